@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "client.h"
+#include "discover.h"
+#include "internetgatewaydevice.h"
+#include "wanconnectionservice.h"
+
+#include <QThread>
+#include <QTimer>
+#include <QPointer>
+#include <QAtomicInt>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_CLIENT, "upnpqt.client", QtInfoMsg)
+
+namespace UpnpQt {
+
+class ClientWorker;
+class ClientPrivate
+{
+public:
+    QThread thread;
+    ClientWorker *worker;
+    QAtomicInt discoveryTimeout{5000};
+};
+
+// Lives on the network thread, everything it touches too
+class ClientWorker : public QObject
+{
+public:
+    ClientWorker(Client *q, ClientPrivate *d);
+    ~ClientWorker();
+
+    void run(const std::function<void(WanConnectionService *)> &job);
+    void discovered(Device *device);
+    void flush(WanConnectionService *srv);
+
+    Client *q_ptr;
+    ClientPrivate *d_ptr;
+    Discover *discover = nullptr;
+    QPointer<WanConnectionService> service;
+    std::vector<std::function<void(WanConnectionService *)>> pending;
+    QTimer *timeout;
+};
+
+}
+
+using namespace UpnpQt;
+
+Client::Client(QObject *parent) : QObject(parent)
+  , d_ptr(new ClientPrivate)
+{
+    Q_D(Client);
+    d->worker = new ClientWorker(this, d);
+    d->worker->moveToThread(&d->thread);
+    connect(&d->thread, &QThread::finished, d->worker, &QObject::deleteLater);
+    d->thread.setObjectName(QStringLiteral("UpnpQt"));
+    d->thread.start();
+}
+
+Client::~Client()
+{
+    Q_D(Client);
+    // the worker is deleted on the way out, failing what is still pending
+    d->thread.quit();
+    d->thread.wait();
+    delete d_ptr;
+}
+
+void Client::setDiscoveryTimeout(int msec)
+{
+    Q_D(Client);
+    d->discoveryTimeout.store(qMax(0, msec));
+}
+
+int Client::discoveryTimeout() const
+{
+    Q_D(const Client);
+    return d->discoveryTimeout.load();
+}
+
+void Client::post(const std::function<void(WanConnectionService *)> &job)
+{
+    Q_D(Client);
+    ClientWorker *worker = d->worker;
+    QMetaObject::invokeMethod(worker, [worker, job] {
+        worker->run(job);
+    }, Qt::QueuedConnection);
+}
+
+ClientWorker::ClientWorker(Client *q, ClientPrivate *d)
+    : q_ptr(q)
+    , d_ptr(d)
+    , timeout(new QTimer(this))
+{
+    timeout->setSingleShot(true);
+    connect(timeout, &QTimer::timeout, this, [=] {
+        qCWarning(UPNPQT_CLIENT) << "No Internet Gateway Device found, failing" << pending.size() << "requests";
+        flush(nullptr);
+    });
+}
+
+ClientWorker::~ClientWorker()
+{
+    flush(nullptr);
+}
+
+void ClientWorker::run(const std::function<void(WanConnectionService *)> &job)
+{
+    if (service) {
+        job(service);
+        return;
+    }
+
+    pending.push_back(job);
+    if (timeout->isActive()) {
+        return;
+    }
+
+    if (!discover) {
+        // created here so its sockets belong to this thread
+        discover = new Discover(this);
+        connect(discover, &Discover::discovered, this, [=] (Device *device) {
+            discovered(device);
+        });
+    }
+
+    qCDebug(UPNPQT_CLIENT) << "discovering gateway for" << pending.size() << "requests";
+    discover->discoverInternetGatewayDevice();
+    timeout->start(d_ptr->discoveryTimeout.load());
+}
+
+void ClientWorker::discovered(Device *device)
+{
+    auto igd = qobject_cast<InternetGatewayDevice *>(device);
+    if (!igd || service) {
+        return;
+    }
+
+    WanConnectionService *srv = igd->wanIpOrPppConnectionService();
+    if (!srv) {
+        return;
+    }
+
+    qCDebug(UPNPQT_CLIENT) << "using gateway" << igd->urlBase();
+    service = srv;
+    timeout->stop();
+    Q_EMIT q_ptr->gatewayFound(igd->urlBase());
+    flush(srv);
+}
+
+void ClientWorker::flush(WanConnectionService *srv)
+{
+    std::vector<std::function<void(WanConnectionService *)>> jobs;
+    jobs.swap(pending);
+    for (const auto &job : jobs) {
+        job(srv);
+    }
+}
+
+#include "moc_client.cpp"
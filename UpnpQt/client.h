@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_CLIENT_H
+#define UPNPQT_CLIENT_H
+
+#include <QObject>
+
+#include <functional>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/future.h>
+
+namespace UpnpQt {
+
+class WanConnectionService;
+
+/**
+ * Runs discovery and all gateway traffic on a dedicated thread.
+ *
+ * Every method is thread-safe. Actions are queued to the network thread
+ * and complete through QFutures, so workers on any thread can map ports
+ * without going through the main event loop; use then() with a context
+ * object to get the completion back on the caller's thread.
+ *
+ * @code
+ * QFuture<Result<QString>> ip = client->invoke([] (WanConnectionService *srv) {
+ *     return srv->getExternalIp();
+ * });
+ * @endcode
+ */
+class ClientPrivate;
+class UPNPQT_LIBRARY Client : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(Client)
+public:
+    explicit Client(QObject *parent = nullptr);
+    virtual ~Client();
+
+    /**
+     * @brief setDiscoveryTimeout
+     * @param msec requests waiting for a gateway fail after this, defaults to 5000
+     */
+    void setDiscoveryTimeout(int msec);
+    int discoveryTimeout() const;
+
+    /**
+     * @brief post runs job on the network thread with the first gateway found
+     *
+     * Jobs posted before a gateway is found wait for discovery, if it
+     * times out they are called with nullptr.
+     */
+    void post(const std::function<void(WanConnectionService *service)> &job);
+
+    /**
+     * @brief invoke calls an action on the network thread
+     * @param func takes the WanConnectionService and returns the Reply of an action
+     * @return QFuture with the action Result, which carries an error when
+     * no gateway was found
+     */
+    template <typename F>
+    auto invoke(F func) -> QFuture<Result<typename Internal::ReplyTraits<decltype(func(static_cast<WanConnectionService *>(nullptr)))>::type>>
+    {
+        typedef decltype(func(static_cast<WanConnectionService *>(nullptr))) ReplyType;
+        typedef typename Internal::ReplyTraits<ReplyType>::type T;
+
+        auto promise = Internal::makeResultPromise<T>();
+        post([=] (WanConnectionService *service) mutable {
+            if (service) {
+                Internal::fulfill(func(service), promise);
+            } else {
+                const Result<T> result = Internal::errorResult<T>(QStringLiteral("No Internet Gateway Device found"));
+                promise->reportFinished(&result);
+            }
+        });
+        return promise->future();
+    }
+
+Q_SIGNALS:
+    /**
+     * Emitted from the network thread when a gateway is selected.
+     */
+    void gatewayFound(const QString &urlBase);
+
+private:
+    ClientPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPQT_CLIENT_H
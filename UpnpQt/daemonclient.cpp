@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "daemonclient.h"
+#include "daemonprotocol.h"
+
+#include <QLocalSocket>
+
+#include <functional>
+#include <unordered_map>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_DAEMONCLIENT, "upnpqt.daemonclient", QtInfoMsg)
+
+namespace UpnpQt {
+
+class DaemonClientPrivate
+{
+public:
+    typedef std::function<void(QDataStream &out)> Writer;
+    typedef std::function<void(QDataStream &in)> Decoder;
+    struct Pending {
+        Reply *reply;
+        Decoder decode;
+    };
+
+    template <typename T>
+    static Decoder decoder(TypedReply<T> *reply) {
+        return [=] (QDataStream &in) {
+            T result;
+            in >> result;
+            if (in.status() != QDataStream::Ok) {
+                reply->finishWithError(QStringLiteral("Invalid response from daemon"));
+            } else {
+                reply->finishWithResult(std::move(result));
+            }
+        };
+    }
+
+    void request(DaemonProtocol::MessageType type, Reply *reply, const Writer &write, const Decoder &decode);
+    void readMessages();
+    void handleMessage(const QByteArray &message);
+    void failPending(const QString &errorString);
+
+    DaemonClient *q_ptr;
+    QLocalSocket socket;
+    QString name;
+    QString gatewayUrlBase;
+    std::unordered_map<quint32, Pending> pending;
+    // requests made while connecting
+    std::vector<QByteArray> queued;
+    quint32 nextRequestId = 1;
+};
+
+}
+
+using namespace UpnpQt;
+
+DaemonClient::DaemonClient(const QString &name, QObject *parent) : QObject(parent)
+  , d_ptr(new DaemonClientPrivate)
+{
+    Q_D(DaemonClient);
+    d->q_ptr = this;
+    d->name = name.isEmpty() ? DaemonProtocol::defaultName() : name;
+
+    connect(&d->socket, &QLocalSocket::connected, this, [=] {
+        qCDebug(UPNPQT_DAEMONCLIENT) << "connected to" << d->socket.fullServerName();
+        const std::vector<QByteArray> queued = std::move(d->queued);
+        d->queued.clear();
+        for (const QByteArray &message : queued) {
+            DaemonProtocol::writeMessage(&d->socket, message);
+        }
+        Q_EMIT connected();
+    });
+    connect(&d->socket, &QLocalSocket::disconnected, this, [=] {
+        qCDebug(UPNPQT_DAEMONCLIENT) << "disconnected from" << d->name;
+        d->gatewayUrlBase.clear();
+        d->failPending(QStringLiteral("Connection to daemon lost"));
+        Q_EMIT disconnected();
+    });
+    connect(&d->socket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error), this, [=] {
+        if (d->socket.state() != QLocalSocket::ConnectedState) {
+            // connecting failed, disconnected is not emitted
+            qCWarning(UPNPQT_DAEMONCLIENT) << "Failed to connect to daemon" << d->name << d->socket.errorString();
+            d->failPending(d->socket.errorString());
+        }
+    });
+    connect(&d->socket, &QLocalSocket::readyRead, this, [=] {
+        d->readMessages();
+    });
+}
+
+DaemonClient::~DaemonClient()
+{
+    // the pending replies are children that go away with us
+    disconnect(&d_ptr->socket, nullptr, this, nullptr);
+    delete d_ptr;
+}
+
+QString DaemonClient::serverName() const
+{
+    Q_D(const DaemonClient);
+    return d->name;
+}
+
+bool DaemonClient::isConnected() const
+{
+    Q_D(const DaemonClient);
+    return d->socket.state() == QLocalSocket::ConnectedState;
+}
+
+QString DaemonClient::gatewayUrlBase() const
+{
+    Q_D(const DaemonClient);
+    return d->gatewayUrlBase;
+}
+
+TypedReply<quint64> *DaemonClient::addPortMapping(const WanConnectionService::PortMap &portMap)
+{
+    Q_D(DaemonClient);
+    auto reply = new TypedReply<quint64>(this);
+    d->request(DaemonProtocol::AddPortMapping, reply, [=] (QDataStream &out) {
+        out << portMap;
+    }, DaemonClientPrivate::decoder(reply));
+    return reply;
+}
+
+Reply *DaemonClient::removePortMapping(quint64 id, bool deleteMapping)
+{
+    Q_D(DaemonClient);
+    auto reply = new Reply(this);
+    d->request(DaemonProtocol::RemovePortMapping, reply, [=] (QDataStream &out) {
+        out << id << deleteMapping;
+    }, [=] (QDataStream &) {
+        reply->finish();
+    });
+    return reply;
+}
+
+TypedReply<QString> *DaemonClient::getExternalIp()
+{
+    Q_D(DaemonClient);
+    auto reply = new TypedReply<QString>(this);
+    d->request(DaemonProtocol::GetExternalIp, reply, DaemonClientPrivate::Writer(), DaemonClientPrivate::decoder(reply));
+    return reply;
+}
+
+TypedReply<std::vector<WanConnectionService::PortMap>> *DaemonClient::getGenericPortMapping()
+{
+    Q_D(DaemonClient);
+    auto reply = new TypedReply<std::vector<WanConnectionService::PortMap>>(this);
+    d->request(DaemonProtocol::GetPortMappings, reply, DaemonClientPrivate::Writer(), DaemonClientPrivate::decoder(reply));
+    return reply;
+}
+
+void DaemonClient::connectToDaemon()
+{
+    Q_D(DaemonClient);
+    if (d->socket.state() == QLocalSocket::UnconnectedState) {
+        d->socket.connectToServer(d->name);
+    }
+}
+
+void DaemonClient::disconnectFromDaemon()
+{
+    Q_D(DaemonClient);
+    d->socket.disconnectFromServer();
+}
+
+void DaemonClientPrivate::request(DaemonProtocol::MessageType type, Reply *reply, const Writer &write, const Decoder &decode)
+{
+    const quint32 requestId = nextRequestId++;
+
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out.setVersion(DaemonProtocol::StreamVersion);
+    out << quint8(type) << requestId;
+    if (write) {
+        write(out);
+    }
+
+    Pending &entry = pending[requestId];
+    entry.reply = reply;
+    entry.decode = decode;
+
+    if (socket.state() == QLocalSocket::ConnectedState) {
+        DaemonProtocol::writeMessage(&socket, message);
+    } else {
+        queued.push_back(message);
+        q_ptr->connectToDaemon();
+    }
+}
+
+void DaemonClientPrivate::readMessages()
+{
+    QDataStream in(&socket);
+    in.setVersion(DaemonProtocol::StreamVersion);
+
+    for (;;) {
+        in.startTransaction();
+        QByteArray message;
+        in >> message;
+        if (!in.commitTransaction()) {
+            return;
+        }
+        handleMessage(message);
+    }
+}
+
+void DaemonClientPrivate::handleMessage(const QByteArray &message)
+{
+    QDataStream in(message);
+    in.setVersion(DaemonProtocol::StreamVersion);
+
+    quint8 type = 0;
+    in >> type;
+    switch (type) {
+    case DaemonProtocol::Response:
+    {
+        quint32 requestId;
+        bool error;
+        QString errorCode;
+        QString errorString;
+        in >> requestId >> error >> errorCode >> errorString;
+
+        auto it = pending.find(requestId);
+        if (in.status() != QDataStream::Ok || it == pending.end()) {
+            qCWarning(UPNPQT_DAEMONCLIENT) << "Unexpected response from daemon" << requestId;
+            return;
+        }
+
+        const Pending entry = it->second;
+        pending.erase(it);
+        if (error) {
+            entry.reply->finishWithError(errorString, errorCode);
+        } else {
+            entry.decode(in);
+        }
+        break;
+    }
+    case DaemonProtocol::MappingLost:
+    {
+        quint64 id;
+        WanConnectionService::PortMap portMap;
+        in >> id >> portMap;
+        if (in.status() == QDataStream::Ok) {
+            Q_EMIT q_ptr->lost(id, portMap);
+        }
+        break;
+    }
+    case DaemonProtocol::GatewayChanged:
+    {
+        QString urlBase;
+        in >> urlBase;
+        if (in.status() == QDataStream::Ok && urlBase != gatewayUrlBase) {
+            gatewayUrlBase = urlBase;
+            Q_EMIT q_ptr->gatewayChanged(urlBase);
+        }
+        break;
+    }
+    default:
+        qCWarning(UPNPQT_DAEMONCLIENT) << "Unknown message from daemon" << type;
+    }
+}
+
+void DaemonClientPrivate::failPending(const QString &errorString)
+{
+    queued.clear();
+
+    std::unordered_map<quint32, Pending> failed;
+    failed.swap(pending);
+    for (const auto &item : failed) {
+        item.second.reply->finishWithError(errorString);
+    }
+}
+
+#include "moc_daemonclient.cpp"
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPDAEMONCLIENT_H
+#define UPNPDAEMONCLIENT_H
+
+#include <QObject>
+
+#include <vector>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/reply.h>
+#include <UpnpQt/wanconnectionservice.h>
+
+namespace UpnpQt {
+
+/**
+ * Talks to a DaemonServer instead of running discovery in this process.
+ *
+ * The connection is made on the first request, mappings added through
+ * it are renewed by the daemon until removed or this client disconnects.
+ * Replies pending when the connection is lost finish with an error.
+ */
+class DaemonClientPrivate;
+class UPNPQT_LIBRARY DaemonClient : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(DaemonClient)
+public:
+    /**
+     * @brief DaemonClient
+     * @param name of the daemon socket, empty for DaemonServer::defaultName()
+     */
+    explicit DaemonClient(const QString &name = QString(), QObject *parent = nullptr);
+    virtual ~DaemonClient();
+
+    QString serverName() const;
+    bool isConnected() const;
+
+    /**
+     * @brief gatewayUrlBase
+     * @return the daemon's active gateway, empty if none is healthy
+     */
+    QString gatewayUrlBase() const;
+
+    /**
+     * @brief addPortMapping
+     * @return the id of the mapping in the daemon to remove it with
+     */
+    TypedReply<quint64> *addPortMapping(const WanConnectionService::PortMap &portMap);
+    Reply *removePortMapping(quint64 id, bool deleteMapping = true);
+    TypedReply<QString> *getExternalIp();
+
+    /**
+     * @brief getGenericPortMapping
+     * @return every mapping on the daemon's active gateway
+     */
+    TypedReply<std::vector<WanConnectionService::PortMap>> *getGenericPortMapping();
+
+public Q_SLOTS:
+    void connectToDaemon();
+    void disconnectFromDaemon();
+
+Q_SIGNALS:
+    void connected();
+    void disconnected();
+
+    /**
+     * Emitted when the daemon failed to renew a mapping, it's no longer managed.
+     */
+    void lost(quint64 id, const UpnpQt::WanConnectionService::PortMap &portMap);
+    void gatewayChanged(const QString &urlBase);
+
+private:
+    DaemonClientPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPDAEMONCLIENT_H
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPDAEMONPROTOCOL_H
+#define UPNPDAEMONPROTOCOL_H
+
+#include <QDataStream>
+#include <QIODevice>
+
+#include <vector>
+
+#include "wanconnectionservice.h"
+
+namespace UpnpQt {
+
+/**
+ * Wire format shared by DaemonServer and DaemonClient.
+ *
+ * Every message is a QByteArray as written by QDataStream, a 32 bit
+ * length followed by the body, so a whole message can be read in one
+ * transaction and parsed on its own. The body starts with a MessageType
+ * byte, requests and responses follow it with the request id.
+ */
+namespace DaemonProtocol {
+
+enum MessageType : quint8 {
+    // requests: id
+    AddPortMapping = 1, // PortMap; response: mapping id
+    RemovePortMapping, // mapping id, deleteMapping
+    GetExternalIp, // response: QString
+    GetPortMappings, // response: count, PortMap...
+
+    // id, error, errorCode, errorString, payload
+    Response = 0x80,
+
+    // events: mapping id, PortMap
+    MappingLost,
+    // urlBase, empty when no gateway is healthy
+    GatewayChanged,
+};
+
+static const QDataStream::Version StreamVersion = QDataStream::Qt_5_12;
+
+inline QString defaultName()
+{
+    return QStringLiteral("upnpqtd");
+}
+
+inline void writeMessage(QIODevice *device, const QByteArray &body)
+{
+    QDataStream out(device);
+    out.setVersion(StreamVersion);
+    out << body;
+}
+
+}
+
+inline QDataStream &operator<<(QDataStream &out, const WanConnectionService::PortMap &portMap)
+{
+    out << portMap.externalPort
+        << portMap.internalPort
+        << qint32(portMap.leaseDuration)
+        << portMap.enabled
+        << qint8(portMap.sockType())
+        << portMap.internalAddress()
+        << portMap.remoteHost()
+        << portMap.description();
+    return out;
+}
+
+inline QDataStream &operator>>(QDataStream &in, WanConnectionService::PortMap &portMap)
+{
+    qint32 leaseDuration;
+    qint8 sockType;
+    QString internalAddress;
+    QString remoteHost;
+    QString description;
+    in >> portMap.externalPort
+       >> portMap.internalPort
+       >> leaseDuration
+       >> portMap.enabled
+       >> sockType
+       >> internalAddress
+       >> remoteHost
+       >> description;
+
+    portMap.leaseDuration = leaseDuration;
+    portMap.setSockType(sockType == QAbstractSocket::UdpSocket ? QAbstractSocket::UdpSocket : QAbstractSocket::TcpSocket);
+    portMap.setInternalAddress(internalAddress);
+    portMap.setRemoteHost(remoteHost);
+    portMap.setDescription(description);
+    return in;
+}
+
+inline QDataStream &operator<<(QDataStream &out, const std::vector<WanConnectionService::PortMap> &portMaps)
+{
+    out << quint32(portMaps.size());
+    for (const WanConnectionService::PortMap &portMap : portMaps) {
+        out << portMap;
+    }
+    return out;
+}
+
+inline QDataStream &operator>>(QDataStream &in, std::vector<WanConnectionService::PortMap> &portMaps)
+{
+    quint32 count;
+    in >> count;
+    portMaps.clear();
+    // the count is not trusted to reserve memory, a short message runs out first
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        WanConnectionService::PortMap portMap;
+        in >> portMap;
+        portMaps.push_back(portMap);
+    }
+    return in;
+}
+
+}
+
+#endif // UPNPDAEMONPROTOCOL_H
@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "daemonserver.h"
+#include "daemonprotocol.h"
+#include "discover.h"
+#include "device.h"
+#include "internetgatewaydevice.h"
+#include "gatewaymanager.h"
+#include "mappingregistry.h"
+#include "wanconnectionservice.h"
+#include "reply.h"
+
+#include <QLocalSocket>
+#include <QPointer>
+#include <QTimer>
+#include <QHash>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_DAEMON, "upnpqt.daemon", QtInfoMsg)
+
+namespace UpnpQt {
+
+class DaemonServerPrivate
+{
+public:
+    typedef std::function<void(WanConnectionService *service)> GatewayCallback;
+
+    void readRequests(QLocalSocket *socket);
+    void handleRequest(QLocalSocket *socket, const QByteArray &message);
+    void addPortMapping(QLocalSocket *socket, quint32 requestId, const WanConnectionService::PortMap &portMap);
+    void removePortMapping(QLocalSocket *socket, quint32 requestId, quint64 id, bool deleteMapping);
+    void dropConnection(QLocalSocket *socket);
+    void withGateway(const GatewayCallback &callback);
+    void bestGatewayChanged(WanConnectionService *service);
+    void mappingLost(quint64 id, const WanConnectionService::PortMap &portMap);
+    void broadcast(const QByteArray &message);
+    void forgetDevice(const QString &urlBase, Device *device);
+
+    static QByteArray response(quint32 requestId, bool error = false, const QString &errorCode = QString(), const QString &errorString = QString());
+    static void writeReplyError(QLocalSocket *socket, quint32 requestId, const Reply *reply);
+
+    DaemonServer *q_ptr;
+    QLocalServer server;
+    Discover *discover;
+    GatewayManager *manager;
+    MappingRegistry *registry;
+    // mappings added by each client, removed when it disconnects
+    QHash<QLocalSocket *, std::vector<quint64>> connections;
+    std::unordered_map<quint64, QLocalSocket *> owners;
+    // requests waiting for a healthy gateway
+    std::map<quint64, GatewayCallback> waiting;
+    quint64 nextWaiting = 1;
+    // the first device seen at each urlBase
+    QHash<QString, Device *> knownDevices;
+    QTimer rediscover;
+    int gatewayTimeout = 5000;
+};
+
+}
+
+using namespace UpnpQt;
+
+DaemonServer::DaemonServer(QObject *parent) : QObject(parent)
+  , d_ptr(new DaemonServerPrivate)
+{
+    Q_D(DaemonServer);
+    d->q_ptr = this;
+    d->server.setSocketOptions(QLocalServer::UserAccessOption);
+    d->discover = new Discover(this);
+    d->registry = new MappingRegistry(this);
+    d->manager = new GatewayManager(this);
+    d->manager->setRegistry(d->registry);
+
+    connect(d->discover, &Discover::discovered, this, [=] (Device *device) {
+        // every NOTIFY and search answer produces a new device, keep the first one
+        if (d->knownDevices.contains(device->urlBase())) {
+            device->deleteLater();
+            return;
+        }
+        const QString urlBase = device->urlBase();
+        d->knownDevices.insert(urlBase, device);
+
+        // forgotten with the device or its service, so a restarted gateway is picked up again
+        connect(device, &QObject::destroyed, this, [=] {
+            d->forgetDevice(urlBase, device);
+        });
+        auto igd = qobject_cast<InternetGatewayDevice *>(device);
+        if (WanConnectionService *service = igd ? igd->wanIpOrPppConnectionService() : nullptr) {
+            connect(service, &QObject::destroyed, this, [=] {
+                d->forgetDevice(urlBase, device);
+            });
+        }
+
+        d->manager->addDevice(device);
+    });
+    connect(d->manager, &GatewayManager::bestGatewayChanged, this, [=] (WanConnectionService *service) {
+        d->bestGatewayChanged(service);
+    });
+    connect(d->registry, &MappingRegistry::lost, this, [=] (quint64 id, const WanConnectionService::PortMap &portMap) {
+        d->mappingLost(id, portMap);
+    });
+
+    // searched again for as long as no gateway is healthy
+    d->rediscover.setInterval(30000);
+    connect(&d->rediscover, &QTimer::timeout, d->discover, &Discover::discoverInternetGatewayDevice);
+
+    connect(&d->server, &QLocalServer::newConnection, this, [=] {
+        while (QLocalSocket *socket = d->server.nextPendingConnection()) {
+            d->connections.insert(socket, std::vector<quint64>());
+            connect(socket, &QLocalSocket::readyRead, this, [=] {
+                d->readRequests(socket);
+            });
+            connect(socket, &QLocalSocket::disconnected, this, [=] {
+                d->dropConnection(socket);
+            });
+
+            qCDebug(UPNPQT_DAEMON) << "client connected" << d->connections.size();
+            if (WanConnectionService *service = d->manager->bestGateway()) {
+                QByteArray message;
+                QDataStream out(&message, QIODevice::WriteOnly);
+                out.setVersion(DaemonProtocol::StreamVersion);
+                out << quint8(DaemonProtocol::GatewayChanged) << d->manager->health(service).urlBase;
+                DaemonProtocol::writeMessage(socket, message);
+            }
+            Q_EMIT clientConnected();
+        }
+    });
+}
+
+DaemonServer::~DaemonServer()
+{
+    delete d_ptr;
+}
+
+QString DaemonServer::defaultName()
+{
+    return DaemonProtocol::defaultName();
+}
+
+void DaemonServer::setSocketOptions(QLocalServer::SocketOptions options)
+{
+    Q_D(DaemonServer);
+    d->server.setSocketOptions(options);
+}
+
+QLocalServer::SocketOptions DaemonServer::socketOptions() const
+{
+    Q_D(const DaemonServer);
+    return d->server.socketOptions();
+}
+
+void DaemonServer::setGatewayTimeout(int msec)
+{
+    Q_D(DaemonServer);
+    d->gatewayTimeout = qMax(0, msec);
+}
+
+int DaemonServer::gatewayTimeout() const
+{
+    Q_D(const DaemonServer);
+    return d->gatewayTimeout;
+}
+
+bool DaemonServer::listen(const QString &name)
+{
+    Q_D(DaemonServer);
+    if (!d->server.listen(name)) {
+        if (d->server.serverError() != QAbstractSocket::AddressInUseError) {
+            qCWarning(UPNPQT_DAEMON) << "Failed to listen on" << name << d->server.errorString();
+            return false;
+        }
+
+        QLocalSocket probe;
+        probe.connectToServer(name);
+        if (probe.waitForConnected(1000)) {
+            qCWarning(UPNPQT_DAEMON) << "Another daemon is listening on" << name;
+            return false;
+        }
+
+        qCInfo(UPNPQT_DAEMON) << "Removing stale socket" << name;
+        QLocalServer::removeServer(name);
+        if (!d->server.listen(name)) {
+            qCWarning(UPNPQT_DAEMON) << "Failed to listen on" << name << d->server.errorString();
+            return false;
+        }
+    }
+
+    qCInfo(UPNPQT_DAEMON) << "Listening on" << d->server.fullServerName();
+    d->rediscover.start();
+    d->discover->discoverInternetGatewayDevice();
+    return true;
+}
+
+void DaemonServer::close()
+{
+    Q_D(DaemonServer);
+    d->server.close();
+    d->rediscover.stop();
+
+    const QList<QLocalSocket *> sockets = d->connections.keys();
+    for (QLocalSocket *socket : sockets) {
+        socket->abort();
+        d->dropConnection(socket);
+    }
+}
+
+bool DaemonServer::isListening() const
+{
+    Q_D(const DaemonServer);
+    return d->server.isListening();
+}
+
+QString DaemonServer::serverName() const
+{
+    Q_D(const DaemonServer);
+    return d->server.serverName();
+}
+
+QString DaemonServer::errorString() const
+{
+    Q_D(const DaemonServer);
+    return d->server.errorString();
+}
+
+int DaemonServer::clientCount() const
+{
+    Q_D(const DaemonServer);
+    return d->connections.size();
+}
+
+Discover *DaemonServer::discover() const
+{
+    Q_D(const DaemonServer);
+    return d->discover;
+}
+
+GatewayManager *DaemonServer::gatewayManager() const
+{
+    Q_D(const DaemonServer);
+    return d->manager;
+}
+
+MappingRegistry *DaemonServer::registry() const
+{
+    Q_D(const DaemonServer);
+    return d->registry;
+}
+
+void DaemonServerPrivate::readRequests(QLocalSocket *socket)
+{
+    QDataStream in(socket);
+    in.setVersion(DaemonProtocol::StreamVersion);
+
+    while (connections.contains(socket)) {
+        in.startTransaction();
+        QByteArray message;
+        in >> message;
+        if (!in.commitTransaction()) {
+            return;
+        }
+        handleRequest(socket, message);
+    }
+}
+
+void DaemonServerPrivate::handleRequest(QLocalSocket *socket, const QByteArray &message)
+{
+    QDataStream in(message);
+    in.setVersion(DaemonProtocol::StreamVersion);
+
+    quint8 type = 0;
+    quint32 requestId = 0;
+    in >> type >> requestId;
+    if (in.status() != QDataStream::Ok) {
+        qCWarning(UPNPQT_DAEMON) << "Truncated request, dropping client";
+        socket->abort();
+        return;
+    }
+
+    QPointer<QLocalSocket> guard(socket);
+    switch (type) {
+    case DaemonProtocol::AddPortMapping:
+    {
+        WanConnectionService::PortMap portMap;
+        in >> portMap;
+        if (in.status() == QDataStream::Ok) {
+            addPortMapping(socket, requestId, portMap);
+            return;
+        }
+        break;
+    }
+    case DaemonProtocol::RemovePortMapping:
+    {
+        quint64 id;
+        bool deleteMapping;
+        in >> id >> deleteMapping;
+        if (in.status() == QDataStream::Ok) {
+            removePortMapping(socket, requestId, id, deleteMapping);
+            return;
+        }
+        break;
+    }
+    case DaemonProtocol::GetExternalIp:
+        withGateway([=] (WanConnectionService *service) {
+            if (!guard) {
+                return;
+            }
+            if (!service) {
+                DaemonProtocol::writeMessage(guard, response(requestId, true, QString(), QStringLiteral("No gateway available")));
+                return;
+            }
+
+            auto reply = service->getExternalIp();
+            QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+                if (!guard) {
+                    return;
+                }
+                if (reply->error()) {
+                    writeReplyError(guard, requestId, reply);
+                    return;
+                }
+
+                QByteArray message = response(requestId);
+                QDataStream out(&message, QIODevice::WriteOnly | QIODevice::Append);
+                out.setVersion(DaemonProtocol::StreamVersion);
+                out << reply->result();
+                DaemonProtocol::writeMessage(guard, message);
+            });
+        });
+        return;
+    case DaemonProtocol::GetPortMappings:
+        withGateway([=] (WanConnectionService *service) {
+            if (!guard) {
+                return;
+            }
+            if (!service) {
+                DaemonProtocol::writeMessage(guard, response(requestId, true, QString(), QStringLiteral("No gateway available")));
+                return;
+            }
+
+            auto reply = service->getGenericPortMapping();
+            QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+                if (!guard) {
+                    return;
+                }
+                if (reply->error()) {
+                    writeReplyError(guard, requestId, reply);
+                    return;
+                }
+
+                const std::vector<WanConnectionService::PortMap> portMaps = reply->takeResult();
+                QByteArray message = response(requestId);
+                QDataStream out(&message, QIODevice::WriteOnly | QIODevice::Append);
+                out.setVersion(DaemonProtocol::StreamVersion);
+                out << portMaps;
+                DaemonProtocol::writeMessage(guard, message);
+            });
+        });
+        return;
+    default:
+        break;
+    }
+
+    qCWarning(UPNPQT_DAEMON) << "Invalid request" << type << "dropping client";
+    socket->abort();
+}
+
+void DaemonServerPrivate::addPortMapping(QLocalSocket *socket, quint32 requestId, const WanConnectionService::PortMap &portMap)
+{
+    QPointer<QLocalSocket> guard(socket);
+    withGateway([=] (WanConnectionService *service) {
+        if (!guard) {
+            return;
+        }
+        if (!service) {
+            DaemonProtocol::writeMessage(guard, response(requestId, true, QString(), QStringLiteral("No gateway available")));
+            return;
+        }
+
+        // added here rather than with MappingRegistry::add() so the
+        // client gets the gateway's error code
+        Reply *reply = service->addPortMapping(portMap.externalPort, portMap.internalAddress(), portMap.internalPort, portMap.sockType(),
+                                               portMap.description(), portMap.enabled, portMap.leaseDuration, portMap.remoteHost());
+        QPointer<WanConnectionService> serviceGuard(service);
+        QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+            if (reply->error()) {
+                if (guard) {
+                    writeReplyError(guard, requestId, reply);
+                }
+                return;
+            }
+
+            if (!guard || !connections.contains(guard)) {
+                // nobody is left to own it
+                if (serviceGuard) {
+                    serviceGuard->deletePortMapping(portMap.externalPort, portMap.sockType(), portMap.remoteHost());
+                }
+                return;
+            }
+
+            const quint64 id = registry->track(serviceGuard, portMap);
+            connections[guard].push_back(id);
+            owners[id] = guard;
+            qCDebug(UPNPQT_DAEMON) << "added" << id << portMap.externalPort << portMap.sockType();
+
+            QByteArray message = response(requestId);
+            QDataStream out(&message, QIODevice::WriteOnly | QIODevice::Append);
+            out.setVersion(DaemonProtocol::StreamVersion);
+            out << id;
+            DaemonProtocol::writeMessage(guard, message);
+        });
+    });
+}
+
+void DaemonServerPrivate::removePortMapping(QLocalSocket *socket, quint32 requestId, quint64 id, bool deleteMapping)
+{
+    auto it = owners.find(id);
+    if (it == owners.end() || it->second != socket) {
+        DaemonProtocol::writeMessage(socket, response(requestId, true, QString(), QStringLiteral("Unknown mapping")));
+        return;
+    }
+
+    owners.erase(it);
+    std::vector<quint64> &ids = connections[socket];
+    ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+    registry->remove(id, deleteMapping);
+
+    DaemonProtocol::writeMessage(socket, response(requestId));
+}
+
+void DaemonServerPrivate::dropConnection(QLocalSocket *socket)
+{
+    auto it = connections.find(socket);
+    if (it == connections.end()) {
+        return;
+    }
+
+    const std::vector<quint64> ids = it.value();
+    connections.erase(it);
+    for (quint64 id : ids) {
+        owners.erase(id);
+        registry->remove(id, true);
+    }
+
+    qCDebug(UPNPQT_DAEMON) << "client disconnected, removed" << ids.size() << "mappings";
+    socket->deleteLater();
+    Q_EMIT q_ptr->clientDisconnected();
+}
+
+void DaemonServerPrivate::withGateway(const GatewayCallback &callback)
+{
+    WanConnectionService *service = manager->bestGateway();
+    if (service) {
+        callback(service);
+        return;
+    }
+
+    const quint64 id = nextWaiting++;
+    waiting[id] = callback;
+    QTimer::singleShot(gatewayTimeout, q_ptr, [=] {
+        auto it = waiting.find(id);
+        if (it != waiting.end()) {
+            const GatewayCallback pending = it->second;
+            waiting.erase(it);
+            pending(nullptr);
+        }
+    });
+}
+
+void DaemonServerPrivate::bestGatewayChanged(WanConnectionService *service)
+{
+    const QString urlBase = service ? manager->health(service).urlBase : QString();
+    qCInfo(UPNPQT_DAEMON) << "Active gateway" << urlBase;
+
+    if (service) {
+        rediscover.stop();
+    } else if (server.isListening()) {
+        rediscover.start();
+        discover->discoverInternetGatewayDevice();
+    }
+
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out.setVersion(DaemonProtocol::StreamVersion);
+    out << quint8(DaemonProtocol::GatewayChanged) << urlBase;
+    broadcast(message);
+
+    if (service) {
+        std::map<quint64, GatewayCallback> ready;
+        ready.swap(waiting);
+        for (const auto &item : ready) {
+            item.second(service);
+        }
+    }
+}
+
+void DaemonServerPrivate::mappingLost(quint64 id, const WanConnectionService::PortMap &portMap)
+{
+    auto it = owners.find(id);
+    if (it == owners.end()) {
+        return;
+    }
+
+    QLocalSocket *socket = it->second;
+    owners.erase(it);
+    std::vector<quint64> &ids = connections[socket];
+    ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out.setVersion(DaemonProtocol::StreamVersion);
+    out << quint8(DaemonProtocol::MappingLost) << id << portMap;
+    DaemonProtocol::writeMessage(socket, message);
+}
+
+void DaemonServerPrivate::broadcast(const QByteArray &message)
+{
+    for (auto it = connections.constBegin(); it != connections.constEnd(); ++it) {
+        DaemonProtocol::writeMessage(it.key(), message);
+    }
+}
+
+void DaemonServerPrivate::forgetDevice(const QString &urlBase, Device *device)
+{
+    // a newer device may already be known at that urlBase
+    auto it = knownDevices.find(urlBase);
+    if (it != knownDevices.end() && it.value() == device) {
+        qCDebug(UPNPQT_DAEMON) << "forgetting" << urlBase;
+        knownDevices.erase(it);
+    }
+}
+
+QByteArray DaemonServerPrivate::response(quint32 requestId, bool error, const QString &errorCode, const QString &errorString)
+{
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    out.setVersion(DaemonProtocol::StreamVersion);
+    out << quint8(DaemonProtocol::Response) << requestId << error << errorCode << errorString;
+    return message;
+}
+
+void DaemonServerPrivate::writeReplyError(QLocalSocket *socket, quint32 requestId, const Reply *reply)
+{
+    DaemonProtocol::writeMessage(socket, response(requestId, true, reply->errorCode(), reply->errorString()));
+}
+
+#include "moc_daemonserver.cpp"
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPDAEMONSERVER_H
+#define UPNPDAEMONSERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+
+#include <UpnpQt/global.h>
+
+namespace UpnpQt {
+
+class Discover;
+class GatewayManager;
+class MappingRegistry;
+
+/**
+ * Owns discovery, the gateways and the mapping registry for every
+ * process of the host, DaemonClient talks to it over a local socket.
+ *
+ * Mappings are renewed for as long as the client that added them stays
+ * connected and deleted from the gateway when it goes away.
+ */
+class DaemonServerPrivate;
+class UPNPQT_LIBRARY DaemonServer : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(DaemonServer)
+public:
+    explicit DaemonServer(QObject *parent = nullptr);
+    virtual ~DaemonServer();
+
+    /**
+     * @brief defaultName
+     * @return the socket name clients connect to by default, "upnpqtd"
+     */
+    static QString defaultName();
+
+    /**
+     * @brief setSocketOptions
+     * @param options defaults to QLocalServer::UserAccessOption, must be set before listen()
+     */
+    void setSocketOptions(QLocalServer::SocketOptions options);
+    QLocalServer::SocketOptions socketOptions() const;
+
+    /**
+     * @brief setGatewayTimeout
+     * @param msec requests received while no gateway is healthy wait this long for one, defaults to 5000
+     */
+    void setGatewayTimeout(int msec);
+    int gatewayTimeout() const;
+
+    /**
+     * @brief listen
+     *
+     * A socket left behind by a daemon that is no longer running is removed,
+     * discovery starts once listening.
+     * @return false if another daemon is listening on name or it failed
+     */
+    bool listen(const QString &name = defaultName());
+    void close();
+    bool isListening() const;
+    QString serverName() const;
+    QString errorString() const;
+
+    int clientCount() const;
+
+    Discover *discover() const;
+    GatewayManager *gatewayManager() const;
+    MappingRegistry *registry() const;
+
+Q_SIGNALS:
+    void clientConnected();
+    void clientDisconnected();
+
+private:
+    DaemonServerPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPDAEMONSERVER_H
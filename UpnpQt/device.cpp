@@ -20,6 +20,8 @@
 #include "internetgatewaydevice.h"
 #include "wanconnectiondevice.h"
 #include "wanconnectionservice.h"
+#include "wanipv6firewallcontrolservice.h"
+#include "wancommoninterfaceconfigservice.h"
 #include "service.h"
 #include "service_p.h"
 
@@ -191,8 +193,13 @@ Service *parseService(QXmlStreamReader &xml, QObject *parent)
     qCDebug(UPNPQT_XML) << "SERIVCE TYPE" << priv->type;
     if (priv->type == QLatin1String("urn:schemas-upnp-org:service:WANPPPConnection:1")) {
         return new WanConnectionService(priv, parent);
-    } else if (priv->type == QLatin1String("urn:schemas-upnp-org:service:WANIPConnection:1")) {
+    } else if (priv->type == QLatin1String("urn:schemas-upnp-org:service:WANIPConnection:1") ||
+               priv->type == QLatin1String("urn:schemas-upnp-org:service:WANIPConnection:2")) {
         return new WanConnectionService(priv, parent);
+    } else if (priv->type == QLatin1String("urn:schemas-upnp-org:service:WANIPv6FirewallControl:1")) {
+        return new WanIpv6FirewallControlService(priv, parent);
+    } else if (priv->type == QLatin1String("urn:schemas-upnp-org:service:WANCommonInterfaceConfig:1")) {
+        return new WanCommonInterfaceConfigService(priv, parent);
     }
     return new Service(priv, parent);
 }
@@ -266,9 +273,11 @@ Device *parseDevice(QXmlStreamReader &xml, Discover *parent)
     }
 
     qCDebug(UPNPQT_XML) << "DEVICE TYPE" << priv->type;
-    if (priv->type == QLatin1String("urn:schemas-upnp-org:device:InternetGatewayDevice:1")) {
+    if (priv->type == QLatin1String("urn:schemas-upnp-org:device:InternetGatewayDevice:1") ||
+            priv->type == QLatin1String("urn:schemas-upnp-org:device:InternetGatewayDevice:2")) {
         return new InternetGatewayDevice(priv, parent);
-    } else if (priv->type == QLatin1String("urn:schemas-upnp-org:device:WANConnectionDevice:1")) {
+    } else if (priv->type == QLatin1String("urn:schemas-upnp-org:device:WANConnectionDevice:1") ||
+               priv->type == QLatin1String("urn:schemas-upnp-org:device:WANConnectionDevice:2")) {
         return new WANConnectionDevice(priv, parent);
     }
     return new Device(priv, parent);
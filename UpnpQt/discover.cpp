@@ -17,6 +17,8 @@
  */
 #include "discover.h"
 #include "device.h"
+#include "metrics.h"
+#include "tracer.h"
 
 #include <unistd.h>
 #include <sys/socket.h>
@@ -30,6 +32,7 @@
 #include <QUdpSocket>
 #include <QNetworkReply>
 #include <QNetworkAccessManager>
+#include <QElapsedTimer>
 
 #include <QLoggingCategory>
 
@@ -47,12 +50,17 @@ public:
           groupAddress(QStringLiteral("239.255.255.250"))
     {}
 
+    void search(const QHostAddress &address, quint16 port);
     void parse(const QByteArray &data, Discover *parent);
+    void fetch(const QUrl &location, const QString &server, Discover *parent);
 
     Discover *q_ptr;
     QNetworkAccessManager *nam;
     QUdpSocket udpSocket4;
     QHostAddress groupAddress;
+    quint64 traceId = 0;
+    // open from the M-SEARCH until the first valid answer
+    quint64 searchSpan = 0;
 };
 
 }
@@ -83,6 +91,7 @@ Discover::Discover(QObject *parent) : QObject(parent)
         }
 
         qCDebug(UPNPQT_DISCOVER) << "Got data" << data;
+        Metrics::instance()->ssdpReceived();
 
         d->parse(data, this);
     });
@@ -120,6 +129,31 @@ void Discover::discoverInternetGatewayDevice()
 
     qCInfo(UPNPQT_DISCOVER) << "Trying to find UPnP devices on the local network";
 
+    d->search(d->groupAddress, 1900);
+}
+
+void Discover::discoverInternetGatewayDeviceAt(const QHostAddress &address, quint16 port)
+{
+    Q_D(Discover);
+
+    qCInfo(UPNPQT_DISCOVER) << "Trying to find UPnP devices at" << address << port;
+
+    d->search(address, port);
+}
+
+void Discover::discoverLocation(const QUrl &location)
+{
+    Q_D(Discover);
+
+    Tracer *tracer = Tracer::instance();
+    if (tracer->isEnabled()) {
+        d->traceId = tracer->newCorrelationId();
+    }
+    d->fetch(location, QString(), this);
+}
+
+void DiscoverPrivate::search(const QHostAddress &address, quint16 port)
+{
     // send a HTTP M-SEARCH message to 239.255.255.250:1900
     const char* upnp_data = "M-SEARCH * HTTP/1.1\r\n"
                             "HOST: 239.255.255.250:1900\r\n"
@@ -138,8 +172,15 @@ void Discover::discoverInternetGatewayDevice()
     qCDebug(UPNPQT_DISCOVER) << "Sending" << upnp_data;
     qCDebug(UPNPQT_DISCOVER) << "Sending" << tr64_data;
 
-    d->udpSocket4.writeDatagram(upnp_data, qstrlen(upnp_data), d->groupAddress, 1900);
-    d->udpSocket4.writeDatagram(tr64_data, qstrlen(tr64_data), d->groupAddress, 1900);
+    Tracer *tracer = Tracer::instance();
+    if (tracer->isEnabled()) {
+        tracer->end(searchSpan);
+        traceId = tracer->newCorrelationId();
+        searchSpan = tracer->begin(QStringLiteral("ssdp.search"), QStringLiteral("discover"), traceId);
+    }
+
+    udpSocket4.writeDatagram(upnp_data, qstrlen(upnp_data), address, port);
+    udpSocket4.writeDatagram(tr64_data, qstrlen(tr64_data), address, port);
 }
 
 void DiscoverPrivate::parse(const QByteArray &data, Discover *parent)
@@ -153,9 +194,11 @@ void DiscoverPrivate::parse(const QByteArray &data, Discover *parent)
     if (!line.contains(QLatin1String("HTTP"), Qt::CaseInsensitive)) {
         // it is either a 200 OK or a NOTIFY
         if (!line.contains(QLatin1String("NOTIFY"), Qt::CaseInsensitive) && !line.contains(QLatin1String("200"))) {
+            Metrics::instance()->ssdpDropped();
             return;
         }
     } else if (line.contains(QLatin1String("M-SEARCH"), Qt::CaseInsensitive)) { // ignore M-SEARCH
+        Metrics::instance()->ssdpDropped();
         return;
     }
 
@@ -172,6 +215,7 @@ void DiscoverPrivate::parse(const QByteArray &data, Discover *parent)
 
     if (!validDevice) {
         qCDebug(UPNPQT_DISCOVER) << "Not a valid Internet Gateway Device" << server << location;
+        Metrics::instance()->ssdpDropped();
         return;
     }
 
@@ -181,30 +225,76 @@ void DiscoverPrivate::parse(const QByteArray &data, Discover *parent)
         if (line.startsWith(QLatin1String("Location"), Qt::CaseInsensitive)) {
             location = QUrl(line.mid(line.indexOf(QLatin1Char(':')) + 1).trimmed());
             if (!location.isValid()) {
+                Metrics::instance()->ssdpDropped();
                 return;
             }
         } else if (line.startsWith(QLatin1String("Server"), Qt::CaseInsensitive)) {
             server = line.mid(line.indexOf(QLatin1Char(':')) + 1).trimmed();
             if (server.length() == 0) {
+                Metrics::instance()->ssdpDropped();
                 return;
             }
         }
     }
+    Metrics::instance()->ssdpParsed();
+
+    if (searchSpan) {
+        Tracer::instance()->end(searchSpan, {
+                                    {QStringLiteral("location"), location.toString()},
+                                    {QStringLiteral("server"), server},
+                                });
+        searchSpan = 0;
+    }
 
     qDebug(UPNPQT_DISCOVER) << "Detected IGD " << server << location << ", downloading it's XML file.";
+    fetch(location, server, parent);
+}
+
+void DiscoverPrivate::fetch(const QUrl &location, const QString &server, Discover *parent)
+{
+    Tracer *tracer = Tracer::instance();
+    const quint64 correlationId = traceId;
+    quint64 fetchSpan = 0;
+    if (tracer->isEnabled()) {
+        fetchSpan = tracer->begin(QStringLiteral("description.fetch"), QStringLiteral("discover"), correlationId, {
+                                      {QStringLiteral("location"), location.toString()},
+                                  });
+    }
+
     QNetworkRequest request(location);
+    QElapsedTimer elapsed;
+    elapsed.start();
     QNetworkReply *reply = nam->get(request);
     connect(reply, &QNetworkReply::finished, this, [=] {
         reply->deleteLater();
+        Metrics::instance()->descriptionFetched(elapsed.elapsed());
 
         const QByteArray data = reply->readAll();
+        Tracer *tracer = Tracer::instance();
+        if (fetchSpan) {
+            tracer->end(fetchSpan, {
+                            {QStringLiteral("bytes"), QString::number(data.size())},
+                            {QStringLiteral("error"), QString::number(reply->error())},
+                        });
+        }
+
         qDebug(UPNPQT_DISCOVER) << "downloaded XML" << server << location << data.constData();
         if (!reply->error()) {
+            const quint64 parseSpan = tracer->begin(QStringLiteral("device.fromXml"), QStringLiteral("discover"), correlationId);
             Device *dev = Device::fromXml(data, parent);
+            tracer->end(parseSpan);
             if (dev) {
                 if (dev->urlBase().isEmpty()) {
                     dev->setUrlBase(location.toString());
                 }
+                // actions on this device join the discovery timeline
+                if (tracer->isEnabled()) {
+                    const QString urlBase = dev->urlBase();
+                    tracer->bind(urlBase, correlationId);
+                    QObject::connect(dev, &QObject::destroyed, [=] {
+                        Tracer::instance()->unbind(urlBase, correlationId);
+                    });
+                }
                 Q_EMIT q_ptr->discovered(dev);
             }
         }
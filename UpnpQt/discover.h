@@ -23,6 +23,8 @@
 #include <UpnpQt/global.h>
 
 class QNetworkAccessManager;
+class QHostAddress;
+class QUrl;
 
 namespace UpnpQt {
 
@@ -41,6 +43,19 @@ public:
 public Q_SLOTS:
     void discoverInternetGatewayDevice();
 
+    /**
+     * @brief discoverInternetGatewayDeviceAt
+     * Sends the M-SEARCH to a single host instead of the multicast group,
+     * i.e. a router that doesn't join it or an IgdEmulator on loopback
+     */
+    void discoverInternetGatewayDeviceAt(const QHostAddress &address, quint16 port = 1900);
+
+    /**
+     * @brief discoverLocation
+     * Skips SSDP and downloads the device description at location
+     */
+    void discoverLocation(const QUrl &location);
+
 Q_SIGNALS:
     void discovered(Device *device);
 
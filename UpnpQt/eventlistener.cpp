@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "eventlistener.h"
+
+#include <QThreadStorage>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_EVENTS, "upnpqt.events", QtInfoMsg)
+
+using namespace UpnpQt;
+
+EventListener *EventListener::instance()
+{
+    static QThreadStorage<EventListener *> listeners;
+    if (!listeners.hasLocalData()) {
+        listeners.setLocalData(new EventListener);
+    }
+    return listeners.localData();
+}
+
+EventListener::EventListener(QObject *parent) : QObject(parent)
+{
+    if (m_server.listen(QHostAddress::Any)) {
+        qCInfo(UPNPQT_EVENTS) << "Listening for events on port" << m_server.serverPort();
+    } else {
+        qCWarning(UPNPQT_EVENTS) << "Cannot listen for events" << m_server.errorString();
+    }
+
+    m_server.setHandler([=] (const HttpServer::Request &request, const HttpServer::Responder &respond) {
+        HttpServer::Response response;
+        if (request.method != "NOTIFY") {
+            response.status = 405;
+            response.reason = QByteArrayLiteral("Method Not Allowed");
+            respond(response);
+            return;
+        }
+
+        auto it = m_subscribers.constFind(request.path);
+        if (it == m_subscribers.constEnd() || !it->context) {
+            qCDebug(UPNPQT_EVENTS) << "NOTIFY for unknown subscription" << request.path << request.headers.value(QByteArrayLiteral("sid"));
+            response.status = 412;
+            response.reason = QByteArrayLiteral("Precondition Failed");
+            respond(response);
+            return;
+        }
+
+        // answer first, the callback might unsubscribe
+        const Callback callback = it->callback;
+        respond(response);
+        callback(request);
+    });
+}
+
+bool EventListener::isListening() const
+{
+    return m_server.isListening();
+}
+
+quint16 EventListener::port() const
+{
+    return m_server.serverPort();
+}
+
+QByteArray EventListener::registerCallback(QObject *context, const Callback &callback)
+{
+    const QByteArray path = QByteArrayLiteral("/upnpqt/event/") + QByteArray::number(m_nextId++);
+
+    Subscriber subscriber;
+    subscriber.context = context;
+    subscriber.callback = callback;
+    m_subscribers.insert(path, subscriber);
+
+    return path;
+}
+
+void EventListener::unregisterCallback(const QByteArray &path)
+{
+    m_subscribers.remove(path);
+}
+
+#include "moc_eventlistener.cpp"
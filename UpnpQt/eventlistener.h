@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPEVENTLISTENER_H
+#define UPNPEVENTLISTENER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QHash>
+
+#include "httpserver.h"
+
+namespace UpnpQt {
+
+/**
+ * Receives GENA NOTIFY requests for all subscriptions of a thread,
+ * each subscriber registers a callback and gets a unique path
+ * to put in its CALLBACK URL.
+ */
+class EventListener : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(const HttpServer::Request &request)> Callback;
+
+    static EventListener *instance();
+
+    bool isListening() const;
+    quint16 port() const;
+
+    QByteArray registerCallback(QObject *context, const Callback &callback);
+    void unregisterCallback(const QByteArray &path);
+
+private:
+    explicit EventListener(QObject *parent = nullptr);
+
+    struct Subscriber {
+        QPointer<QObject> context;
+        Callback callback;
+    };
+
+    HttpServer m_server;
+    QHash<QByteArray, Subscriber> m_subscribers;
+    quint64 m_nextId = 1;
+};
+
+}
+
+#endif // UPNPEVENTLISTENER_H
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_FUTURE_H
+#define UPNPQT_FUTURE_H
+
+#include <QFuture>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QThread>
+#include <QVector>
+
+#include <memory>
+#include <utility>
+
+#include <UpnpQt/reply.h>
+
+namespace UpnpQt {
+
+/**
+ * Outcome of an action wrapped by toFuture(), QFuture has no error
+ * channel without exceptions so failures travel in the result.
+ */
+template <typename T>
+struct Result
+{
+    T value;
+    QString errorCode;
+    QString errorString;
+    Reply::UpnpError upnpError = Reply::NoError;
+    bool error = false;
+};
+
+namespace Internal {
+
+// Abandoned promises (their context was destroyed or a source future
+// was canceled) are canceled so waiters don't block forever
+template <typename R>
+std::shared_ptr<QFutureInterface<R>> makePromise()
+{
+    std::shared_ptr<QFutureInterface<R>> promise(new QFutureInterface<R>, [] (QFutureInterface<R> *p) {
+        if (!p->isFinished()) {
+            p->reportCanceled();
+            p->reportFinished();
+        }
+        delete p;
+    });
+    promise->reportStarted();
+    return promise;
+}
+
+template <typename T, typename Callback>
+void whenFinished(const QFuture<T> &future, QObject *context, Callback callback)
+{
+    if (future.isFinished() && (!context || context->thread() == QThread::currentThread())) {
+        callback();
+        return;
+    }
+
+    auto watcher = new QFutureWatcher<T>(context);
+    QObject::connect(watcher, &QFutureWatcherBase::finished, watcher, [=] () mutable {
+        watcher->deleteLater();
+        callback();
+    });
+    watcher->setFuture(future);
+}
+
+template <typename T>
+Result<T> errorResult(const QString &errorString)
+{
+    Result<T> result;
+    result.error = true;
+    result.upnpError = Reply::UnknownError;
+    result.errorString = errorString;
+    return result;
+}
+
+// Abandoned result promises finish with an error rather than canceled,
+// so result() is always safe to call
+template <typename T>
+std::shared_ptr<QFutureInterface<Result<T>>> makeResultPromise()
+{
+    std::shared_ptr<QFutureInterface<Result<T>>> promise(new QFutureInterface<Result<T>>, [] (QFutureInterface<Result<T>> *p) {
+        if (!p->isFinished()) {
+            const Result<T> result = errorResult<T>(QStringLiteral("Request abandoned"));
+            p->reportFinished(&result);
+        }
+        delete p;
+    });
+    promise->reportStarted();
+    return promise;
+}
+
+template <typename R>
+struct ReplyTraits;
+
+template <typename T>
+struct ReplyTraits<TypedReply<T> *>
+{
+    typedef T type;
+    static T take(TypedReply<T> *reply) { return reply->takeResult(); }
+};
+
+template <>
+struct ReplyTraits<Reply *>
+{
+    typedef QVariant type;
+    static QVariant take(Reply *reply) { return reply->value(); }
+};
+
+template <typename R>
+void fulfill(R reply, const std::shared_ptr<QFutureInterface<Result<typename ReplyTraits<R>::type>>> &promise)
+{
+    QObject::connect(reply, &Reply::finished, reply, [=] {
+        Result<typename ReplyTraits<R>::type> result;
+        if (reply->error()) {
+            result.error = true;
+            result.upnpError = reply->upnpError();
+            result.errorCode = reply->errorCode();
+            result.errorString = reply->errorString();
+        } else {
+            result.value = ReplyTraits<R>::take(reply);
+        }
+        promise->reportFinished(&result);
+    });
+}
+
+template <typename T>
+struct Invoke
+{
+    template <typename F>
+    static auto call(F &func, const QFuture<T> &future) -> decltype(func(future.result())) {
+        return func(future.result());
+    }
+};
+
+template <>
+struct Invoke<void>
+{
+    template <typename F>
+    static auto call(F &func, const QFuture<void> &) -> decltype(func()) {
+        return func();
+    }
+};
+
+template <typename R>
+struct Complete
+{
+    template <typename T, typename F>
+    static void run(QFutureInterface<R> &promise, F &func, const QFuture<T> &future) {
+        const R result = Invoke<T>::call(func, future);
+        promise.reportFinished(&result);
+    }
+};
+
+template <>
+struct Complete<void>
+{
+    template <typename T, typename F>
+    static void run(QFutureInterface<void> &promise, F &func, const QFuture<T> &future) {
+        Invoke<T>::call(func, future);
+        promise.reportFinished();
+    }
+};
+
+struct JoinState
+{
+    std::shared_ptr<QFutureInterface<void>> promise;
+    int pending = 0;
+    bool canceled = false;
+};
+
+template <typename T>
+void join(const QFuture<T> &future, QObject *context, const std::shared_ptr<JoinState> &state)
+{
+    whenFinished(future, context, [=] {
+        if (future.isCanceled()) {
+            state->canceled = true;
+        }
+        if (--state->pending == 0 && !state->canceled) {
+            state->promise->reportFinished();
+        }
+    });
+}
+
+}
+
+/**
+ * @brief toFuture wraps an action reply in a QFuture
+ *
+ * The reply is deleted once it finishes, the result is moved out of it
+ * and failures are reported in Result::error. If the reply is destroyed
+ * before finishing (i.e. its service went away) the result carries an
+ * error instead of leaving the future pending. Plain Reply objects give
+ * a Result<QVariant> with their value().
+ *
+ * @code
+ * QFuture<Result<QString>> ip = toFuture(srv->getExternalIp());
+ * @endcode
+ */
+template <typename R>
+auto toFuture(R reply) -> QFuture<Result<typename Internal::ReplyTraits<R>::type>>
+{
+    auto promise = Internal::makeResultPromise<typename Internal::ReplyTraits<R>::type>();
+    Internal::fulfill(reply, promise);
+    return promise->future();
+}
+
+/**
+ * @brief then runs func with the result of future once it finishes
+ *
+ * func runs on the thread of context, which must be the calling thread,
+ * or right away when future is already finished. If context is destroyed
+ * first, or future is canceled, the returned future is canceled.
+ *
+ * @return QFuture with whatever func returns
+ */
+template <typename T, typename F>
+auto then(const QFuture<T> &future, QObject *context, F func)
+    -> QFuture<decltype(Internal::Invoke<T>::call(func, future))>
+{
+    typedef decltype(Internal::Invoke<T>::call(func, future)) R;
+
+    auto promise = Internal::makePromise<R>();
+    QFuture<R> ret = promise->future();
+    Internal::whenFinished(future, context, [=] () mutable {
+        if (!future.isCanceled()) {
+            Internal::Complete<R>::run(*promise, func, future);
+        }
+    });
+    return ret;
+}
+
+/**
+ * @brief then overload running func on the calling thread
+ */
+template <typename T, typename F>
+auto then(const QFuture<T> &future, F func)
+    -> QFuture<decltype(Internal::Invoke<T>::call(func, future))>
+{
+    return then(future, nullptr, std::move(func));
+}
+
+/**
+ * @brief whenAll joins futures of the same type
+ * @param context object on whose thread completion is tracked, may be nullptr
+ * @return QVector with the results in the same order as futures
+ */
+template <typename T>
+QFuture<QVector<T>> whenAll(QObject *context, const QVector<QFuture<T>> &futures)
+{
+    auto promise = Internal::makePromise<QVector<T>>();
+    QFuture<QVector<T>> ret = promise->future();
+    if (futures.isEmpty()) {
+        const QVector<T> results;
+        promise->reportFinished(&results);
+        return ret;
+    }
+
+    auto pending = std::make_shared<int>(futures.size());
+    for (const QFuture<T> &future : futures) {
+        Internal::whenFinished(future, context, [=] {
+            if (--*pending) {
+                return;
+            }
+
+            QVector<T> results;
+            results.reserve(futures.size());
+            for (const QFuture<T> &done : futures) {
+                if (done.isCanceled()) {
+                    return;
+                }
+                results.append(done.result());
+            }
+            promise->reportFinished(&results);
+        });
+    }
+    return ret;
+}
+
+/**
+ * @brief whenAll joins futures of different types
+ *
+ * Results are read from the original futures once the returned one
+ * finishes:
+ * @code
+ * auto ip = toFuture(srv->getExternalIp());
+ * auto status = toFuture(srv->getStatusInfo());
+ * then(whenAll(this, ip, status), this, [=] {
+ *     qDebug() << ip.result().value << status.result().value;
+ * });
+ * @endcode
+ */
+template <typename... Ts>
+QFuture<void> whenAll(QObject *context, const QFuture<Ts> &... futures)
+{
+    auto state = std::make_shared<Internal::JoinState>();
+    state->promise = Internal::makePromise<void>();
+    state->pending = int(sizeof...(Ts));
+
+    QFuture<void> ret = state->promise->future();
+    if (state->pending == 0) {
+        state->promise->reportFinished();
+        return ret;
+    }
+
+    int expand[] = { 0, (Internal::join(futures, context, state), 0)... };
+    Q_UNUSED(expand)
+    return ret;
+}
+
+}
+
+#endif // UPNPQT_FUTURE_H
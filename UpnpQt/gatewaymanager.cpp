@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "gatewaymanager.h"
+#include "discover.h"
+#include "internetgatewaydevice.h"
+#include "wanconnectionservice.h"
+#include "mappingregistry.h"
+#include "reply.h"
+
+#include <QTimer>
+#include <QPointer>
+#include <QElapsedTimer>
+
+#include <memory>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_GATEWAYS, "upnpqt.gateways", QtInfoMsg)
+
+namespace UpnpQt {
+
+class GatewayManagerPrivate
+{
+public:
+    struct Gateway {
+        QPointer<WanConnectionService> service;
+        // identity that survives the service being destroyed
+        WanConnectionService *key = nullptr;
+        GatewayManager::Health health;
+        int generation = 0;
+        bool probing = false;
+    };
+
+    Gateway *find(WanConnectionService *key);
+    void remove(WanConnectionService *key);
+    void probe(WanConnectionService *key);
+    void finishProbe(WanConnectionService *key, int generation, bool success, qint64 latency);
+    WanConnectionService *pickBest() const;
+    void reselect();
+
+    GatewayManager *q_ptr;
+    std::vector<Gateway> gateways;
+    QTimer timer;
+    QPointer<MappingRegistry> registry;
+    QPointer<WanConnectionService> active;
+    // last gateway announced with bestGatewayChanged()
+    WanConnectionService *announced = nullptr;
+    int probeTimeout = 3000;
+    int failureThreshold = 2;
+    bool hasActive = false;
+};
+
+}
+
+using namespace UpnpQt;
+
+GatewayManager::GatewayManager(QObject *parent) : QObject(parent)
+  , d_ptr(new GatewayManagerPrivate)
+{
+    Q_D(GatewayManager);
+    d->q_ptr = this;
+    d->timer.setInterval(10000);
+    connect(&d->timer, &QTimer::timeout, this, &GatewayManager::probe);
+}
+
+GatewayManager::GatewayManager(Discover *discover, QObject *parent) : GatewayManager(parent)
+{
+    connect(discover, &Discover::discovered, this, &GatewayManager::addDevice);
+}
+
+GatewayManager::~GatewayManager()
+{
+    delete d_ptr;
+}
+
+void GatewayManager::addDevice(Device *device)
+{
+    auto igd = qobject_cast<InternetGatewayDevice *>(device);
+    if (igd) {
+        addService(igd->wanIpOrPppConnectionService());
+    }
+}
+
+void GatewayManager::addService(WanConnectionService *service)
+{
+    Q_D(GatewayManager);
+    if (!service || d->find(service)) {
+        return;
+    }
+
+    GatewayManagerPrivate::Gateway gateway;
+    gateway.service = service;
+    gateway.key = service;
+    gateway.health.urlBase = service->device()->urlBase();
+    d->gateways.push_back(gateway);
+    qCDebug(UPNPQT_GATEWAYS) << "tracking" << gateway.health.urlBase;
+
+    connect(service, &QObject::destroyed, this, [=] {
+        d->remove(service);
+    });
+
+    Q_EMIT gatewayAdded(service);
+
+    d->probe(service);
+    if (!d->timer.isActive()) {
+        d->timer.start();
+    }
+}
+
+void GatewayManager::removeService(WanConnectionService *service)
+{
+    Q_D(GatewayManager);
+    if (service) {
+        disconnect(service, nullptr, this, nullptr);
+    }
+    d->remove(service);
+}
+
+void GatewayManager::setProbeInterval(int msec)
+{
+    Q_D(GatewayManager);
+    d->timer.setInterval(qMax(100, msec));
+}
+
+int GatewayManager::probeInterval() const
+{
+    Q_D(const GatewayManager);
+    return d->timer.interval();
+}
+
+void GatewayManager::setProbeTimeout(int msec)
+{
+    Q_D(GatewayManager);
+    d->probeTimeout = qMax(100, msec);
+}
+
+int GatewayManager::probeTimeout() const
+{
+    Q_D(const GatewayManager);
+    return d->probeTimeout;
+}
+
+void GatewayManager::setFailureThreshold(int failures)
+{
+    Q_D(GatewayManager);
+    d->failureThreshold = qMax(1, failures);
+}
+
+int GatewayManager::failureThreshold() const
+{
+    Q_D(const GatewayManager);
+    return d->failureThreshold;
+}
+
+void GatewayManager::setRegistry(MappingRegistry *registry)
+{
+    Q_D(GatewayManager);
+    d->registry = registry;
+}
+
+MappingRegistry *GatewayManager::registry() const
+{
+    Q_D(const GatewayManager);
+    return d->registry;
+}
+
+WanConnectionService *GatewayManager::bestGateway() const
+{
+    Q_D(const GatewayManager);
+    return d->announced;
+}
+
+std::vector<WanConnectionService *> GatewayManager::gateways() const
+{
+    Q_D(const GatewayManager);
+    std::vector<WanConnectionService *> ret;
+    for (const GatewayManagerPrivate::Gateway &gateway : d->gateways) {
+        if (gateway.service) {
+            ret.push_back(gateway.service);
+        }
+    }
+    return ret;
+}
+
+GatewayManager::Health GatewayManager::health(WanConnectionService *service) const
+{
+    Q_D(const GatewayManager);
+    for (const GatewayManagerPrivate::Gateway &gateway : d->gateways) {
+        if (gateway.key == service) {
+            return gateway.health;
+        }
+    }
+    return Health();
+}
+
+void GatewayManager::probe()
+{
+    Q_D(GatewayManager);
+    std::vector<WanConnectionService *> keys;
+    for (const GatewayManagerPrivate::Gateway &gateway : d->gateways) {
+        keys.push_back(gateway.key);
+    }
+
+    for (WanConnectionService *key : keys) {
+        d->probe(key);
+    }
+}
+
+GatewayManagerPrivate::Gateway *GatewayManagerPrivate::find(WanConnectionService *key)
+{
+    for (Gateway &gateway : gateways) {
+        if (gateway.key == key) {
+            return &gateway;
+        }
+    }
+    return nullptr;
+}
+
+void GatewayManagerPrivate::remove(WanConnectionService *key)
+{
+    for (auto it = gateways.begin(); it != gateways.end(); ++it) {
+        if (it->key == key) {
+            qCDebug(UPNPQT_GATEWAYS) << "removed" << it->health.urlBase;
+            gateways.erase(it);
+            break;
+        }
+    }
+
+    if (gateways.empty()) {
+        timer.stop();
+    }
+    reselect();
+}
+
+void GatewayManagerPrivate::probe(WanConnectionService *key)
+{
+    Gateway *gateway = find(key);
+    if (!gateway || !gateway->service || gateway->probing) {
+        return;
+    }
+
+    gateway->probing = true;
+    const int generation = ++gateway->generation;
+
+    auto elapsed = std::make_shared<QElapsedTimer>();
+    elapsed->start();
+
+    // a probe that doesn't answer in time failed, its late reply is ignored
+    QTimer::singleShot(probeTimeout, q_ptr, [=] {
+        finishProbe(key, generation, false, elapsed->elapsed());
+    });
+
+    auto reply = gateway->service->getStatusInfo();
+    QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+        // a gateway that answers but lost its WAN link is of no use either
+        const bool success = !reply->error() &&
+                reply->result().value(QStringLiteral("ConnectionStatus")).toString() == QLatin1String("Connected");
+        finishProbe(key, generation, success, elapsed->elapsed());
+    });
+}
+
+void GatewayManagerPrivate::finishProbe(WanConnectionService *key, int generation, bool success, qint64 latency)
+{
+    Gateway *gateway = find(key);
+    if (!gateway || !gateway->probing || gateway->generation != generation) {
+        return;
+    }
+    gateway->probing = false;
+
+    const double alpha = 0.2;
+    GatewayManager::Health &health = gateway->health;
+    health.successRate = health.successRate * (1 - alpha) + (success ? alpha : 0);
+    ++health.probes;
+
+    if (success) {
+        health.latency = health.probes - health.failures == 1 ? latency : health.latency * (1 - alpha) + latency * alpha;
+        health.consecutiveFailures = 0;
+        if (!health.healthy) {
+            qCInfo(UPNPQT_GATEWAYS) << "gateway up" << health.urlBase << latency;
+            health.healthy = true;
+            Q_EMIT q_ptr->gatewayUp(key);
+        }
+    } else {
+        ++health.failures;
+        ++health.consecutiveFailures;
+        qCDebug(UPNPQT_GATEWAYS) << "probe failed" << health.urlBase << health.consecutiveFailures;
+        if (health.consecutiveFailures >= failureThreshold) {
+            if (health.healthy) {
+                qCWarning(UPNPQT_GATEWAYS) << "gateway down" << health.urlBase;
+                health.healthy = false;
+                Q_EMIT q_ptr->gatewayDown(key);
+            }
+        } else {
+            // confirm right away instead of waiting for the next interval
+            QTimer::singleShot(0, q_ptr, [=] {
+                probe(key);
+            });
+        }
+    }
+
+    reselect();
+}
+
+WanConnectionService *GatewayManagerPrivate::pickBest() const
+{
+    // reliability first, 1% of success rate is worth 10 msec of latency
+    const Gateway *best = nullptr;
+    double bestScore = 0;
+    for (const Gateway &gateway : gateways) {
+        if (!gateway.service || !gateway.health.healthy) {
+            continue;
+        }
+
+        const double score = gateway.health.successRate * 1000 - gateway.health.latency;
+        if (!best || score > bestScore) {
+            best = &gateway;
+            bestScore = score;
+        }
+    }
+    return best ? best->service.data() : nullptr;
+}
+
+void GatewayManagerPrivate::reselect()
+{
+    // stick to the active gateway while it's healthy so mappings don't move around
+    Gateway *current = active ? find(active) : nullptr;
+    WanConnectionService *next = current && current->health.healthy ? active.data() : pickBest();
+
+    if (next && next != active) {
+        if (registry && hasActive) {
+            // a destroyed active gateway is nullptr here, which adopts its orphaned mappings
+            const int moved = registry->migrate(active.data(), next);
+            qCInfo(UPNPQT_GATEWAYS) << "failing over" << moved << "mappings to" << next->device()->urlBase();
+        }
+        active = next;
+        hasActive = true;
+    }
+
+    if (next != announced) {
+        announced = next;
+        Q_EMIT q_ptr->bestGatewayChanged(next);
+    }
+}
+
+#include "moc_gatewaymanager.cpp"
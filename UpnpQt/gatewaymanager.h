@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPGATEWAYMANAGER_H
+#define UPNPGATEWAYMANAGER_H
+
+#include <QObject>
+
+#include <vector>
+
+#include <UpnpQt/global.h>
+
+namespace UpnpQt {
+
+class Device;
+class Discover;
+class MappingRegistry;
+class WanConnectionService;
+
+/**
+ * Tracks every discovered gateway and probes it with GetStatusInfo.
+ *
+ * Probe latency and success are kept as moving averages, the healthiest
+ * gateway is picked as the active one and when it fails the mappings of
+ * the registry are moved to the next best. A dead gateway is noticed
+ * within one probe interval plus failureThreshold probe timeouts, as
+ * failed probes are retried right away.
+ */
+class GatewayManagerPrivate;
+class UPNPQT_LIBRARY GatewayManager : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(GatewayManager)
+public:
+    struct Health {
+        QString urlBase;
+        /** moving average of the probe round trip in msec */
+        double latency = 0;
+        /** moving average of successful probes, from 0 to 1 */
+        double successRate = 1;
+        int consecutiveFailures = 0;
+        qint64 probes = 0;
+        qint64 failures = 0;
+        bool healthy = false;
+    };
+
+    explicit GatewayManager(QObject *parent = nullptr);
+
+    /**
+     * @brief GatewayManager tracking every device discover finds
+     */
+    explicit GatewayManager(Discover *discover, QObject *parent = nullptr);
+    virtual ~GatewayManager();
+
+    /**
+     * @brief addDevice
+     * @param device an InternetGatewayDevice, anything else is ignored
+     */
+    void addDevice(Device *device);
+    void addService(WanConnectionService *service);
+    void removeService(WanConnectionService *service);
+
+    /**
+     * @brief setProbeInterval
+     * @param msec time between probes of every gateway, defaults to 10000
+     */
+    void setProbeInterval(int msec);
+    int probeInterval() const;
+
+    /**
+     * @brief setProbeTimeout
+     * @param msec a probe not answered in this time failed, defaults to 3000
+     */
+    void setProbeTimeout(int msec);
+    int probeTimeout() const;
+
+    /**
+     * @brief setFailureThreshold
+     * @param failures consecutive failed probes to consider a gateway down, defaults to 2
+     */
+    void setFailureThreshold(int failures);
+    int failureThreshold() const;
+
+    /**
+     * @brief setRegistry
+     * @param registry its mappings follow the active gateway on failover
+     */
+    void setRegistry(MappingRegistry *registry);
+    MappingRegistry *registry() const;
+
+    /**
+     * @brief bestGateway
+     * @return the active gateway to create new mappings on, nullptr if none is healthy
+     */
+    WanConnectionService *bestGateway() const;
+    std::vector<WanConnectionService *> gateways() const;
+    Health health(WanConnectionService *service) const;
+
+public Q_SLOTS:
+    /**
+     * @brief probe all gateways now
+     */
+    void probe();
+
+Q_SIGNALS:
+    void gatewayAdded(UpnpQt::WanConnectionService *service);
+    void gatewayDown(UpnpQt::WanConnectionService *service);
+    void gatewayUp(UpnpQt::WanConnectionService *service);
+
+    /**
+     * Emitted when the active gateway changes, service is nullptr when
+     * no gateway is healthy.
+     */
+    void bestGatewayChanged(UpnpQt::WanConnectionService *service);
+
+private:
+    GatewayManagerPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPGATEWAYMANAGER_H
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "httpserver.h"
+
+#include <QTcpSocket>
+#include <QPointer>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_HTTP, "upnpqt.http", QtInfoMsg)
+
+using namespace UpnpQt;
+
+namespace {
+
+// enough for descriptions, SOAP actions and GENA property sets
+const int MaxHeaderSize = 64 * 1024;
+const int MaxBodySize = 64 * 1024;
+
+}
+
+HttpServer::HttpServer(QObject *parent) : QTcpServer(parent)
+{
+    connect(this, &QTcpServer::newConnection, this, [=] {
+        while (QTcpSocket *socket = nextPendingConnection()) {
+            m_connections.insert(socket, Connection());
+            connect(socket, &QTcpSocket::readyRead, this, [=] {
+                auto it = m_connections.find(socket);
+                if (it != m_connections.end()) {
+                    it->buffer.append(socket->readAll());
+                    if (it->buffer.size() > MaxHeaderSize + MaxBodySize) {
+                        // pipelining more than a request can hold
+                        qCWarning(UPNPQT_HTTP) << "Too much data from" << socket->peerAddress();
+                        socket->abort();
+                        return;
+                    }
+                    readRequest(socket);
+                }
+            });
+            connect(socket, &QTcpSocket::disconnected, this, [=] {
+                m_connections.remove(socket);
+                socket->deleteLater();
+            });
+        }
+    });
+}
+
+HttpServer::~HttpServer()
+{
+
+}
+
+void HttpServer::setHandler(const Handler &handler)
+{
+    m_handler = handler;
+}
+
+void HttpServer::readRequest(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end() || it->busy) {
+        return;
+    }
+
+    QByteArray &buffer = it->buffer;
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (buffer.size() > MaxHeaderSize) {
+            qCWarning(UPNPQT_HTTP) << "Request header too large from" << socket->peerAddress();
+            socket->abort();
+        }
+        return;
+    }
+
+    const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    if (requestLine.size() < 3) {
+        qCWarning(UPNPQT_HTTP) << "Invalid request line from" << socket->peerAddress();
+        socket->abort();
+        return;
+    }
+
+    Request request;
+    request.method = requestLine.at(0);
+    request.path = requestLine.at(1);
+    for (int i = 1; i < lines.size(); ++i) {
+        const QByteArray &line = lines.at(i);
+        const int colon = line.indexOf(':');
+        if (colon > 0) {
+            request.headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+        }
+    }
+
+    bool ok = true;
+    int contentLength = 0;
+    const auto contentLengthHeader = request.headers.constFind(QByteArrayLiteral("content-length"));
+    if (contentLengthHeader != request.headers.constEnd()) {
+        contentLength = contentLengthHeader.value().toInt(&ok);
+    }
+    if (!ok || contentLength < 0) {
+        qCWarning(UPNPQT_HTTP) << "Invalid Content-Length from" << socket->peerAddress();
+        reject(socket, 400, QByteArrayLiteral("Bad Request"));
+        return;
+    }
+    if (contentLength > MaxBodySize) {
+        qCWarning(UPNPQT_HTTP) << "Request body too large from" << socket->peerAddress() << contentLength;
+        reject(socket, 413, QByteArrayLiteral("Payload Too Large"));
+        return;
+    }
+
+    if (buffer.size() < headerEnd + 4 + contentLength) {
+        return;
+    }
+    request.body = buffer.mid(headerEnd + 4, contentLength);
+    request.peer = socket->peerAddress();
+    buffer.remove(0, headerEnd + 4 + contentLength);
+
+    bool keepAlive = requestLine.at(2).trimmed() != "HTTP/1.0";
+    const QByteArray connection = request.headers.value(QByteArrayLiteral("connection")).toLower();
+    if (connection == "close") {
+        keepAlive = false;
+    } else if (connection == "keep-alive") {
+        keepAlive = true;
+    }
+
+    qCDebug(UPNPQT_HTTP) << request.method << request.path << request.peer << request.body.size();
+    it->busy = true;
+
+    if (!m_handler) {
+        Response response;
+        response.status = 404;
+        response.reason = QByteArrayLiteral("Not Found");
+        writeResponse(socket, response, keepAlive);
+        return;
+    }
+
+    QPointer<QTcpSocket> guard(socket);
+    m_handler(request, [=] (const Response &response) {
+        if (guard) {
+            writeResponse(guard.data(), response, keepAlive);
+        }
+    });
+}
+
+void HttpServer::reject(QTcpSocket *socket, int status, const QByteArray &reason)
+{
+    auto it = m_connections.find(socket);
+    if (it != m_connections.end()) {
+        // nothing after this request can be parsed
+        it->buffer.clear();
+        it->busy = true;
+    }
+
+    Response response;
+    response.status = status;
+    response.reason = reason;
+    writeResponse(socket, response, false);
+}
+
+void HttpServer::writeResponse(QTcpSocket *socket, const Response &response, bool keepAlive)
+{
+    if (response.abort) {
+        socket->abort();
+        return;
+    }
+
+    keepAlive = keepAlive && !response.close;
+
+    QByteArray out;
+    out.reserve(256 + response.body.size());
+    out.append("HTTP/1.1 ");
+    out.append(QByteArray::number(response.status));
+    out.append(' ');
+    out.append(response.reason.isEmpty() ? QByteArrayLiteral("OK") : response.reason);
+    out.append("\r\n");
+    for (const auto &header : response.headers) {
+        out.append(header.first);
+        out.append(": ");
+        out.append(header.second);
+        out.append("\r\n");
+    }
+    out.append("Content-Length: ");
+    out.append(QByteArray::number(response.body.size()));
+    out.append(keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+    out.append(response.body);
+    socket->write(out);
+
+    if (!keepAlive) {
+        socket->disconnectFromHost();
+        return;
+    }
+
+    auto it = m_connections.find(socket);
+    if (it != m_connections.end()) {
+        it->busy = false;
+        if (!it->buffer.isEmpty()) {
+            readRequest(socket);
+        }
+    }
+}
+
+#include "moc_httpserver.cpp"
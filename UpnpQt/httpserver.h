@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPHTTPSERVER_H
+#define UPNPHTTPSERVER_H
+
+#include <QTcpServer>
+#include <QHostAddress>
+#include <QHash>
+
+#include <functional>
+
+class QTcpSocket;
+
+namespace UpnpQt {
+
+/**
+ * Minimal HTTP/1.1 server, just enough for GENA NOTIFY callbacks and
+ * for serving descriptions and SOAP actions, requests on a connection
+ * are answered in order and the handler may respond asynchronously.
+ * Request bodies are limited to 64 KiB, larger ones get a 413 and the
+ * connection is closed.
+ */
+class HttpServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    struct Request {
+        QByteArray method;
+        QByteArray path;
+        /** Header names are lower case */
+        QHash<QByteArray, QByteArray> headers;
+        QByteArray body;
+        QHostAddress peer;
+    };
+
+    struct Response {
+        int status = 200;
+        /** Defaults to "OK" when empty */
+        QByteArray reason;
+        std::vector<std::pair<QByteArray, QByteArray>> headers;
+        QByteArray body;
+        bool close = false;
+        /** Drops the connection without answering */
+        bool abort = false;
+    };
+
+    typedef std::function<void(const Response &response)> Responder;
+    typedef std::function<void(const Request &request, const Responder &respond)> Handler;
+
+    explicit HttpServer(QObject *parent = nullptr);
+    ~HttpServer();
+
+    void setHandler(const Handler &handler);
+
+private:
+    struct Connection {
+        QByteArray buffer;
+        bool busy = false;
+    };
+
+    void readRequest(QTcpSocket *socket);
+    void reject(QTcpSocket *socket, int status, const QByteArray &reason);
+    void writeResponse(QTcpSocket *socket, const Response &response, bool keepAlive);
+
+    QHash<QTcpSocket *, Connection> m_connections;
+    Handler m_handler;
+};
+
+}
+
+#endif // UPNPHTTPSERVER_H
@@ -21,27 +21,69 @@
 #include "soapenvelope.h"
 #include "reply.h"
 #include "wanconnectionservice.h"
+#include "wanipv6firewallcontrolservice.h"
+#include "wancommoninterfaceconfigservice.h"
 
 #include <QHostAddress>
+#include <QElapsedTimer>
+#include <QPointer>
 
 #include <QNetworkReply>
 #include <QNetworkAccessManager>
 
 #include <QDomDocument>
 
+#include <algorithm>
+#include <memory>
+
 #include <QLoggingCategory>
 
 Q_LOGGING_CATEGORY(UPNPQT_IDG, "upnpqt.idg")
 
+namespace UpnpQt {
+
+class InternetGatewayDevicePrivate
+{
+public:
+    static void collect(const Device *device, std::vector<WanConnectionService *> &services);
+    void watch(InternetGatewayDevice *q);
+    void pickBest();
+
+    std::vector<InternetGatewayDevice::WanConnection> connections;
+    // keep connections in sync with the services between probes
+    std::vector<QMetaObject::Connection> watches;
+    QPointer<WanConnectionService> pinned;
+    QPointer<WanConnectionService> best;
+};
+
+}
+
 using namespace UpnpQt;
 
 InternetGatewayDevice::InternetGatewayDevice(DevicePrivate *priv, Discover *parent) : Device(priv, parent)
+  , d_ptr(new InternetGatewayDevicePrivate)
 {
 
 }
 
+InternetGatewayDevice::~InternetGatewayDevice()
+{
+    for (const QMetaObject::Connection &watch : d_ptr->watches) {
+        disconnect(watch);
+    }
+    delete d_ptr;
+}
+
 WanConnectionService *InternetGatewayDevice::wanIpOrPppConnectionService() const
 {
+    Q_D(const InternetGatewayDevice);
+    if (d->pinned) {
+        return d->pinned;
+    }
+    if (d->best) {
+        return d->best;
+    }
+
     auto srv = qobject_cast<WanConnectionService *>(findService(QStringLiteral("WANIPConnection")));
     if (!srv) {
         srv = qobject_cast<WanConnectionService *>(findService(QStringLiteral("WANPPPConnection")));
@@ -49,4 +91,199 @@ WanConnectionService *InternetGatewayDevice::wanIpOrPppConnectionService() const
     return srv;
 }
 
+std::vector<WanConnectionService *> InternetGatewayDevice::wanConnectionServices() const
+{
+    std::vector<WanConnectionService *> ret;
+    InternetGatewayDevicePrivate::collect(this, ret);
+    return ret;
+}
+
+TypedReply<std::vector<InternetGatewayDevice::WanConnection>> *InternetGatewayDevice::probeWanConnections()
+{
+    Q_D(InternetGatewayDevice);
+    auto ret = new TypedReply<std::vector<WanConnection>>(this);
+
+    const std::vector<WanConnectionService *> services = wanConnectionServices();
+    if (services.empty()) {
+        ret->finishWithErrorLater(QStringLiteral("No WAN connection service"));
+        return ret;
+    }
+
+    struct Probe {
+        std::vector<WanConnection> connections;
+        // answers still expected per service
+        std::vector<int> left;
+        int pending = 0;
+    };
+    auto probe = std::make_shared<Probe>();
+    probe->connections.resize(services.size());
+    probe->left.assign(services.size(), 2);
+    probe->pending = int(services.size()) * 2;
+
+    auto done = [=] (size_t i) {
+        if (probe->left[i] == 0) {
+            return;
+        }
+        --probe->left[i];
+        if (--probe->pending > 0) {
+            return;
+        }
+
+        qCDebug(UPNPQT_IDG) << "probed" << probe->connections.size() << "WAN connections";
+        d->connections = probe->connections;
+        d->watch(this);
+        d->pickBest();
+        ret->finishWithResult(probe->connections);
+    };
+
+    for (size_t i = 0; i < services.size(); ++i) {
+        WanConnectionService *service = services[i];
+        probe->connections[i].service = service;
+
+        // replies die with their service without finishing
+        connect(service, &QObject::destroyed, ret, [=] {
+            WanConnection &connection = probe->connections[i];
+            connection.service = nullptr;
+            connection.latency = -1;
+            connection.connectionStatus.clear();
+            while (probe->left[i] > 0) {
+                done(i);
+            }
+        });
+
+        // both in parallel, the status round trip is the latency
+        QElapsedTimer issued;
+        issued.start();
+        auto status = service->getStatusInfo();
+        connect(status, &Reply::finished, this, [=] {
+            WanConnection &connection = probe->connections[i];
+            if (!status->error()) {
+                connection.latency = issued.elapsed();
+                connection.connectionStatus = status->result().value(QStringLiteral("ConnectionStatus")).toString();
+            }
+            done(i);
+        });
+
+        auto externalIp = service->getExternalIp();
+        connect(externalIp, &Reply::finished, this, [=] {
+            if (!externalIp->error()) {
+                probe->connections[i].externalIp = externalIp->result();
+            }
+            done(i);
+        });
+    }
+
+    return ret;
+}
+
+std::vector<InternetGatewayDevice::WanConnection> InternetGatewayDevice::wanConnections() const
+{
+    Q_D(const InternetGatewayDevice);
+    return d->connections;
+}
+
+bool InternetGatewayDevice::pinWanConnectionService(WanConnectionService *service)
+{
+    Q_D(InternetGatewayDevice);
+    if (service) {
+        const std::vector<WanConnectionService *> services = wanConnectionServices();
+        if (std::find(services.begin(), services.end(), service) == services.end()) {
+            qCWarning(UPNPQT_IDG) << "Not a WAN connection service of this gateway" << service;
+            return false;
+        }
+    }
+    d->pinned = service;
+    return true;
+}
+
+WanConnectionService *InternetGatewayDevice::pinnedWanConnectionService() const
+{
+    Q_D(const InternetGatewayDevice);
+    return d->pinned;
+}
+
+WanIpv6FirewallControlService *InternetGatewayDevice::wanIpv6FirewallControlService() const
+{
+    return qobject_cast<WanIpv6FirewallControlService *>(findService(QStringLiteral("WANIPv6FirewallControl")));
+}
+
+WanCommonInterfaceConfigService *InternetGatewayDevice::wanCommonInterfaceConfigService() const
+{
+    return qobject_cast<WanCommonInterfaceConfigService *>(findService(QStringLiteral("WANCommonInterfaceConfig")));
+}
+
+void InternetGatewayDevicePrivate::watch(InternetGatewayDevice *q)
+{
+    for (const QMetaObject::Connection &watch : watches) {
+        QObject::disconnect(watch);
+    }
+    watches.clear();
+
+    for (const InternetGatewayDevice::WanConnection &connection : connections) {
+        WanConnectionService *service = connection.service;
+        if (!service) {
+            continue;
+        }
+
+        // only updated while the service is monitored, otherwise until the next probe
+        watches.push_back(QObject::connect(service, &WanConnectionService::connectionStatusChanged, q, [=] (const QString &connectionStatus) {
+            for (InternetGatewayDevice::WanConnection &entry : connections) {
+                if (entry.service == service) {
+                    entry.connectionStatus = connectionStatus;
+                }
+            }
+            pickBest();
+        }));
+        watches.push_back(QObject::connect(service, &WanConnectionService::externalIpChanged, q, [=] (const QString &externalIp) {
+            for (InternetGatewayDevice::WanConnection &entry : connections) {
+                if (entry.service == service) {
+                    entry.externalIp = externalIp;
+                }
+            }
+        }));
+        watches.push_back(QObject::connect(service, &QObject::destroyed, q, [=] {
+            for (InternetGatewayDevice::WanConnection &entry : connections) {
+                if (entry.service == service) {
+                    entry.service = nullptr;
+                    entry.latency = -1;
+                    entry.connectionStatus.clear();
+                }
+            }
+            pickBest();
+        }));
+    }
+}
+
+void InternetGatewayDevicePrivate::pickBest()
+{
+    // connected first, the fastest of them wins
+    WanConnectionService *service = nullptr;
+    qint64 latency = -1;
+    for (const InternetGatewayDevice::WanConnection &connection : connections) {
+        if (connection.service && connection.connectionStatus == QLatin1String("Connected") && connection.latency >= 0 &&
+                (!service || connection.latency < latency)) {
+            service = connection.service;
+            latency = connection.latency;
+        }
+    }
+
+    if (service != best) {
+        qCDebug(UPNPQT_IDG) << "best WAN connection" << service << latency;
+    }
+    best = service;
+}
+
+void InternetGatewayDevicePrivate::collect(const Device *device, std::vector<WanConnectionService *> &services)
+{
+    for (Service *service : device->services()) {
+        auto srv = qobject_cast<WanConnectionService *>(service);
+        if (srv) {
+            services.push_back(srv);
+        }
+    }
+    for (Device *child : device->devices()) {
+        collect(child, services);
+    }
+}
+
 #include "moc_internetgatewaydevice.cpp"
@@ -22,14 +22,18 @@
 
 #include <UpnpQt/global.h>
 #include <UpnpQt/device.h>
+#include <UpnpQt/reply.h>
 
 #include <QAbstractSocket>
 
+#include <vector>
+
 namespace UpnpQt {
 
-class Reply;
 class Discover;
 class WanConnectionService;
+class WanIpv6FirewallControlService;
+class WanCommonInterfaceConfigService;
 class InternetGatewayDevicePrivate;
 class UPNPQT_LIBRARY InternetGatewayDevice : public Device
 {
@@ -37,18 +41,82 @@ class UPNPQT_LIBRARY InternetGatewayDevice : public Device
     Q_DECLARE_PRIVATE(InternetGatewayDevice)
 public:
     explicit InternetGatewayDevice(DevicePrivate *priv, Discover *parent);
+    virtual ~InternetGatewayDevice();
+
+    /**
+     * State of one WAN connection service as seen by the last probe.
+     */
+    struct WanConnection {
+        /** nullptr once the service was destroyed */
+        WanConnectionService *service = nullptr;
+        QString connectionStatus;
+        QString externalIp;
+        /** GetStatusInfo round trip in msec from when it was sent, -1 if it failed */
+        qint64 latency = -1;
+    };
 
     /**
      * @brief wanIpOrPppConnectionService
-     * Search for WanIpConnectionService or WanPppConnection service respectively
+     *
+     * The pinned service if any, otherwise once probeWanConnections()
+     * finished the connected service that answered fastest. A monitored
+     * service that disconnects or a destroyed one is dropped right away
+     * and the next fastest connected one takes over. Before the first
+     * probe or when none is connected the first WanIpConnection service
+     * is returned, or the first WanPppConnection one.
      * @return service class or nullptr if not found.
      */
     WanConnectionService *wanIpOrPppConnectionService() const;
 
+    /**
+     * @brief wanConnectionServices
+     * @return the WANIPConnection and WANPPPConnection services of every
+     * WANConnectionDevice, a multi-WAN router has several
+     */
+    std::vector<WanConnectionService *> wanConnectionServices() const;
+
+    /**
+     * @brief probeWanConnections
+     *
+     * Asks every WAN connection service for its status and external IP
+     * in parallel, the result also picks wanIpOrPppConnectionService().
+     * @return one entry per service in wanConnectionServices() order
+     */
+    TypedReply<std::vector<WanConnection>> *probeWanConnections();
+
+    /**
+     * @brief wanConnections
+     * @return the result of the last probe, updated by the status and
+     * external IP changes of monitored services
+     */
+    std::vector<WanConnection> wanConnections() const;
+
+    /**
+     * @brief pinWanConnectionService
+     * @param service always returned by wanIpOrPppConnectionService(), nullptr to pick again
+     * @return false if service is not one of wanConnectionServices(), the pin is then unchanged
+     */
+    bool pinWanConnectionService(WanConnectionService *service);
+    WanConnectionService *pinnedWanConnectionService() const;
+
+    /**
+     * @brief wanIpv6FirewallControlService
+     * @return the IPv6 pinhole service or nullptr if the gateway has none
+     */
+    WanIpv6FirewallControlService *wanIpv6FirewallControlService() const;
+
+    /**
+     * @brief wanCommonInterfaceConfigService
+     * @return the WAN link properties and traffic counters service or nullptr
+     */
+    WanCommonInterfaceConfigService *wanCommonInterfaceConfigService() const;
+
 private:
     InternetGatewayDevicePrivate *d_ptr;
 };
 
 }
 
+Q_DECLARE_METATYPE(UpnpQt::InternetGatewayDevice::WanConnection)
+
 #endif // UPNPINTERNETGATEWAYDEVICE_H
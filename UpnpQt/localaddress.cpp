@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "localaddress_p.h"
+
+#include <QUdpSocket>
+
+QHostAddress UpnpQt::localAddressTowards(const QHostAddress &host, quint16 port)
+{
+    if (host.isNull()) {
+        return QHostAddress();
+    }
+
+    // connecting an UDP socket to an address sends nothing, it only picks
+    // the route so it is connected (or failed) when connectToHost returns
+    QUdpSocket socket;
+    socket.connectToHost(host, port);
+    if (socket.state() != QAbstractSocket::ConnectedState) {
+        return QHostAddress();
+    }
+    return socket.localAddress();
+}
+
+QHostAddress UpnpQt::localAddressTowards(const QUrl &url)
+{
+    return localAddressTowards(QHostAddress(url.host()), quint16(url.port(80)));
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPLOCALADDRESS_P_H
+#define UPNPLOCALADDRESS_P_H
+
+#include <QHostAddress>
+#include <QUrl>
+
+namespace UpnpQt {
+
+/**
+ * The local address the route towards host goes out from, a null
+ * address if host is null or unreachable. Doesn't block.
+ */
+QHostAddress localAddressTowards(const QHostAddress &host, quint16 port);
+
+/**
+ * Same for the host of url, which has to be an IP address as gateways
+ * announce, a host name would need a blocking lookup.
+ */
+QHostAddress localAddressTowards(const QUrl &url);
+
+}
+
+#endif // UPNPLOCALADDRESS_P_H
@@ -0,0 +1,543 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "mappingregistry.h"
+#include "reply.h"
+
+#include <QTimer>
+#include <QPointer>
+#include <QSet>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include <unordered_map>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_REGISTRY, "upnpqt.registry", QtInfoMsg)
+
+namespace UpnpQt {
+
+class MappingRegistryPrivate
+{
+public:
+    struct Entry {
+        QPointer<WanConnectionService> service;
+        WanConnectionService::PortMap portMap;
+        QPointer<WanIpv6FirewallControlService> firewall;
+        WanIpv6FirewallControlService::Pinhole pinhole;
+        qint64 due = 0;
+        int failures = 0;
+        // bumped on migration so replies from the previous gateway are ignored
+        int epoch = 0;
+        bool established = false;
+        bool inFlight = false;
+        bool isPinhole = false;
+        // gateway destroyed, waiting for migrate() to adopt it
+        bool orphaned = false;
+
+        int lease() const { return isPinhole ? pinhole.leaseTime : portMap.leaseDuration; }
+        bool reachable() const { return isPinhole ? !firewall.isNull() : !service.isNull(); }
+    };
+    typedef std::pair<qint64, quint64> HeapItem;
+
+    void schedule(quint64 id, Entry &entry, qint64 delay);
+    qint64 renewalDelay(const Entry &entry) const;
+    void rearm();
+    void renewDue();
+    void renewPinhole(quint64 id, const Entry &entry);
+    void finishRenewal(quint64 id, int epoch, bool success);
+    void watch(QObject *gateway);
+    void gatewayDestroyed(QObject *gateway);
+    void park(quint64 id, Entry &entry);
+
+    MappingRegistry *q_ptr;
+    std::unordered_map<quint64, Entry> entries;
+    // min-heap of (due, id), entries removed or rescheduled leave stale items behind
+    // that are skipped when they reach the top
+    std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap;
+    // services and firewalls whose destruction is being watched
+    QSet<QObject *> watched;
+    // pinholes removed while AddPinhole was in flight, deleted once their UniqueID is known
+    QHash<quint64, QObject *> pinholesToDelete;
+    QTimer timer;
+    QElapsedTimer clock;
+    double jitter = 0.1;
+    int orphanGrace = 120000;
+    int coalesce = 1000;
+    int window = 4;
+    quint64 nextId = 1;
+};
+
+}
+
+using namespace UpnpQt;
+
+MappingRegistry::MappingRegistry(QObject *parent) : QObject(parent)
+  , d_ptr(new MappingRegistryPrivate)
+{
+    Q_D(MappingRegistry);
+    d->q_ptr = this;
+    d->clock.start();
+    d->timer.setSingleShot(true);
+    connect(&d->timer, &QTimer::timeout, this, [=] {
+        d->renewDue();
+    });
+}
+
+MappingRegistry::~MappingRegistry()
+{
+    delete d_ptr;
+}
+
+void MappingRegistry::setJitter(double fraction)
+{
+    Q_D(MappingRegistry);
+    d->jitter = qBound(0.0, fraction, 0.4);
+}
+
+double MappingRegistry::jitter() const
+{
+    Q_D(const MappingRegistry);
+    return d->jitter;
+}
+
+void MappingRegistry::setCoalesceInterval(int msec)
+{
+    Q_D(MappingRegistry);
+    d->coalesce = qMax(0, msec);
+}
+
+int MappingRegistry::coalesceInterval() const
+{
+    Q_D(const MappingRegistry);
+    return d->coalesce;
+}
+
+void MappingRegistry::setOrphanGracePeriod(int msec)
+{
+    Q_D(MappingRegistry);
+    d->orphanGrace = qMax(0, msec);
+}
+
+int MappingRegistry::orphanGracePeriod() const
+{
+    Q_D(const MappingRegistry);
+    return d->orphanGrace;
+}
+
+void MappingRegistry::setWindow(int window)
+{
+    Q_D(MappingRegistry);
+    d->window = qMax(1, window);
+}
+
+int MappingRegistry::window() const
+{
+    Q_D(const MappingRegistry);
+    return d->window;
+}
+
+quint64 MappingRegistry::add(WanConnectionService *service, const WanConnectionService::PortMap &portMap)
+{
+    Q_D(MappingRegistry);
+    const quint64 id = d->nextId++;
+
+    MappingRegistryPrivate::Entry &entry = d->entries[id];
+    entry.service = service;
+    entry.portMap = portMap;
+    entry.inFlight = true;
+    d->watch(service);
+
+    qCDebug(UPNPQT_REGISTRY) << "add" << id << portMap.externalPort << portMap.sockType() << portMap.leaseDuration;
+    Reply *reply = service->addPortMapping(portMap.externalPort, portMap.internalAddress(), portMap.internalPort, portMap.sockType(),
+                                           portMap.description(), portMap.enabled, portMap.leaseDuration, portMap.remoteHost());
+    connect(reply, &Reply::finished, this, [=] {
+        d->finishRenewal(id, 0, !reply->error());
+    });
+
+    return id;
+}
+
+quint64 MappingRegistry::track(WanConnectionService *service, const WanConnectionService::PortMap &portMap)
+{
+    Q_D(MappingRegistry);
+    const quint64 id = d->nextId++;
+
+    MappingRegistryPrivate::Entry &entry = d->entries[id];
+    entry.service = service;
+    entry.portMap = portMap;
+    entry.established = true;
+    d->watch(service);
+
+    qCDebug(UPNPQT_REGISTRY) << "track" << id << portMap.externalPort << portMap.sockType() << portMap.leaseDuration;
+    if (portMap.leaseDuration > 0) {
+        d->schedule(id, entry, d->renewalDelay(entry));
+    }
+
+    return id;
+}
+
+quint64 MappingRegistry::addPinhole(WanIpv6FirewallControlService *firewall, const WanIpv6FirewallControlService::Pinhole &pinhole)
+{
+    Q_D(MappingRegistry);
+    const quint64 id = d->nextId++;
+
+    MappingRegistryPrivate::Entry &entry = d->entries[id];
+    entry.firewall = firewall;
+    entry.pinhole = pinhole;
+    entry.isPinhole = true;
+    entry.inFlight = true;
+    d->watch(firewall);
+
+    qCDebug(UPNPQT_REGISTRY) << "add pinhole" << id << pinhole.internalClient << pinhole.internalPort << pinhole.leaseTime;
+    d->renewPinhole(id, entry);
+
+    return id;
+}
+
+void MappingRegistry::remove(quint64 id, bool deleteMapping)
+{
+    Q_D(MappingRegistry);
+    auto it = d->entries.find(id);
+    if (it == d->entries.end()) {
+        return;
+    }
+
+    const MappingRegistryPrivate::Entry &entry = it->second;
+    qCDebug(UPNPQT_REGISTRY) << "remove" << id << entry.portMap.externalPort << deleteMapping;
+    if (entry.isPinhole) {
+        if (deleteMapping && entry.firewall) {
+            if (entry.established) {
+                entry.firewall->deletePinhole(entry.pinhole.uniqueId);
+            } else if (entry.inFlight) {
+                // its UniqueID is not known yet
+                d->pinholesToDelete.insert(id, entry.firewall.data());
+            }
+        }
+    } else if (deleteMapping && entry.service) {
+        entry.service->deletePortMapping(entry.portMap.externalPort, entry.portMap.sockType(), entry.portMap.remoteHost());
+    }
+    d->entries.erase(it);
+}
+
+int MappingRegistry::migrate(WanConnectionService *from, WanConnectionService *to)
+{
+    Q_D(MappingRegistry);
+    if (!to || from == to) {
+        return 0;
+    }
+    d->watch(to);
+
+    int moved = 0;
+    for (auto &item : d->entries) {
+        MappingRegistryPrivate::Entry &entry = item.second;
+        if (entry.isPinhole || entry.service != from) {
+            continue;
+        }
+
+        entry.service = to;
+        entry.failures = 0;
+        entry.established = false;
+        entry.inFlight = false;
+        entry.orphaned = false;
+        ++entry.epoch;
+        d->schedule(item.first, entry, 0);
+        ++moved;
+    }
+
+    qCDebug(UPNPQT_REGISTRY) << "migrated" << moved << "mappings from" << from << "to" << to;
+    return moved;
+}
+
+bool MappingRegistry::contains(quint64 id) const
+{
+    Q_D(const MappingRegistry);
+    return d->entries.find(id) != d->entries.end();
+}
+
+int MappingRegistry::count() const
+{
+    Q_D(const MappingRegistry);
+    return int(d->entries.size());
+}
+
+std::vector<WanConnectionService::PortMap> MappingRegistry::portMaps(WanConnectionService *service) const
+{
+    Q_D(const MappingRegistry);
+    std::vector<WanConnectionService::PortMap> ret;
+    for (const auto &item : d->entries) {
+        if (!item.second.isPinhole && item.second.service == service) {
+            ret.push_back(item.second.portMap);
+        }
+    }
+    return ret;
+}
+
+void MappingRegistryPrivate::schedule(quint64 id, Entry &entry, qint64 delay)
+{
+    entry.due = clock.elapsed() + delay;
+    heap.push(HeapItem(entry.due, id));
+    rearm();
+}
+
+qint64 MappingRegistryPrivate::renewalDelay(const Entry &entry) const
+{
+    // renew at half the lease, spread so mappings added together drift apart
+    const double fraction = 0.5 + jitter * QRandomGenerator::global()->generateDouble();
+    return qint64(entry.lease() * 1000.0 * fraction);
+}
+
+void MappingRegistryPrivate::rearm()
+{
+    while (!heap.empty()) {
+        const HeapItem &top = heap.top();
+        auto it = entries.find(top.second);
+        if (it != entries.end() && !it->second.inFlight && it->second.due == top.first) {
+            break;
+        }
+        heap.pop();
+    }
+
+    if (heap.empty()) {
+        timer.stop();
+        return;
+    }
+
+    const qint64 delay = qMax(qint64(0), heap.top().first - clock.elapsed());
+    timer.start(int(qMin(delay, qint64(std::numeric_limits<int>::max()))));
+}
+
+void MappingRegistryPrivate::renewDue()
+{
+    const qint64 horizon = clock.elapsed() + coalesce;
+
+    std::map<WanConnectionService *, std::vector<quint64>> batches;
+    std::vector<quint64> pinholes;
+    std::vector<std::pair<quint64, WanConnectionService::PortMap>> lostPortMaps;
+    std::vector<std::pair<quint64, WanIpv6FirewallControlService::Pinhole>> lostPinholes;
+    while (!heap.empty() && heap.top().first <= horizon) {
+        const HeapItem item = heap.top();
+        heap.pop();
+
+        auto it = entries.find(item.second);
+        if (it == entries.end() || it->second.inFlight || it->second.due != item.first) {
+            continue;
+        }
+
+        Entry &entry = it->second;
+        if (!entry.reachable()) {
+            if (entry.isPinhole) {
+                lostPinholes.push_back(std::make_pair(item.second, entry.pinhole));
+            } else if (entry.orphaned) {
+                // no gateway adopted it in time
+                lostPortMaps.push_back(std::make_pair(item.second, entry.portMap));
+            } else {
+                park(item.second, entry);
+                continue;
+            }
+            entries.erase(it);
+            continue;
+        }
+
+        entry.inFlight = true;
+        if (entry.isPinhole) {
+            pinholes.push_back(item.second);
+        } else {
+            batches[entry.service.data()].push_back(item.second);
+        }
+    }
+
+    for (const auto &batch : batches) {
+        WanConnectionService *service = batch.first;
+        const std::vector<quint64> ids = batch.second;
+
+        std::vector<WanConnectionService::PortMap> portMaps;
+        std::vector<int> epochs;
+        portMaps.reserve(ids.size());
+        epochs.reserve(ids.size());
+        for (quint64 id : ids) {
+            const Entry &entry = entries[id];
+            portMaps.push_back(entry.portMap);
+            epochs.push_back(entry.epoch);
+        }
+
+        qCDebug(UPNPQT_REGISTRY) << "renewing" << ids.size() << "mappings on" << service;
+        auto reply = service->addPortMappings(portMaps, window);
+        QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+            const std::vector<WanConnectionService::BatchResult> results = reply->takeResult();
+            for (size_t i = 0; i < ids.size(); ++i) {
+                finishRenewal(ids[i], epochs[i], i < results.size() && !results[i].error);
+            }
+        });
+    }
+
+    for (quint64 id : pinholes) {
+        renewPinhole(id, entries[id]);
+    }
+
+    rearm();
+
+    for (const auto &lost : lostPortMaps) {
+        Q_EMIT q_ptr->lost(lost.first, lost.second);
+    }
+    for (const auto &lost : lostPinholes) {
+        Q_EMIT q_ptr->pinholeLost(lost.first, lost.second);
+    }
+}
+
+void MappingRegistryPrivate::renewPinhole(quint64 id, const Entry &entry)
+{
+    const int epoch = entry.epoch;
+    WanIpv6FirewallControlService *firewall = entry.firewall.data();
+    const WanIpv6FirewallControlService::Pinhole pinhole = entry.pinhole;
+
+    if (!entry.established) {
+        auto reply = firewall->addPinhole(pinhole);
+        QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+            if (pinholesToDelete.remove(id)) {
+                // removed while being opened, don't leave it open until its lease ends
+                if (!reply->error()) {
+                    firewall->deletePinhole(reply->result());
+                }
+                return;
+            }
+
+            auto it = entries.find(id);
+            if (!reply->error() && it != entries.end() && it->second.epoch == epoch) {
+                it->second.pinhole.uniqueId = reply->result();
+            }
+            finishRenewal(id, epoch, !reply->error());
+        });
+        return;
+    }
+
+    Reply *reply = firewall->updatePinhole(pinhole.uniqueId, pinhole.leaseTime);
+    QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+        auto it = entries.find(id);
+        if (reply->upnpError() == Reply::NoSuchEntry && it != entries.end() && it->second.epoch == epoch && it->second.firewall) {
+            // expired or the gateway restarted, open it again
+            qCDebug(UPNPQT_REGISTRY) << "pinhole gone, adding it again" << id << pinhole.uniqueId;
+            it->second.established = false;
+            renewPinhole(id, it->second);
+            return;
+        }
+        finishRenewal(id, epoch, !reply->error());
+    });
+}
+
+void MappingRegistryPrivate::finishRenewal(quint64 id, int epoch, bool success)
+{
+    auto it = entries.find(id);
+    if (it == entries.end() || it->second.epoch != epoch) {
+        // removed or migrated while in flight
+        return;
+    }
+
+    Entry &entry = it->second;
+    entry.inFlight = false;
+    if (success) {
+        entry.established = true;
+        entry.failures = 0;
+        if (entry.lease() > 0) {
+            schedule(id, entry, renewalDelay(entry));
+        }
+        if (entry.isPinhole) {
+            Q_EMIT q_ptr->pinholeRenewed(id, entry.pinhole);
+        } else {
+            Q_EMIT q_ptr->renewed(id, entry.portMap);
+        }
+    } else if (entry.established && entry.reachable() && entry.lease() > 0 && ++entry.failures < 3) {
+        // the lease is still valid for a while, try again before giving up
+        qCDebug(UPNPQT_REGISTRY) << "renewal failed" << id << "attempt" << entry.failures;
+        schedule(id, entry, qint64(entry.lease()) * 1000 / 8);
+    } else if (entry.isPinhole) {
+        qCDebug(UPNPQT_REGISTRY) << "lost pinhole" << id << entry.pinhole.internalClient << entry.pinhole.internalPort;
+        const WanIpv6FirewallControlService::Pinhole pinhole = entry.pinhole;
+        entries.erase(it);
+        Q_EMIT q_ptr->pinholeLost(id, pinhole);
+    } else {
+        qCDebug(UPNPQT_REGISTRY) << "lost" << id << entry.portMap.externalPort << entry.portMap.sockType();
+        const WanConnectionService::PortMap portMap = entry.portMap;
+        entries.erase(it);
+        Q_EMIT q_ptr->lost(id, portMap);
+    }
+}
+
+void MappingRegistryPrivate::watch(QObject *gateway)
+{
+    if (watched.contains(gateway)) {
+        return;
+    }
+
+    watched.insert(gateway);
+    QObject::connect(gateway, &QObject::destroyed, q_ptr, [=] {
+        gatewayDestroyed(gateway);
+    });
+}
+
+void MappingRegistryPrivate::gatewayDestroyed(QObject *gateway)
+{
+    watched.remove(gateway);
+    for (auto it = pinholesToDelete.begin(); it != pinholesToDelete.end();) {
+        if (it.value() == gateway) {
+            it = pinholesToDelete.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // replies are children of the gateway and die with it without
+    // emitting finished, entries waiting on them would never move again.
+    // Mappings wait for a replacement gateway, pinholes aren't migrated
+    std::vector<std::pair<quint64, WanIpv6FirewallControlService::Pinhole>> lostPinholes;
+    for (auto it = entries.begin(); it != entries.end();) {
+        Entry &entry = it->second;
+        if (entry.reachable() || entry.orphaned) {
+            ++it;
+        } else if (entry.isPinhole) {
+            lostPinholes.push_back(std::make_pair(it->first, entry.pinhole));
+            it = entries.erase(it);
+        } else {
+            park(it->first, entry);
+            ++it;
+        }
+    }
+    rearm();
+
+    for (const auto &lost : lostPinholes) {
+        Q_EMIT q_ptr->pinholeLost(lost.first, lost.second);
+    }
+}
+
+void MappingRegistryPrivate::park(quint64 id, Entry &entry)
+{
+    qCDebug(UPNPQT_REGISTRY) << "orphaned" << id << entry.portMap.externalPort << entry.portMap.sockType();
+    entry.orphaned = true;
+    entry.inFlight = false;
+    entry.established = false;
+    ++entry.epoch;
+    entry.due = clock.elapsed() + orphanGrace;
+    heap.push(HeapItem(entry.due, id));
+}
+
+#include "moc_mappingregistry.cpp"
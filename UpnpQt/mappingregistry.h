@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPMAPPINGREGISTRY_H
+#define UPNPMAPPINGREGISTRY_H
+
+#include <QObject>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/wanconnectionservice.h>
+#include <UpnpQt/wanipv6firewallcontrolservice.h>
+
+namespace UpnpQt {
+
+/**
+ * Owns the lease renewal of port mappings on any number of gateways.
+ *
+ * All mappings share a single timer armed for the earliest renewal,
+ * renewals are spread with jitter and the ones falling close together
+ * are sent as one batch per gateway. IPv6 pinholes share the same timer
+ * and are kept open with UpdatePinhole.
+ */
+class MappingRegistryPrivate;
+class UPNPQT_LIBRARY MappingRegistry : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(MappingRegistry)
+public:
+    explicit MappingRegistry(QObject *parent = nullptr);
+    virtual ~MappingRegistry();
+
+    /**
+     * @brief setJitter
+     * @param fraction mappings are renewed at half their lease plus up
+     * to this fraction of the lease, defaults to 0.1
+     */
+    void setJitter(double fraction);
+    double jitter() const;
+
+    /**
+     * @brief setCoalesceInterval
+     * @param msec renewals due within this interval are sent in the same batch, defaults to 1000
+     */
+    void setCoalesceInterval(int msec);
+    int coalesceInterval() const;
+
+    /**
+     * @brief setOrphanGracePeriod
+     * @param msec time mappings of a destroyed gateway wait for migrate()
+     * to adopt them before lost() is emitted, defaults to 120000
+     */
+    void setOrphanGracePeriod(int msec);
+    int orphanGracePeriod() const;
+
+    /**
+     * @brief setWindow
+     * @param window maximum number of concurrent renewals per gateway, defaults to 4
+     */
+    void setWindow(int window);
+    int window() const;
+
+    /**
+     * @brief add
+     *
+     * Adds the mapping right away and renews it before every lease expires,
+     * mappings with a leaseDuration of 0 are added once and never renewed.
+     * @return an id to remove the mapping with
+     */
+    quint64 add(WanConnectionService *service, const WanConnectionService::PortMap &portMap);
+
+    /**
+     * @brief track
+     *
+     * Like add() for a mapping that was just added to service, only
+     * renewals are sent.
+     * @return an id to remove the mapping with
+     */
+    quint64 track(WanConnectionService *service, const WanConnectionService::PortMap &portMap);
+
+    /**
+     * @brief addPinhole
+     *
+     * Opens the pinhole right away and updates its lease before it expires,
+     * it's opened again if the gateway forgot it.
+     * @return an id to remove the pinhole with
+     */
+    quint64 addPinhole(WanIpv6FirewallControlService *firewall, const WanIpv6FirewallControlService::Pinhole &pinhole);
+
+    /**
+     * @brief remove
+     * @param id returned by add(), track() or addPinhole()
+     * @param deleteMapping also delete the mapping from the gateway
+     */
+    void remove(quint64 id, bool deleteMapping = true);
+
+    /**
+     * @brief migrate moves the mappings managed on from to another gateway
+     *
+     * They are added to to right away and renewed there from then on,
+     * nothing is sent to from as it's expected to be unreachable.
+     * A nullptr from adopts the mappings whose gateway was destroyed.
+     * @return the number of mappings moved
+     */
+    int migrate(WanConnectionService *from, WanConnectionService *to);
+
+    bool contains(quint64 id) const;
+    int count() const;
+
+    /**
+     * @brief portMaps
+     * @return the mappings managed on service, pinholes aside
+     */
+    std::vector<WanConnectionService::PortMap> portMaps(WanConnectionService *service) const;
+
+Q_SIGNALS:
+    void renewed(quint64 id, const UpnpQt::WanConnectionService::PortMap &portMap);
+
+    /**
+     * Emitted when adding or renewing failed, or when its gateway was destroyed
+     * and no other one adopted it within the grace period, the mapping is no
+     * longer managed.
+     */
+    void lost(quint64 id, const UpnpQt::WanConnectionService::PortMap &portMap);
+
+    /**
+     * Emitted when a pinhole was opened or its lease updated, uniqueId is
+     * the one assigned by the gateway.
+     */
+    void pinholeRenewed(quint64 id, const UpnpQt::WanIpv6FirewallControlService::Pinhole &pinhole);
+    void pinholeLost(quint64 id, const UpnpQt::WanIpv6FirewallControlService::Pinhole &pinhole);
+
+private:
+    MappingRegistryPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPMAPPINGREGISTRY_H
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "metrics.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+
+namespace UpnpQt {
+
+class MetricsPrivate
+{
+public:
+    MetricsPrivate();
+
+    static Metrics::Histogram histogram();
+    static void record(Metrics::Histogram &histogram, qint64 msec);
+
+    mutable QMutex mutex;
+    Metrics::Snapshot data;
+    std::function<void(const Metrics::ActionSample &)> observer;
+    QAtomicInt enabled{0};
+};
+
+}
+
+using namespace UpnpQt;
+
+namespace {
+
+QByteArray labelValue(const QString &value)
+{
+    QByteArray ret = value.toUtf8();
+    ret.replace('\\', "\\\\");
+    ret.replace('"', "\\\"");
+    ret.replace('\n', "\\n");
+    return ret;
+}
+
+void writeHistogram(QByteArray &out, const char *name, const QByteArray &labels, const Metrics::Histogram &histogram)
+{
+    QByteArray prefix = labels;
+    if (!prefix.isEmpty()) {
+        prefix.append(',');
+    }
+    quint64 cumulative = 0;
+    for (size_t i = 0; i < histogram.bounds.size(); ++i) {
+        cumulative += histogram.counts[i];
+        out.append(name).append("_bucket{").append(prefix).append("le=\"")
+                .append(QByteArray::number(histogram.bounds[i] / 1000.0)).append("\"} ")
+                .append(QByteArray::number(cumulative)).append('\n');
+    }
+    out.append(name).append("_bucket{").append(prefix).append("le=\"+Inf\"} ")
+            .append(QByteArray::number(histogram.count)).append('\n');
+
+    QByteArray braces;
+    if (!labels.isEmpty()) {
+        braces.append('{').append(labels).append('}');
+    }
+    out.append(name).append("_sum").append(braces).append(' ')
+            .append(QByteArray::number(histogram.sum / 1000.0)).append('\n');
+    out.append(name).append("_count").append(braces).append(' ')
+            .append(QByteArray::number(histogram.count)).append('\n');
+}
+
+}
+
+MetricsPrivate::MetricsPrivate()
+{
+    data.descriptionFetch = histogram();
+}
+
+Metrics::Histogram MetricsPrivate::histogram()
+{
+    Metrics::Histogram ret;
+    ret.bounds = { 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+    ret.counts.resize(ret.bounds.size() + 1, 0);
+    return ret;
+}
+
+void MetricsPrivate::record(Metrics::Histogram &histogram, qint64 msec)
+{
+    size_t i = 0;
+    while (i < histogram.bounds.size() && msec > histogram.bounds[i]) {
+        ++i;
+    }
+    ++histogram.counts[i];
+    ++histogram.count;
+    histogram.sum += msec;
+}
+
+Metrics::Metrics()
+    : d_ptr(new MetricsPrivate)
+{
+}
+
+Metrics::~Metrics()
+{
+    delete d_ptr;
+}
+
+Metrics *Metrics::instance()
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+void Metrics::setEnabled(bool enabled)
+{
+    Q_D(Metrics);
+    d->enabled.store(enabled ? 1 : 0);
+}
+
+bool Metrics::isEnabled() const
+{
+    Q_D(const Metrics);
+    return d->enabled.load();
+}
+
+void Metrics::setObserver(const std::function<void (const Metrics::ActionSample &)> &observer)
+{
+    Q_D(Metrics);
+    QMutexLocker locker(&d->mutex);
+    d->observer = observer;
+}
+
+Metrics::Snapshot Metrics::snapshot() const
+{
+    Q_D(const Metrics);
+    QMutexLocker locker(&d->mutex);
+    return d->data;
+}
+
+QByteArray Metrics::toPrometheus() const
+{
+    const Snapshot data = snapshot();
+
+    QByteArray out;
+    out.append("# HELP upnpqt_ssdp_packets_total SSDP datagrams by outcome\n"
+               "# TYPE upnpqt_ssdp_packets_total counter\n");
+    out.append("upnpqt_ssdp_packets_total{state=\"received\"} ").append(QByteArray::number(data.ssdpReceived)).append('\n');
+    out.append("upnpqt_ssdp_packets_total{state=\"parsed\"} ").append(QByteArray::number(data.ssdpParsed)).append('\n');
+    out.append("upnpqt_ssdp_packets_total{state=\"dropped\"} ").append(QByteArray::number(data.ssdpDropped)).append('\n');
+
+    out.append("# HELP upnpqt_description_fetch_seconds Device description download time\n"
+               "# TYPE upnpqt_description_fetch_seconds histogram\n");
+    writeHistogram(out, "upnpqt_description_fetch_seconds", QByteArray(), data.descriptionFetch);
+
+    out.append("# HELP upnpqt_action_duration_seconds SOAP action time including retries\n"
+               "# TYPE upnpqt_action_duration_seconds histogram\n");
+    for (const auto &item : data.actionLatency) {
+        const QByteArray labels = QByteArrayLiteral("action=\"") + labelValue(item.first) + QByteArrayLiteral("\"");
+        writeHistogram(out, "upnpqt_action_duration_seconds", labels, item.second);
+    }
+
+    out.append("# HELP upnpqt_action_errors_total Failed SOAP actions by UPnP error code\n"
+               "# TYPE upnpqt_action_errors_total counter\n");
+    for (const auto &item : data.errors) {
+        out.append("upnpqt_action_errors_total{code=\"").append(QByteArray::number(item.first)).append("\"} ")
+                .append(QByteArray::number(item.second)).append('\n');
+    }
+
+    out.append("# HELP upnpqt_requests_in_flight SOAP actions waiting for an answer\n"
+               "# TYPE upnpqt_requests_in_flight gauge\n");
+    for (const auto &item : data.inFlight) {
+        out.append("upnpqt_requests_in_flight{gateway=\"").append(labelValue(item.first)).append("\"} ")
+                .append(QByteArray::number(item.second)).append('\n');
+    }
+
+    return out;
+}
+
+void Metrics::reset()
+{
+    Q_D(Metrics);
+    QMutexLocker locker(&d->mutex);
+    // requests in flight are still going to finish
+    const std::map<QString, qint64> inFlight = d->data.inFlight;
+    d->data = Snapshot();
+    d->data.descriptionFetch = MetricsPrivate::histogram();
+    d->data.inFlight = inFlight;
+}
+
+void Metrics::ssdpReceived()
+{
+    Q_D(Metrics);
+    if (d->enabled.load()) {
+        QMutexLocker locker(&d->mutex);
+        ++d->data.ssdpReceived;
+    }
+}
+
+void Metrics::ssdpParsed()
+{
+    Q_D(Metrics);
+    if (d->enabled.load()) {
+        QMutexLocker locker(&d->mutex);
+        ++d->data.ssdpParsed;
+    }
+}
+
+void Metrics::ssdpDropped()
+{
+    Q_D(Metrics);
+    if (d->enabled.load()) {
+        QMutexLocker locker(&d->mutex);
+        ++d->data.ssdpDropped;
+    }
+}
+
+void Metrics::descriptionFetched(qint64 msec)
+{
+    Q_D(Metrics);
+    if (d->enabled.load()) {
+        QMutexLocker locker(&d->mutex);
+        MetricsPrivate::record(d->data.descriptionFetch, msec);
+    }
+}
+
+void Metrics::actionStarted(const QString &gateway)
+{
+    Q_D(Metrics);
+    QMutexLocker locker(&d->mutex);
+    ++d->data.inFlight[gateway];
+}
+
+void Metrics::actionsAbandoned(const QString &gateway, int count)
+{
+    Q_D(Metrics);
+    QMutexLocker locker(&d->mutex);
+    auto it = d->data.inFlight.find(gateway);
+    if (it != d->data.inFlight.end()) {
+        it->second -= count;
+        if (it->second <= 0) {
+            d->data.inFlight.erase(it);
+        }
+    }
+}
+
+void Metrics::actionFinished(const QString &gateway, const QString &action, qint64 msec, int errorCode)
+{
+    Q_D(Metrics);
+    std::function<void(const ActionSample &)> observer;
+    {
+        QMutexLocker locker(&d->mutex);
+        // the gauge is balanced even if disabled meanwhile, idle gateways are dropped
+        auto gauge = d->data.inFlight.find(gateway);
+        if (gauge != d->data.inFlight.end() && --gauge->second <= 0) {
+            d->data.inFlight.erase(gauge);
+        }
+        if (!d->enabled.load()) {
+            return;
+        }
+
+        auto it = d->data.actionLatency.find(action);
+        if (it == d->data.actionLatency.end()) {
+            it = d->data.actionLatency.insert(std::make_pair(action, MetricsPrivate::histogram())).first;
+        }
+        MetricsPrivate::record(it->second, msec);
+
+        if (errorCode) {
+            ++d->data.errors[errorCode];
+        }
+        observer = d->observer;
+    }
+
+    if (observer) {
+        ActionSample sample;
+        sample.gateway = gateway;
+        sample.action = action;
+        sample.msec = msec;
+        sample.errorCode = errorCode;
+        observer(sample);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_METRICS_H
+#define UPNPQT_METRICS_H
+
+#include <QString>
+#include <QByteArray>
+
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <UpnpQt/global.h>
+
+namespace UpnpQt {
+
+/**
+ * Process wide counters of what the library is doing.
+ *
+ * Discover and every service action record into instance(), from
+ * whatever thread they run on. Read it with snapshot() or toPrometheus(),
+ * or get each action as it completes with setObserver().
+ */
+class MetricsPrivate;
+class UPNPQT_LIBRARY Metrics
+{
+    Q_DECLARE_PRIVATE(Metrics)
+public:
+    /**
+     * Latencies in msec, counts[i] holds samples up to bounds[i] and the
+     * last one everything above.
+     */
+    struct Histogram {
+        std::vector<double> bounds;
+        std::vector<quint64> counts;
+        quint64 count = 0;
+        double sum = 0;
+    };
+
+    struct Snapshot {
+        quint64 ssdpReceived = 0;
+        quint64 ssdpParsed = 0;
+        quint64 ssdpDropped = 0;
+        Histogram descriptionFetch;
+        /** by SOAP action name */
+        std::map<QString, Histogram> actionLatency;
+        /** by UPnP error code, -1 for failures without one */
+        std::map<int, quint64> errors;
+        /** requests waiting for an answer by gateway URL, idle gateways are left out */
+        std::map<QString, qint64> inFlight;
+    };
+
+    struct ActionSample {
+        QString gateway;
+        QString action;
+        qint64 msec;
+        /** 0 on success */
+        int errorCode;
+    };
+
+    static Metrics *instance();
+
+    /**
+     * @brief setEnabled
+     * @param enabled when false nothing is recorded, defaults to false
+     * as every recorded action takes a process wide lock
+     */
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    /**
+     * @brief setObserver
+     * @param observer called on the thread of the service after each
+     * action, pass an empty function to remove it
+     */
+    void setObserver(const std::function<void(const ActionSample &sample)> &observer);
+
+    Snapshot snapshot() const;
+
+    /**
+     * @brief toPrometheus
+     * @return the snapshot in Prometheus text exposition format
+     */
+    QByteArray toPrometheus() const;
+    void reset();
+
+    void ssdpReceived();
+    void ssdpParsed();
+    void ssdpDropped();
+    void descriptionFetched(qint64 msec);
+    void actionStarted(const QString &gateway);
+    void actionFinished(const QString &gateway, const QString &action, qint64 msec, int errorCode);
+    /** Actions of a destroyed service that will never finish */
+    void actionsAbandoned(const QString &gateway, int count);
+
+private:
+    Metrics();
+    ~Metrics();
+
+    MetricsPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPQT_METRICS_H
@@ -0,0 +1,652 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "natpmpclient.h"
+#include "localaddress_p.h"
+
+#include <QUdpSocket>
+#include <QTimer>
+#include <QFile>
+#include <QtEndian>
+#include <QRandomGenerator>
+
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_NATPMP, "upnpqt.natpmp", QtInfoMsg)
+
+namespace {
+
+const quint16 ServerPort = 5351;
+const quint8 NatPmpVersion = 0;
+const quint8 PcpVersion = 2;
+const quint8 ResponseBit = 0x80;
+
+// NAT-PMP opcodes
+const quint8 OpExternalAddress = 0;
+const quint8 OpMapUdp = 1;
+const quint8 OpMapTcp = 2;
+
+// PCP
+const quint8 PcpOpMap = 1;
+const int PcpHeaderSize = 24;
+const int PcpMapSize = PcpHeaderSize + 36;
+
+// RFC 6886 section 3.3
+const quint32 RecommendedLifetime = 7200;
+
+}
+
+namespace UpnpQt {
+
+class NatPmpClientPrivate
+{
+public:
+    enum Kind {
+        ExternalIp,
+        Map,
+    };
+
+    struct Request {
+        Reply *reply = nullptr;
+        QTimer *timer = nullptr;
+        Kind kind = ExternalIp;
+        quint8 version = NatPmpVersion;
+        QAbstractSocket::SocketType sockType = QAbstractSocket::TcpSocket;
+        quint16 internalPort = 0;
+        quint16 externalPort = 0;
+        quint32 lifetime = 0;
+        int attempt = 0;
+        // waiting for another request on the same mapping
+        bool queued = false;
+    };
+    typedef std::map<quint64, Request>::iterator RequestIterator;
+
+    quint64 start(const Request &request);
+    void send(quint64 id);
+    void readDatagrams();
+    void handleNatPmp(const uchar *data, int size);
+    void handlePcp(const uchar *data, int size);
+    RequestIterator findMap(quint8 version, QAbstractSocket::SocketType sockType, int internalPort);
+    bool mappingBusy(quint64 id, const Request &request) const;
+    void startQueued(QAbstractSocket::SocketType sockType, quint16 internalPort);
+    void finishMap(RequestIterator it, quint16 externalPort, quint32 lifetime);
+    void fail(RequestIterator it, const QString &errorString, const QString &errorCode);
+    void fallBackToNatPmp();
+    QHostAddress sourceAddress();
+    quint8 mapVersion() const;
+
+    static QString natPmpError(quint16 result, QString *code);
+    static QString pcpError(quint8 result, QString *code);
+
+    NatPmpClient *q_ptr;
+    QUdpSocket socket;
+    QHostAddress gateway;
+    QHostAddress source;
+    // assigned to the last PCP mapping, PCP has no external address request
+    QHostAddress externalAddress;
+    std::map<quint64, Request> requests;
+    quint64 nextId = 1;
+    NatPmpClient::Protocol protocol = NatPmpClient::Auto;
+    bool fellBack = false;
+    quint32 nonce[3];
+    int initialTimeout = 250;
+    int retries = 2;
+};
+
+}
+
+using namespace UpnpQt;
+
+NatPmpClient::NatPmpClient(const QHostAddress &gateway, QObject *parent) : QObject(parent)
+  , d_ptr(new NatPmpClientPrivate)
+{
+    Q_D(NatPmpClient);
+    d->q_ptr = this;
+    d->gateway = gateway.isNull() ? defaultGateway() : gateway;
+
+    // one nonce for every mapping of this client, PCP needs it again to renew or delete them
+    QRandomGenerator::global()->fillRange(d->nonce, 3);
+
+    if (!d->socket.bind(d->gateway.protocol() == QAbstractSocket::IPv6Protocol ? QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4)) {
+        qCWarning(UPNPQT_NATPMP) << "Failed to bind UDP socket" << d->socket.errorString();
+    }
+    connect(&d->socket, &QUdpSocket::readyRead, this, [=] {
+        d->readDatagrams();
+    });
+}
+
+NatPmpClient::~NatPmpClient()
+{
+    delete d_ptr;
+}
+
+QHostAddress NatPmpClient::defaultGateway()
+{
+    QFile file(QStringLiteral("/proc/net/route"));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QHostAddress();
+    }
+
+    // Iface Destination Gateway Flags ..., addresses in network order printed as hex
+    file.readLine();
+    while (!file.atEnd()) {
+        const QList<QByteArray> fields = file.readLine().simplified().split(' ');
+        if (fields.size() < 3 || fields.at(1) != "00000000") {
+            continue;
+        }
+
+        bool ok;
+        const quint32 value = fields.at(2).toUInt(&ok, 16);
+        if (ok && value) {
+            return QHostAddress(qFromBigEndian(value));
+        }
+    }
+    return QHostAddress();
+}
+
+QHostAddress NatPmpClient::gateway() const
+{
+    Q_D(const NatPmpClient);
+    return d->gateway;
+}
+
+void NatPmpClient::setProtocol(Protocol protocol)
+{
+    Q_D(NatPmpClient);
+    d->protocol = protocol;
+    d->fellBack = false;
+}
+
+NatPmpClient::Protocol NatPmpClient::protocol() const
+{
+    Q_D(const NatPmpClient);
+    return d->protocol;
+}
+
+NatPmpClient::Protocol NatPmpClient::activeProtocol() const
+{
+    Q_D(const NatPmpClient);
+    return d->mapVersion() == PcpVersion ? Pcp : NatPmp;
+}
+
+void NatPmpClient::setInitialTimeout(int msec)
+{
+    Q_D(NatPmpClient);
+    d->initialTimeout = qMax(1, msec);
+}
+
+int NatPmpClient::initialTimeout() const
+{
+    Q_D(const NatPmpClient);
+    return d->initialTimeout;
+}
+
+void NatPmpClient::setRetries(int retries)
+{
+    Q_D(NatPmpClient);
+    d->retries = qBound(0, retries, 8);
+}
+
+int NatPmpClient::retries() const
+{
+    Q_D(const NatPmpClient);
+    return d->retries;
+}
+
+TypedReply<QString> *NatPmpClient::getExternalIp()
+{
+    Q_D(NatPmpClient);
+    auto reply = new TypedReply<QString>(this);
+
+    NatPmpClientPrivate::Request request;
+    request.reply = reply;
+    request.kind = NatPmpClientPrivate::ExternalIp;
+    if (d->mapVersion() == PcpVersion && !d->externalAddress.isNull()) {
+        const QString address = d->externalAddress.toString();
+        QTimer::singleShot(0, reply, [=] {
+            reply->finishWithResult(address);
+        });
+        return reply;
+    }
+    d->start(request);
+
+    return reply;
+}
+
+TypedReply<WanConnectionService::PortMap> *NatPmpClient::addPortMapping(quint16 externalPort, quint16 internalPort,
+                                                                       QAbstractSocket::SocketType sockType,
+                                                                       int leaseDuration)
+{
+    Q_D(NatPmpClient);
+    auto reply = new TypedReply<WanConnectionService::PortMap>(this);
+    if (internalPort == 0) {
+        reply->finishWithErrorLater(QStringLiteral("Internal port can't be 0"), QString::number(Reply::InvalidArgs));
+        return reply;
+    }
+
+    NatPmpClientPrivate::Request request;
+    request.reply = reply;
+    request.kind = NatPmpClientPrivate::Map;
+    request.version = d->mapVersion();
+    request.sockType = sockType;
+    request.internalPort = internalPort;
+    request.externalPort = externalPort;
+    request.lifetime = leaseDuration > 0 ? quint32(leaseDuration) : RecommendedLifetime;
+    d->start(request);
+
+    return reply;
+}
+
+Reply *NatPmpClient::deletePortMapping(quint16 internalPort, QAbstractSocket::SocketType sockType)
+{
+    Q_D(NatPmpClient);
+    auto reply = new Reply(this);
+
+    NatPmpClientPrivate::Request request;
+    request.reply = reply;
+    request.kind = NatPmpClientPrivate::Map;
+    request.version = d->mapVersion();
+    request.sockType = sockType;
+    request.internalPort = internalPort;
+    d->start(request);
+
+    return reply;
+}
+
+quint8 NatPmpClientPrivate::mapVersion() const
+{
+    if (protocol == NatPmpClient::NatPmp || (protocol == NatPmpClient::Auto && fellBack)) {
+        return NatPmpVersion;
+    }
+    return PcpVersion;
+}
+
+quint64 NatPmpClientPrivate::start(const Request &request)
+{
+    const quint64 id = nextId++;
+    if (gateway.isNull()) {
+        request.reply->finishWithErrorLater(QStringLiteral("No gateway address"));
+        return id;
+    }
+
+    Request &entry = requests[id];
+    entry = request;
+    entry.timer = new QTimer(request.reply);
+    entry.timer->setSingleShot(true);
+    QObject::connect(entry.timer, &QTimer::timeout, q_ptr, [=] {
+        auto it = requests.find(id);
+        if (it == requests.end()) {
+            return;
+        }
+
+        if (++it->second.attempt > retries) {
+            qCDebug(UPNPQT_NATPMP) << "no answer from" << gateway;
+            fail(it, QStringLiteral("Gateway did not answer"), QString());
+            return;
+        }
+        send(id);
+    });
+
+    // answers only carry the protocol and internal port, requests on
+    // one mapping go out one at a time so they can't be mixed up
+    if (entry.kind == Map && mappingBusy(id, entry)) {
+        qCDebug(UPNPQT_NATPMP) << "queued behind a request on" << entry.internalPort << entry.sockType;
+        entry.queued = true;
+        return id;
+    }
+
+    send(id);
+    return id;
+}
+
+bool NatPmpClientPrivate::mappingBusy(quint64 id, const Request &request) const
+{
+    for (const auto &item : requests) {
+        const Request &other = item.second;
+        if (item.first != id && other.kind == Map && !other.queued &&
+                other.sockType == request.sockType && other.internalPort == request.internalPort) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void NatPmpClientPrivate::startQueued(QAbstractSocket::SocketType sockType, quint16 internalPort)
+{
+    // requests are ordered by id, the oldest one goes first
+    for (auto &item : requests) {
+        Request &request = item.second;
+        if (request.queued && request.sockType == sockType && request.internalPort == internalPort) {
+            request.queued = false;
+            if (request.version == PcpVersion) {
+                request.version = mapVersion();
+            }
+            send(item.first);
+            return;
+        }
+    }
+}
+
+void NatPmpClientPrivate::send(quint64 id)
+{
+    Request &request = requests[id];
+
+    uchar data[PcpMapSize] = {};
+    int size;
+    if (request.kind == ExternalIp) {
+        data[0] = NatPmpVersion;
+        data[1] = OpExternalAddress;
+        size = 2;
+    } else if (request.version == NatPmpVersion) {
+        data[0] = NatPmpVersion;
+        data[1] = request.sockType == QAbstractSocket::UdpSocket ? OpMapUdp : OpMapTcp;
+        qToBigEndian<quint16>(request.internalPort, data + 4);
+        qToBigEndian<quint16>(request.externalPort, data + 6);
+        qToBigEndian<quint32>(request.lifetime, data + 8);
+        size = 12;
+    } else {
+        data[0] = PcpVersion;
+        data[1] = PcpOpMap;
+        qToBigEndian<quint32>(request.lifetime, data + 4);
+        const Q_IPV6ADDR client = sourceAddress().toIPv6Address();
+        memcpy(data + 8, client.c, 16);
+
+        memcpy(data + PcpHeaderSize, nonce, sizeof(nonce));
+        data[PcpHeaderSize + 12] = request.sockType == QAbstractSocket::UdpSocket ? 17 : 6;
+        qToBigEndian<quint16>(request.internalPort, data + PcpHeaderSize + 16);
+        qToBigEndian<quint16>(request.externalPort, data + PcpHeaderSize + 18);
+        // the suggested external address stays all zeros, ::ffff:0.0.0.0 for IPv4
+        if (gateway.protocol() == QAbstractSocket::IPv4Protocol) {
+            data[PcpHeaderSize + 30] = 0xff;
+            data[PcpHeaderSize + 31] = 0xff;
+        }
+        size = PcpMapSize;
+    }
+
+    socket.writeDatagram(reinterpret_cast<const char *>(data), size, gateway, ServerPort);
+    request.timer->start(initialTimeout << request.attempt);
+}
+
+void NatPmpClientPrivate::readDatagrams()
+{
+    while (socket.hasPendingDatagrams()) {
+        uchar data[1100];
+        QHostAddress sender;
+        quint16 senderPort;
+        const qint64 size = socket.readDatagram(reinterpret_cast<char *>(data), sizeof(data), &sender, &senderPort);
+        if (size < 4 || senderPort != ServerPort || !sender.isEqual(gateway, QHostAddress::TolerantConversion)) {
+            continue;
+        }
+
+        if (data[0] == NatPmpVersion) {
+            handleNatPmp(data, int(size));
+        } else if (data[0] == PcpVersion) {
+            handlePcp(data, int(size));
+        }
+    }
+}
+
+void NatPmpClientPrivate::handleNatPmp(const uchar *data, int size)
+{
+    const quint8 op = data[1];
+    const quint16 result = qFromBigEndian<quint16>(data + 2);
+    if (!(op & ResponseBit)) {
+        return;
+    }
+
+    if (op == (ResponseBit | OpExternalAddress)) {
+        auto it = requests.begin();
+        while (it != requests.end() && it->second.kind != ExternalIp) {
+            ++it;
+        }
+        if (it == requests.end()) {
+            return;
+        }
+
+        QString code;
+        if (result != 0) {
+            const QString errorString = natPmpError(result, &code);
+            fail(it, errorString, code);
+        } else if (size >= 12) {
+            const QHostAddress address(qFromBigEndian<quint32>(data + 8));
+            auto reply = static_cast<TypedReply<QString> *>(it->second.reply);
+            delete it->second.timer;
+            requests.erase(it);
+            reply->finishWithResult(address.toString());
+        }
+        return;
+    }
+
+    if (result == 1 && op == (ResponseBit | PcpOpMap)) {
+        // a NAT-PMP only gateway rejecting a PCP request
+        auto it = findMap(PcpVersion, QAbstractSocket::UnknownSocketType, -1);
+        if (it != requests.end()) {
+            if (protocol == NatPmpClient::Auto) {
+                fallBackToNatPmp();
+            } else {
+                fail(it, QStringLiteral("Gateway doesn't support PCP"), QStringLiteral("natpmp:1"));
+            }
+            return;
+        }
+    }
+
+    const QAbstractSocket::SocketType sockType = op == (ResponseBit | OpMapUdp) ? QAbstractSocket::UdpSocket : QAbstractSocket::TcpSocket;
+    // errors may be short, the internal port is not known then
+    const int internalPort = size >= 16 ? qFromBigEndian<quint16>(data + 8) : -1;
+    auto it = findMap(NatPmpVersion, sockType, internalPort);
+    if (it == requests.end()) {
+        return;
+    }
+
+    if (result != 0) {
+        QString code;
+        const QString errorString = natPmpError(result, &code);
+        fail(it, errorString, code);
+    } else if (size >= 16) {
+        finishMap(it, qFromBigEndian<quint16>(data + 10), qFromBigEndian<quint32>(data + 12));
+    }
+}
+
+void NatPmpClientPrivate::handlePcp(const uchar *data, int size)
+{
+    const quint8 op = data[1];
+    const quint8 result = data[3];
+    if (size < PcpHeaderSize || !(op & ResponseBit)) {
+        return;
+    }
+
+    if (op == (ResponseBit | OpExternalAddress) && result == 1) {
+        // a PCP only gateway rejecting the NAT-PMP external address request
+        auto it = requests.begin();
+        while (it != requests.end() && it->second.kind != ExternalIp) {
+            ++it;
+        }
+        if (it != requests.end()) {
+            fail(it, QStringLiteral("Gateway only speaks PCP, add a mapping to learn the external address"), QStringLiteral("pcp:1"));
+        }
+        return;
+    }
+
+    if (op != (ResponseBit | PcpOpMap)) {
+        return;
+    }
+
+    RequestIterator it;
+    if (size >= PcpMapSize) {
+        if (memcmp(data + PcpHeaderSize, nonce, sizeof(nonce)) != 0) {
+            return;
+        }
+        const quint8 proto = data[PcpHeaderSize + 12];
+        it = findMap(PcpVersion, proto == 17 ? QAbstractSocket::UdpSocket : QAbstractSocket::TcpSocket,
+                     qFromBigEndian<quint16>(data + PcpHeaderSize + 16));
+    } else {
+        it = findMap(PcpVersion, QAbstractSocket::UnknownSocketType, -1);
+    }
+    if (it == requests.end()) {
+        return;
+    }
+
+    if (result != 0) {
+        QString code;
+        const QString errorString = pcpError(result, &code);
+        fail(it, errorString, code);
+    } else if (size >= PcpMapSize) {
+        Q_IPV6ADDR address;
+        memcpy(address.c, data + PcpHeaderSize + 20, 16);
+        bool ok;
+        const quint32 ipv4 = QHostAddress(address).toIPv4Address(&ok);
+        const QHostAddress assigned = ok ? QHostAddress(ipv4) : QHostAddress(address);
+        if (!assigned.isNull() && assigned != QHostAddress::AnyIPv4 && assigned != QHostAddress::AnyIPv6) {
+            externalAddress = assigned;
+        }
+        finishMap(it, qFromBigEndian<quint16>(data + PcpHeaderSize + 18), qFromBigEndian<quint32>(data + 4));
+    }
+}
+
+NatPmpClientPrivate::RequestIterator NatPmpClientPrivate::findMap(quint8 version, QAbstractSocket::SocketType sockType, int internalPort)
+{
+    for (auto it = requests.begin(); it != requests.end(); ++it) {
+        const Request &request = it->second;
+        if (request.kind == Map && !request.queued && request.version == version &&
+                (sockType == QAbstractSocket::UnknownSocketType || request.sockType == sockType) &&
+                (internalPort < 0 || request.internalPort == internalPort)) {
+            return it;
+        }
+    }
+    return requests.end();
+}
+
+void NatPmpClientPrivate::finishMap(RequestIterator it, quint16 externalPort, quint32 lifetime)
+{
+    const Request request = it->second;
+    delete request.timer;
+    requests.erase(it);
+    startQueued(request.sockType, request.internalPort);
+
+    if (request.lifetime == 0) {
+        qCDebug(UPNPQT_NATPMP) << "deleted" << request.internalPort << request.sockType;
+        request.reply->finish();
+        return;
+    }
+
+    WanConnectionService::PortMap portMap;
+    portMap.externalPort = externalPort;
+    portMap.internalPort = request.internalPort;
+    portMap.leaseDuration = int(qMin(lifetime, quint32(std::numeric_limits<int>::max())));
+    portMap.setSockType(request.sockType);
+    portMap.setInternalAddress(sourceAddress());
+
+    qCDebug(UPNPQT_NATPMP) << "mapped" << externalPort << "to" << request.internalPort << request.sockType << lifetime;
+    static_cast<TypedReply<WanConnectionService::PortMap> *>(request.reply)->finishWithResult(std::move(portMap));
+}
+
+void NatPmpClientPrivate::fail(RequestIterator it, const QString &errorString, const QString &errorCode)
+{
+    const Request request = it->second;
+    delete request.timer;
+    requests.erase(it);
+    if (request.kind == Map) {
+        startQueued(request.sockType, request.internalPort);
+    }
+    request.reply->finishWithError(errorString, errorCode);
+}
+
+void NatPmpClientPrivate::fallBackToNatPmp()
+{
+    qCInfo(UPNPQT_NATPMP) << "Gateway" << gateway << "doesn't support PCP, using NAT-PMP";
+    fellBack = true;
+
+    // resend everything that went out as PCP
+    for (auto &item : requests) {
+        Request &request = item.second;
+        if (request.kind == Map && request.version == PcpVersion) {
+            request.version = NatPmpVersion;
+            request.attempt = 0;
+            if (!request.queued) {
+                send(item.first);
+            }
+        }
+    }
+}
+
+QHostAddress NatPmpClientPrivate::sourceAddress()
+{
+    if (source.isNull()) {
+        source = localAddressTowards(gateway, ServerPort);
+    }
+    return source;
+}
+
+QString NatPmpClientPrivate::natPmpError(quint16 result, QString *code)
+{
+    switch (result) {
+    case 1:
+        *code = QStringLiteral("natpmp:1");
+        return QStringLiteral("Unsupported version");
+    case 2:
+        *code = QString::number(Reply::ActionNotAuthorized);
+        return QStringLiteral("Not authorized or refused");
+    case 3:
+        *code = QStringLiteral("natpmp:3");
+        return QStringLiteral("Network failure");
+    case 4:
+        *code = QString::number(Reply::NoPortMapsAvailable);
+        return QStringLiteral("Out of resources");
+    case 5:
+        *code = QStringLiteral("natpmp:5");
+        return QStringLiteral("Unsupported opcode");
+    default:
+        *code = QLatin1String("natpmp:") + QString::number(result);
+        return QStringLiteral("Unknown error");
+    }
+}
+
+QString NatPmpClientPrivate::pcpError(quint8 result, QString *code)
+{
+    switch (result) {
+    case 2:
+        *code = QString::number(Reply::ActionNotAuthorized);
+        return QStringLiteral("Not authorized");
+    case 8:
+        *code = QString::number(Reply::NoPortMapsAvailable);
+        return QStringLiteral("No resources");
+    case 10:
+        *code = QString::number(Reply::NoPortMapsAvailable);
+        return QStringLiteral("User exceeded quota");
+    case 11:
+        *code = QString::number(Reply::ConflictInMappingEntry);
+        return QStringLiteral("Cannot provide external port");
+    case 12:
+        *code = QStringLiteral("pcp:12");
+        return QStringLiteral("Address mismatch");
+    default:
+        break;
+    }
+
+    static const char *names[] = {
+        "Success", "Unsupported version", "Not authorized", "Malformed request", "Unsupported opcode",
+        "Unsupported option", "Malformed option", "Network failure", "No resources", "Unsupported protocol",
+    };
+    *code = QLatin1String("pcp:") + QString::number(result);
+    return result < sizeof(names) / sizeof(names[0]) ? QLatin1String(names[result]) : QStringLiteral("Unknown error");
+}
+
+#include "moc_natpmpclient.cpp"
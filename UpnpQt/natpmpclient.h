@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_NATPMPCLIENT_H
+#define UPNPQT_NATPMPCLIENT_H
+
+#include <QObject>
+#include <QHostAddress>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/reply.h>
+#include <UpnpQt/wanconnectionservice.h>
+
+namespace UpnpQt {
+
+/**
+ * NAT-PMP (RFC 6886) and PCP (RFC 6887) client.
+ *
+ * Every operation is a single UDP exchange with the gateway, retransmitted
+ * with a doubling timeout until retries() is exhausted. Mappings are made
+ * for the address this host uses to reach the gateway. In Auto mode PCP
+ * is tried first and the client falls back to NAT-PMP for good once the
+ * gateway answers with an unsupported version. Requests on the same
+ * internal port and protocol are sent one after the other, as answers
+ * can't be told apart otherwise.
+ *
+ * Errors carry the equivalent UPnP code when there is one, so callers
+ * can check Reply::upnpError() for both backends, otherwise the code is
+ * "natpmp:N" or "pcp:N" with the result of the gateway.
+ */
+class NatPmpClientPrivate;
+class UPNPQT_LIBRARY NatPmpClient : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(NatPmpClient)
+public:
+    enum Protocol {
+        Auto,
+        NatPmp,
+        Pcp,
+    };
+    Q_ENUM(Protocol)
+
+    /**
+     * @brief NatPmpClient
+     * @param gateway the router, defaultGateway() when null
+     */
+    explicit NatPmpClient(const QHostAddress &gateway = QHostAddress(), QObject *parent = nullptr);
+    virtual ~NatPmpClient();
+
+    /**
+     * @brief defaultGateway
+     * @return the IPv4 default route of this host, only known on Linux
+     */
+    static QHostAddress defaultGateway();
+
+    QHostAddress gateway() const;
+
+    /**
+     * @brief setProtocol
+     * @param protocol defaults to Auto
+     */
+    void setProtocol(Protocol protocol);
+    Protocol protocol() const;
+
+    /**
+     * @brief activeProtocol
+     * @return the protocol requests are sent with, PCP until Auto fell back
+     */
+    Protocol activeProtocol() const;
+
+    /**
+     * @brief setInitialTimeout
+     * @param msec before the first retransmission, doubled on each one, defaults to 250
+     */
+    void setInitialTimeout(int msec);
+    int initialTimeout() const;
+
+    /**
+     * @brief setRetries
+     * @param retries retransmissions before failing, defaults to 2. A request
+     * gives up after initialTimeout() * (2^(retries + 1) - 1) ms, 1.75s with
+     * the defaults, so gateways without NAT-PMP/PCP don't hold up the IGD
+     * fallback for long. RFC 6886 uses 8 retries to wait for slow gateways.
+     */
+    void setRetries(int retries);
+    int retries() const;
+
+    /**
+     * @brief getExternalIp
+     *
+     * PCP has no such request, when the gateway only speaks PCP the
+     * address assigned to the last mapping is returned.
+     */
+    TypedReply<QString> *getExternalIp();
+
+    /**
+     * @brief addPortMapping
+     * @param externalPort the suggested port, the gateway may assign another one
+     * @param leaseDuration in seconds, 0 asks for the recommended 7200
+     * @return the mapping as created, with the assigned external port and lease
+     */
+    TypedReply<WanConnectionService::PortMap> *addPortMapping(quint16 externalPort, quint16 internalPort,
+                                                             QAbstractSocket::SocketType sockType,
+                                                             int leaseDuration = 0);
+
+    /**
+     * @brief deletePortMapping
+     * @param internalPort both protocols identify mappings by their internal port
+     */
+    Reply *deletePortMapping(quint16 internalPort, QAbstractSocket::SocketType sockType);
+
+private:
+    NatPmpClientPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPQT_NATPMPCLIENT_H
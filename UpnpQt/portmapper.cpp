@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "portmapper.h"
+#include "natpmpclient.h"
+#include "device.h"
+
+#include <QPointer>
+#include <QHash>
+#include <QNetworkInterface>
+#include <QTimer>
+#include <QUrl>
+
+#include <algorithm>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_PORTMAPPER, "upnpqt.portmapper", QtInfoMsg)
+
+namespace UpnpQt {
+
+class PortMapperPrivate
+{
+public:
+    struct NatPmpMapping {
+        // identifies the mapping for NAT-PMP/PCP
+        quint16 internalPort = 0;
+        // only for mappings asked without a lease, kept alive like IGD permanent ones
+        QTimer *renewal = nullptr;
+    };
+
+    static quint32 key(QAbstractSocket::SocketType sockType, quint16 externalPort) {
+        return (quint32(sockType == QAbstractSocket::UdpSocket) << 16) | externalPort;
+    }
+
+    bool useNatPmp();
+    static bool forThisHost(const WanConnectionService::PortMap &portMap);
+    void insertNatPmpMapping(const WanConnectionService::PortMap &created, bool renew);
+    void renew(quint32 key);
+    void setClient(NatPmpClient *natPmpClient, bool owned);
+    void markNatPmpUnavailable(const Reply *reply);
+    void updateBackend();
+    void addIgd(TypedReply<WanConnectionService::PortMap> *reply, const WanConnectionService::PortMap &portMap);
+    void getExternalIpIgd(TypedReply<QString> *reply);
+    static bool unsupported(const Reply *reply);
+    static void forward(const Reply *from, Reply *to);
+
+    PortMapper *q_ptr;
+    QPointer<WanConnectionService> service;
+    QPointer<NatPmpClient> client;
+    // mappings made with NAT-PMP/PCP
+    QHash<quint32, NatPmpMapping> natPmpMappings;
+    PortMapper::Backend backend = PortMapper::None;
+    bool ownsClient = false;
+    bool preferNatPmp = true;
+    bool natPmpAvailable = true;
+};
+
+}
+
+using namespace UpnpQt;
+
+PortMapper::PortMapper(QObject *parent) : QObject(parent)
+  , d_ptr(new PortMapperPrivate)
+{
+    Q_D(PortMapper);
+    d->q_ptr = this;
+}
+
+PortMapper::~PortMapper()
+{
+    delete d_ptr;
+}
+
+void PortMapper::setService(WanConnectionService *service)
+{
+    Q_D(PortMapper);
+    d->service = service;
+
+    if ((!d->client || d->ownsClient) && service && service->device()) {
+        // the IGD is usually the router answering NAT-PMP/PCP too
+        QHostAddress host(QUrl(service->device()->urlBase()).host());
+        if (host.isNull()) {
+            host = NatPmpClient::defaultGateway();
+        }
+        if (!d->client || d->client->gateway() != host) {
+            d->setClient(new NatPmpClient(host, this), true);
+        }
+    }
+    d->updateBackend();
+}
+
+WanConnectionService *PortMapper::service() const
+{
+    Q_D(const PortMapper);
+    return d->service;
+}
+
+void PortMapper::setNatPmpClient(NatPmpClient *client)
+{
+    Q_D(PortMapper);
+    d->setClient(client, false);
+    d->updateBackend();
+}
+
+NatPmpClient *PortMapper::natPmpClient() const
+{
+    Q_D(const PortMapper);
+    return d->client;
+}
+
+void PortMapper::setPreferNatPmp(bool prefer)
+{
+    Q_D(PortMapper);
+    d->preferNatPmp = prefer;
+    d->updateBackend();
+}
+
+bool PortMapper::preferNatPmp() const
+{
+    Q_D(const PortMapper);
+    return d->preferNatPmp;
+}
+
+PortMapper::Backend PortMapper::backend() const
+{
+    Q_D(const PortMapper);
+    return d->backend;
+}
+
+TypedReply<WanConnectionService::PortMap> *PortMapper::addPortMapping(const WanConnectionService::PortMap &portMap)
+{
+    Q_D(PortMapper);
+    auto reply = new TypedReply<WanConnectionService::PortMap>(this);
+
+    if (PortMapperPrivate::forThisHost(portMap) && d->useNatPmp()) {
+        auto natPmp = d->client->addPortMapping(portMap.externalPort, portMap.internalPort, portMap.sockType(), portMap.leaseDuration);
+        connect(natPmp, &Reply::finished, this, [=] {
+            if (!natPmp->error()) {
+                WanConnectionService::PortMap created = natPmp->takeResult();
+                created.setDescription(portMap.description());
+                d->insertNatPmpMapping(created, portMap.leaseDuration <= 0);
+                d->updateBackend();
+                reply->finishWithResult(std::move(created));
+            } else if (PortMapperPrivate::unsupported(natPmp)) {
+                d->markNatPmpUnavailable(natPmp);
+                d->addIgd(reply, portMap);
+            } else {
+                PortMapperPrivate::forward(natPmp, reply);
+            }
+        });
+        return reply;
+    }
+
+    d->addIgd(reply, portMap);
+    return reply;
+}
+
+Reply *PortMapper::deletePortMapping(const WanConnectionService::PortMap &portMap)
+{
+    Q_D(PortMapper);
+    auto reply = new Reply(this);
+
+    auto it = d->natPmpMappings.find(PortMapperPrivate::key(portMap.sockType(), portMap.externalPort));
+    if (it != d->natPmpMappings.end() && d->client) {
+        const quint16 internalPort = it->internalPort;
+        delete it->renewal;
+        d->natPmpMappings.erase(it);
+
+        Reply *natPmp = d->client->deletePortMapping(internalPort, portMap.sockType());
+        connect(natPmp, &Reply::finished, this, [=] {
+            PortMapperPrivate::forward(natPmp, reply);
+        });
+        return reply;
+    }
+
+    if (!d->service) {
+        reply->finishWithErrorLater(QStringLiteral("No gateway available"));
+        return reply;
+    }
+
+    Reply *igd = d->service->deletePortMapping(portMap.externalPort, portMap.sockType(), portMap.remoteHost());
+    connect(igd, &Reply::finished, this, [=] {
+        PortMapperPrivate::forward(igd, reply);
+    });
+    return reply;
+}
+
+TypedReply<QString> *PortMapper::getExternalIp()
+{
+    Q_D(PortMapper);
+    auto reply = new TypedReply<QString>(this);
+
+    if (d->useNatPmp()) {
+        auto natPmp = d->client->getExternalIp();
+        connect(natPmp, &Reply::finished, this, [=] {
+            if (!natPmp->error()) {
+                reply->finishWithResult(natPmp->takeResult());
+                return;
+            }
+
+            // a PCP only gateway can't tell, that doesn't make it unusable for mappings
+            if (natPmp->errorCode() != QLatin1String("pcp:1")) {
+                d->markNatPmpUnavailable(natPmp);
+            }
+            if (d->service) {
+                d->getExternalIpIgd(reply);
+            } else {
+                PortMapperPrivate::forward(natPmp, reply);
+            }
+        });
+        return reply;
+    }
+
+    d->getExternalIpIgd(reply);
+    return reply;
+}
+
+bool PortMapperPrivate::useNatPmp()
+{
+    if (!preferNatPmp || !natPmpAvailable) {
+        return false;
+    }
+    if (!client) {
+        setClient(new NatPmpClient(QHostAddress(), q_ptr), true);
+    }
+    return !client->gateway().isNull();
+}
+
+bool PortMapperPrivate::forThisHost(const WanConnectionService::PortMap &portMap)
+{
+    // NAT-PMP/PCP can only map to the host sending the request
+    if (portMap.internalAddress().isEmpty()) {
+        return true;
+    }
+
+    const QHostAddress address = portMap.internalHostAddress();
+    if (address.isNull()) {
+        return false;
+    }
+    if (address.isLoopback()) {
+        return true;
+    }
+
+    const QList<QHostAddress> local = QNetworkInterface::allAddresses();
+    return std::any_of(local.begin(), local.end(), [&] (const QHostAddress &localAddress) {
+        return localAddress.isEqual(address, QHostAddress::TolerantConversion);
+    });
+}
+
+void PortMapperPrivate::insertNatPmpMapping(const WanConnectionService::PortMap &created, bool renew)
+{
+    const quint32 mappingKey = key(created.sockType(), created.externalPort);
+    NatPmpMapping &mapping = natPmpMappings[mappingKey];
+    mapping.internalPort = created.internalPort;
+    if (!renew) {
+        delete mapping.renewal;
+        mapping.renewal = nullptr;
+        return;
+    }
+
+    if (!mapping.renewal) {
+        mapping.renewal = new QTimer(q_ptr);
+        mapping.renewal->setSingleShot(true);
+        QObject::connect(mapping.renewal, &QTimer::timeout, q_ptr, [=] {
+            this->renew(mappingKey);
+        });
+    }
+    // renew halfway through the lease the gateway granted
+    mapping.renewal->start(qMax(60, created.leaseDuration / 2) * 1000);
+}
+
+void PortMapperPrivate::renew(quint32 mappingKey)
+{
+    auto it = natPmpMappings.find(mappingKey);
+    if (it == natPmpMappings.end() || !client) {
+        return;
+    }
+
+    const quint16 externalPort = quint16(mappingKey & 0xffff);
+    const QAbstractSocket::SocketType sockType = mappingKey >> 16 ? QAbstractSocket::UdpSocket : QAbstractSocket::TcpSocket;
+    auto natPmp = client->addPortMapping(externalPort, it->internalPort, sockType);
+    QObject::connect(natPmp, &Reply::finished, q_ptr, [=] {
+        auto entry = natPmpMappings.find(mappingKey);
+        if (entry == natPmpMappings.end() || !entry->renewal) {
+            // deleted meanwhile
+            return;
+        }
+
+        if (natPmp->error()) {
+            qCWarning(UPNPQT_PORTMAPPER) << "Failed to renew" << externalPort << sockType << natPmp->errorString();
+            entry->renewal->start(60 * 1000);
+            return;
+        }
+
+        const WanConnectionService::PortMap renewed = natPmp->result();
+        if (renewed.externalPort != externalPort) {
+            qCWarning(UPNPQT_PORTMAPPER) << "Gateway moved" << externalPort << sockType << "to" << renewed.externalPort;
+        }
+        entry->renewal->start(qMax(60, renewed.leaseDuration / 2) * 1000);
+    });
+}
+
+void PortMapperPrivate::setClient(NatPmpClient *natPmpClient, bool owned)
+{
+    if (client && ownsClient && client != natPmpClient) {
+        client->deleteLater();
+    }
+    client = natPmpClient;
+    ownsClient = owned;
+    natPmpAvailable = true;
+}
+
+void PortMapperPrivate::markNatPmpUnavailable(const Reply *reply)
+{
+    if (!unsupported(reply) || !natPmpAvailable) {
+        return;
+    }
+
+    qCInfo(UPNPQT_PORTMAPPER) << "NAT-PMP/PCP unavailable on" << client->gateway() << reply->errorString() << "using the IGD";
+    natPmpAvailable = false;
+    updateBackend();
+}
+
+void PortMapperPrivate::updateBackend()
+{
+    PortMapper::Backend current = PortMapper::None;
+    if (preferNatPmp && natPmpAvailable && client && !client->gateway().isNull()) {
+        current = client->activeProtocol() == NatPmpClient::Pcp ? PortMapper::Pcp : PortMapper::NatPmp;
+    } else if (service) {
+        current = PortMapper::Igd;
+    }
+
+    if (current != backend) {
+        backend = current;
+        qCDebug(UPNPQT_PORTMAPPER) << "backend" << backend;
+        Q_EMIT q_ptr->backendChanged(backend);
+    }
+}
+
+void PortMapperPrivate::addIgd(TypedReply<WanConnectionService::PortMap> *reply, const WanConnectionService::PortMap &portMap)
+{
+    if (!service) {
+        reply->finishWithErrorLater(QStringLiteral("No gateway available"));
+        return;
+    }
+
+    Reply *igd = service->addPortMapping(portMap.externalPort, portMap.internalAddress(), portMap.internalPort, portMap.sockType(),
+                                         portMap.description(), portMap.enabled, portMap.leaseDuration, portMap.remoteHost());
+    QObject::connect(igd, &Reply::finished, q_ptr, [=] {
+        if (igd->error()) {
+            forward(igd, reply);
+        } else {
+            reply->finishWithResult(portMap);
+        }
+    });
+}
+
+void PortMapperPrivate::getExternalIpIgd(TypedReply<QString> *reply)
+{
+    if (!service) {
+        reply->finishWithErrorLater(QStringLiteral("No gateway available"));
+        return;
+    }
+
+    auto igd = service->getExternalIp();
+    QObject::connect(igd, &Reply::finished, q_ptr, [=] {
+        if (igd->error()) {
+            forward(igd, reply);
+        } else {
+            reply->finishWithResult(igd->takeResult());
+        }
+    });
+}
+
+bool PortMapperPrivate::unsupported(const Reply *reply)
+{
+    // no answer at all or a version/opcode the gateway doesn't speak
+    const QString code = reply->errorCode();
+    return code.isEmpty() ||
+            code == QLatin1String("natpmp:1") || code == QLatin1String("natpmp:5") ||
+            code == QLatin1String("pcp:1") || code == QLatin1String("pcp:4");
+}
+
+void PortMapperPrivate::forward(const Reply *from, Reply *to)
+{
+    if (from->error()) {
+        to->finishWithError(from->errorString(), from->errorCode());
+    } else {
+        to->finish();
+    }
+}
+
+#include "moc_portmapper.cpp"
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_PORTMAPPER_H
+#define UPNPQT_PORTMAPPER_H
+
+#include <QObject>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/reply.h>
+#include <UpnpQt/wanconnectionservice.h>
+
+namespace UpnpQt {
+
+class NatPmpClient;
+
+/**
+ * Creates mappings with NAT-PMP/PCP when the gateway answers them and
+ * with the IGD service otherwise.
+ *
+ * The UDP protocols are tried first, once the gateway doesn't answer
+ * them or rejects their version every operation goes to the IGD. Errors
+ * about the mapping itself, like a conflict, are returned as they are.
+ * NAT-PMP/PCP can only map ports to this host, mappings for another
+ * internal address always go to the IGD.
+ */
+class PortMapperPrivate;
+class UPNPQT_LIBRARY PortMapper : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(PortMapper)
+public:
+    enum Backend {
+        None,
+        NatPmp,
+        Pcp,
+        Igd,
+    };
+    Q_ENUM(Backend)
+
+    explicit PortMapper(QObject *parent = nullptr);
+    virtual ~PortMapper();
+
+    /**
+     * @brief setService
+     * @param service the IGD fallback, unless setNatPmpClient() was called
+     * NAT-PMP/PCP requests are sent to the host of its device
+     */
+    void setService(WanConnectionService *service);
+    WanConnectionService *service() const;
+
+    void setNatPmpClient(NatPmpClient *client);
+    NatPmpClient *natPmpClient() const;
+
+    /**
+     * @brief setPreferNatPmp
+     * @param prefer try NAT-PMP/PCP before the IGD, defaults to true
+     */
+    void setPreferNatPmp(bool prefer);
+    bool preferNatPmp() const;
+
+    /**
+     * @brief backend
+     * @return the backend the next operation goes to
+     */
+    Backend backend() const;
+
+    /**
+     * @brief addPortMapping
+     *
+     * A leaseDuration of 0 asks for a permanent mapping. NAT-PMP/PCP have no
+     * such thing, the gateway grants its recommended lease instead and the
+     * mapping is renewed halfway through it until deletePortMapping().
+     * @return the mapping as created, NAT-PMP/PCP may assign another external port
+     */
+    TypedReply<WanConnectionService::PortMap> *addPortMapping(const WanConnectionService::PortMap &portMap);
+    Reply *deletePortMapping(const WanConnectionService::PortMap &portMap);
+    TypedReply<QString> *getExternalIp();
+
+Q_SIGNALS:
+    void backendChanged(UpnpQt::PortMapper::Backend backend);
+
+private:
+    PortMapperPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPQT_PORTMAPPER_H
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "portmappingenumerator.h"
+#include "reply.h"
+
+#include <limits>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_ENUMERATOR, "upnpqt.enumerator", QtInfoMsg)
+
+using namespace UpnpQt;
+
+static QString mappingKey(const WanConnectionService::PortMap &portMap)
+{
+    return QString::number(int(portMap.sockType())) % QLatin1Char('/') % QString::number(portMap.externalPort) %
+            QLatin1Char('/') % portMap.remoteHost();
+}
+
+PortMappingEnumerator::PortMappingEnumerator(WanConnectionService *service, QObject *parent) : QObject(parent)
+  , m_service(service)
+{
+
+}
+
+PortMappingEnumerator::~PortMappingEnumerator()
+{
+
+}
+
+void PortMappingEnumerator::setWindow(int window)
+{
+    m_window = qMax(1, window);
+}
+
+int PortMappingEnumerator::window() const
+{
+    return m_window;
+}
+
+void PortMappingEnumerator::setDescriptionPrefix(const QString &prefix)
+{
+    m_descriptionPrefix = prefix;
+}
+
+QString PortMappingEnumerator::descriptionPrefix() const
+{
+    return m_descriptionPrefix;
+}
+
+void PortMappingEnumerator::setInternalClient(const QString &internalClient)
+{
+    setInternalClient(QHostAddress(internalClient));
+}
+
+void PortMappingEnumerator::setInternalClient(const QHostAddress &internalClient)
+{
+    m_internalClient = internalClient;
+}
+
+QHostAddress PortMappingEnumerator::internalClient() const
+{
+    return m_internalClient;
+}
+
+void PortMappingEnumerator::setPageSize(int pageSize)
+{
+    m_pageSize = qMax(0, pageSize);
+}
+
+int PortMappingEnumerator::pageSize() const
+{
+    return m_pageSize;
+}
+
+bool PortMappingEnumerator::isRunning() const
+{
+    return m_running;
+}
+
+bool PortMappingEnumerator::error() const
+{
+    return m_error;
+}
+
+QString PortMappingEnumerator::errorCode() const
+{
+    return m_errorCode;
+}
+
+QString PortMappingEnumerator::errorString() const
+{
+    return m_errorString;
+}
+
+void PortMappingEnumerator::start()
+{
+    m_errorCode.clear();
+    m_errorString.clear();
+    m_error = false;
+    m_emitted = 0;
+    m_nextToEmit = 0;
+    m_end = std::numeric_limits<int>::max();
+    m_errorIndex = std::numeric_limits<int>::max();
+    m_listed.clear();
+    m_fallback.clear();
+    m_running = true;
+
+    if (m_pageSize > 0 && m_service->version() >= 2) {
+        ++m_generation;
+        m_pending.clear();
+        m_inFlight = 0;
+
+        qCDebug(UPNPQT_ENUMERATOR) << "start listing page size" << m_pageSize;
+        requestPage(QAbstractSocket::TcpSocket, 0);
+        requestPage(QAbstractSocket::UdpSocket, 0);
+    } else {
+        startIndexed();
+    }
+}
+
+void PortMappingEnumerator::startIndexed()
+{
+    ++m_generation;
+    m_pending.clear();
+    m_next = 0;
+    m_nextToEmit = 0;
+    m_end = std::numeric_limits<int>::max();
+    m_errorIndex = std::numeric_limits<int>::max();
+    m_inFlight = 0;
+
+    qCDebug(UPNPQT_ENUMERATOR) << "start window" << m_window;
+    for (int i = 0; i < m_window; ++i) {
+        requestNext();
+    }
+}
+
+void PortMappingEnumerator::requestPage(QAbstractSocket::SocketType sockType, quint16 startPort)
+{
+    const int generation = m_generation;
+    ++m_inFlight;
+
+    auto reply = m_service->getListOfPortMappings(startPort, 65535, sockType, true, m_pageSize);
+    connect(reply, &Reply::finished, this, [=] {
+        if (generation != m_generation) {
+            return;
+        }
+        --m_inFlight;
+
+        if (!reply->error()) {
+            const std::vector<WanConnectionService::PortMap> portMaps = reply->takeResult();
+            int added = 0;
+            for (const WanConnectionService::PortMap &portMap : portMaps) {
+                // pages start at the last port of the previous one, skip what it had
+                const QString key = mappingKey(portMap);
+                if (m_listed.contains(key)) {
+                    continue;
+                }
+                m_listed.insert(key);
+                ++added;
+
+                ++m_emitted;
+                if (matches(portMap)) {
+                    Q_EMIT entry(portMap);
+                    if (!m_running) {
+                        // stopped from an entry() handler
+                        return;
+                    }
+                }
+            }
+
+            // gateways may return fewer entries than asked, so a short page
+            // isn't the end, only 730 or a page with nothing new is
+            if (added > 0) {
+                // the last port may have more entries for other remote hosts
+                const quint16 lastPort = portMaps.back().externalPort;
+                if (lastPort > startPort) {
+                    requestPage(sockType, lastPort);
+                    return;
+                }
+                if (lastPort < 65535) {
+                    if (int(portMaps.size()) >= m_pageSize) {
+                        qCWarning(UPNPQT_ENUMERATOR) << "More than" << m_pageSize << "entries for port" << lastPort << "some may be missing";
+                    }
+                    requestPage(sockType, lastPort + 1);
+                    return;
+                }
+            }
+        } else if (reply->upnpError() == Reply::PortMappingNotFound || reply->errorString() == QLatin1String("PortMappingNotFound")) {
+            // nothing (left) in this range
+        } else {
+            // Not implemented or not authorized to manage (606), walk the
+            // indexes for this protocol once the other one is done
+            qCDebug(UPNPQT_ENUMERATOR) << "GetListOfPortMappings failed, falling back" << sockType << reply->errorCode() << reply->errorString();
+            m_fallback.insert(int(sockType));
+        }
+
+        if (m_inFlight == 0) {
+            if (m_fallback.isEmpty()) {
+                finish();
+            } else {
+                startIndexed();
+            }
+        }
+    });
+}
+
+void PortMappingEnumerator::stop()
+{
+    if (!m_running) {
+        return;
+    }
+
+    qCDebug(UPNPQT_ENUMERATOR) << "stopped at" << m_nextToEmit << "in flight" << m_inFlight;
+    ++m_generation;
+    finish();
+}
+
+void PortMappingEnumerator::requestNext()
+{
+    const int index = m_next++;
+    const int generation = m_generation;
+    ++m_inFlight;
+
+    auto reply = m_service->getGenericPortMappingEntry(index);
+    connect(reply, &Reply::finished, this, [=] {
+        if (generation != m_generation) {
+            return;
+        }
+        --m_inFlight;
+
+        if (!reply->error()) {
+            m_pending[index] = reply->takeResult();
+        } else if (reply->upnpError() == Reply::SpecifiedArrayIndexInvalid || reply->errorString() == QLatin1String("SpecifiedArrayIndexInvalid")) {
+            m_end = qMin(m_end, index);
+        } else if (index < m_errorIndex) {
+            m_errorIndex = index;
+            m_errorCode = reply->errorCode();
+            m_errorString = reply->errorString();
+        }
+
+        flush();
+        if (!m_running) {
+            // stopped from an entry() handler
+            return;
+        }
+
+        if (m_next < qMin(m_end, m_errorIndex)) {
+            requestNext();
+        } else if (m_inFlight == 0) {
+            finish();
+        }
+    });
+}
+
+void PortMappingEnumerator::flush()
+{
+    // answers may arrive out of order, emit them in table order
+    auto it = m_pending.begin();
+    while (m_running && it != m_pending.end() && it->first == m_nextToEmit && m_nextToEmit < qMin(m_end, m_errorIndex)) {
+        const WanConnectionService::PortMap portMap = std::move(it->second);
+        it = m_pending.erase(it);
+        ++m_nextToEmit;
+
+        // after a listing failed only its protocols are walked, minus what was listed
+        if (!m_fallback.isEmpty() &&
+                (!m_fallback.contains(int(portMap.sockType())) || m_listed.contains(mappingKey(portMap)))) {
+            continue;
+        }
+
+        if (matches(portMap)) {
+            Q_EMIT entry(portMap);
+        }
+    }
+}
+
+bool PortMappingEnumerator::matches(const WanConnectionService::PortMap &portMap) const
+{
+    if (!m_descriptionPrefix.isEmpty() && !portMap.description().startsWith(m_descriptionPrefix)) {
+        return false;
+    }
+    if (!m_internalClient.isNull() && !m_internalClient.isEqual(portMap.internalHostAddress(), QHostAddress::TolerantConversion)) {
+        return false;
+    }
+    return true;
+}
+
+void PortMappingEnumerator::finish()
+{
+    m_running = false;
+    m_pending.clear();
+    m_listed.clear();
+    if (m_errorIndex < m_end) {
+        m_error = true;
+    }
+
+    qCDebug(UPNPQT_ENUMERATOR) << "finished entries" << qMax(m_nextToEmit, m_emitted) << "error" << m_error << m_errorCode;
+    Q_EMIT finished();
+}
+
+#include "moc_portmappingenumerator.cpp"
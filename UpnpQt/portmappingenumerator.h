@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPPORTMAPPINGENUMERATOR_H
+#define UPNPPORTMAPPINGENUMERATOR_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QSet>
+
+#include <map>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/wanconnectionservice.h>
+
+namespace UpnpQt {
+
+/**
+ * Walks the gateway port mapping table, entries are emitted as soon
+ * as they arrive so consumers can stop once they found what they need.
+ *
+ * IGDv2 gateways are listed with GetListOfPortMappings in pages, per
+ * protocol. Each page starts at the last port of the previous one so
+ * entries sharing that port with another remote host are not skipped.
+ * Pages shorter than asked don't end the listing since gateways may cap
+ * them, it ends on PortMappingNotFound or a page with no new entries.
+ * When the listing of a protocol is refused, that protocol is walked
+ * by index afterwards and entries it already listed are not emitted twice.
+ * The index walk keeps a window of requests in flight and emits
+ * entries in table order.
+ */
+class UPNPQT_LIBRARY PortMappingEnumerator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PortMappingEnumerator(WanConnectionService *service, QObject *parent = nullptr);
+    virtual ~PortMappingEnumerator();
+
+    /**
+     * @brief setWindow
+     * @param window maximum number of concurrent index requests, defaults to 4
+     */
+    void setWindow(int window);
+    int window() const;
+
+    /**
+     * @brief setPageSize
+     * @param pageSize entries asked per GetListOfPortMappings, 0 disables the IGDv2 listing
+     */
+    void setPageSize(int pageSize);
+    int pageSize() const;
+
+    /**
+     * @brief setDescriptionPrefix only emit entries whose description starts with prefix
+     */
+    void setDescriptionPrefix(const QString &prefix);
+    QString descriptionPrefix() const;
+
+    /**
+     * @brief setInternalClient only emit entries mapped to internalClient,
+     * compared as addresses so IPv4-mapped IPv6 forms match too
+     */
+    void setInternalClient(const QString &internalClient);
+    void setInternalClient(const QHostAddress &internalClient);
+    QHostAddress internalClient() const;
+
+    bool isRunning() const;
+    bool error() const;
+    QString errorCode() const;
+    QString errorString() const;
+
+public Q_SLOTS:
+    /**
+     * Starts enumerating from the first index, restarting if already running.
+     */
+    void start();
+
+    /**
+     * Stops the scan, no more entries are emitted and finished() is emitted
+     * right away, answers still in flight are discarded.
+     */
+    void stop();
+
+Q_SIGNALS:
+    void entry(const UpnpQt::WanConnectionService::PortMap &portMap);
+    void finished();
+
+private:
+    void startIndexed();
+    void requestPage(QAbstractSocket::SocketType sockType, quint16 startPort);
+    void requestNext();
+    void flush();
+    bool matches(const WanConnectionService::PortMap &portMap) const;
+    void finish();
+
+    WanConnectionService *m_service;
+    std::map<int, WanConnectionService::PortMap> m_pending;
+    QString m_descriptionPrefix;
+    QHostAddress m_internalClient;
+    // keys of the entries listed so far, and protocols whose listing failed
+    QSet<QString> m_listed;
+    QSet<int> m_fallback;
+    QString m_errorCode;
+    QString m_errorString;
+    int m_window = 4;
+    int m_pageSize = 256;
+    int m_emitted = 0;
+    int m_next = 0;
+    int m_nextToEmit = 0;
+    int m_end = 0;
+    int m_errorIndex = 0;
+    int m_inFlight = 0;
+    int m_generation = 0;
+    bool m_running = false;
+    bool m_error = false;
+};
+
+}
+
+#endif // UPNPPORTMAPPINGENUMERATOR_H
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "portmappingmirror.h"
+#include "portmappingenumerator.h"
+
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <memory>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_MIRROR, "upnpqt.mirror", QtInfoMsg)
+
+namespace UpnpQt {
+
+struct PortMappingKey {
+    QString remoteHost;
+    quint16 externalPort;
+    bool tcp;
+
+    PortMappingKey(quint16 port, QAbstractSocket::SocketType sockType, const QString &host)
+        : remoteHost(host)
+        , externalPort(port)
+        , tcp(sockType == QAbstractSocket::TcpSocket)
+    {}
+
+    bool operator==(const PortMappingKey &other) const {
+        return externalPort == other.externalPort && tcp == other.tcp && remoteHost == other.remoteHost;
+    }
+};
+
+inline uint qHash(const PortMappingKey &key, uint seed = 0)
+{
+    return ::qHash(key.remoteHost, seed) ^ (uint(key.externalPort) << 1 | uint(key.tcp));
+}
+
+class PortMappingMirrorPrivate
+{
+public:
+    struct JournalEntry {
+        WanConnectionService::PortMap portMap;
+        bool insert;
+    };
+
+    // stores the map with the table's copy of its description
+    static void intern(QSet<QString> *descriptions, WanConnectionService::PortMap portMap, QHash<PortMappingKey, WanConnectionService::PortMap> *table);
+
+    WanConnectionService *service;
+    QHash<PortMappingKey, WanConnectionService::PortMap> table;
+    // descriptions used in the table, rebuilt with it on each sync
+    QSet<QString> descriptions;
+    QTimer refreshTimer;
+    QElapsedTimer lastSync;
+    PortMappingEnumerator *enumerator = nullptr;
+    std::vector<JournalEntry> journal;
+};
+
+}
+
+using namespace UpnpQt;
+
+void PortMappingMirrorPrivate::intern(QSet<QString> *descriptions, WanConnectionService::PortMap portMap, QHash<PortMappingKey, WanConnectionService::PortMap> *table)
+{
+    portMap.setDescription(*descriptions->insert(portMap.description()));
+    const PortMappingKey key(portMap.externalPort, portMap.sockType(), portMap.remoteHost());
+    table->insert(key, std::move(portMap));
+}
+
+PortMappingMirror::PortMappingMirror(WanConnectionService *service) : QObject(service)
+  , d_ptr(new PortMappingMirrorPrivate)
+{
+    Q_D(PortMappingMirror);
+    d->service = service;
+    connect(&d->refreshTimer, &QTimer::timeout, this, &PortMappingMirror::revalidate);
+}
+
+PortMappingMirror::~PortMappingMirror()
+{
+    delete d_ptr;
+}
+
+bool PortMappingMirror::isValid() const
+{
+    Q_D(const PortMappingMirror);
+    return d->lastSync.isValid();
+}
+
+qint64 PortMappingMirror::age() const
+{
+    Q_D(const PortMappingMirror);
+    return d->lastSync.isValid() ? d->lastSync.elapsed() : -1;
+}
+
+bool PortMappingMirror::isSyncing() const
+{
+    Q_D(const PortMappingMirror);
+    return d->enumerator != nullptr;
+}
+
+void PortMappingMirror::setRefreshInterval(int msec)
+{
+    Q_D(PortMappingMirror);
+    if (msec > 0) {
+        d->refreshTimer.start(msec);
+    } else {
+        d->refreshTimer.stop();
+    }
+}
+
+int PortMappingMirror::refreshInterval() const
+{
+    Q_D(const PortMappingMirror);
+    return d->refreshTimer.isActive() ? d->refreshTimer.interval() : 0;
+}
+
+bool PortMappingMirror::contains(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost) const
+{
+    Q_D(const PortMappingMirror);
+    return d->table.contains(PortMappingKey(externalPort, sockType, remoteHost));
+}
+
+WanConnectionService::PortMap PortMappingMirror::portMap(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost) const
+{
+    Q_D(const PortMappingMirror);
+    auto it = d->table.constFind(PortMappingKey(externalPort, sockType, remoteHost));
+    if (it != d->table.constEnd()) {
+        return it.value();
+    }
+
+    WanConnectionService::PortMap ret;
+    ret.setSockType(sockType);
+    return ret;
+}
+
+std::vector<WanConnectionService::PortMap> PortMappingMirror::portMaps() const
+{
+    Q_D(const PortMappingMirror);
+    std::vector<WanConnectionService::PortMap> ret;
+    ret.reserve(size_t(d->table.size()));
+    for (auto it = d->table.constBegin(); it != d->table.constEnd(); ++it) {
+        ret.push_back(it.value());
+    }
+    return ret;
+}
+
+int PortMappingMirror::count() const
+{
+    Q_D(const PortMappingMirror);
+    return d->table.size();
+}
+
+void PortMappingMirror::revalidate()
+{
+    Q_D(PortMappingMirror);
+    if (d->enumerator) {
+        return;
+    }
+
+    qCDebug(UPNPQT_MIRROR) << "revalidating, age" << age();
+    auto table = std::make_shared<QHash<PortMappingKey, WanConnectionService::PortMap>>();
+    auto descriptions = std::make_shared<QSet<QString>>();
+    d->enumerator = new PortMappingEnumerator(d->service, this);
+    connect(d->enumerator, &PortMappingEnumerator::entry, this, [=] (const WanConnectionService::PortMap &portMap) {
+        PortMappingMirrorPrivate::intern(descriptions.get(), portMap, table.get());
+    });
+    connect(d->enumerator, &PortMappingEnumerator::finished, this, [=] {
+        const bool success = !d->enumerator->error();
+        d->enumerator->deleteLater();
+        d->enumerator = nullptr;
+
+        if (success) {
+            d->table = *table;
+            d->descriptions = *descriptions;
+            d->lastSync.start();
+        }
+
+        // changes done while enumerating might or might not be in the result
+        for (const PortMappingMirrorPrivate::JournalEntry &entry : d->journal) {
+            if (entry.insert) {
+                PortMappingMirrorPrivate::intern(&d->descriptions, entry.portMap, &d->table);
+            } else {
+                d->table.remove(PortMappingKey(entry.portMap.externalPort, entry.portMap.sockType(), entry.portMap.remoteHost()));
+            }
+        }
+        d->journal.clear();
+
+        qCDebug(UPNPQT_MIRROR) << "synced" << success << d->table.size();
+        Q_EMIT synced(success);
+    });
+    d->enumerator->start();
+}
+
+void PortMappingMirror::insert(const WanConnectionService::PortMap &portMap)
+{
+    Q_D(PortMappingMirror);
+    PortMappingMirrorPrivate::intern(&d->descriptions, portMap, &d->table);
+    if (d->enumerator) {
+        PortMappingMirrorPrivate::JournalEntry entry;
+        entry.portMap = portMap;
+        entry.insert = true;
+        d->journal.push_back(entry);
+    }
+}
+
+void PortMappingMirror::remove(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost)
+{
+    Q_D(PortMappingMirror);
+    d->table.remove(PortMappingKey(externalPort, sockType, remoteHost));
+    if (d->enumerator) {
+        PortMappingMirrorPrivate::JournalEntry entry;
+        entry.portMap.externalPort = externalPort;
+        entry.portMap.setSockType(sockType);
+        entry.portMap.setRemoteHost(remoteHost);
+        entry.insert = false;
+        d->journal.push_back(entry);
+    }
+}
+
+#include "moc_portmappingmirror.cpp"
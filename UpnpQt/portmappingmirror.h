@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPPORTMAPPINGMIRROR_H
+#define UPNPPORTMAPPINGMIRROR_H
+
+#include <QObject>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/wanconnectionservice.h>
+
+namespace UpnpQt {
+
+/**
+ * Local copy of the gateway port mapping table indexed by
+ * (externalPort, protocol, remoteHost), filled by one enumeration
+ * and kept up to date with the adds and deletes done through the
+ * owning WanConnectionService, lookups don't touch the network.
+ */
+class PortMappingMirrorPrivate;
+class UPNPQT_LIBRARY PortMappingMirror : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(PortMappingMirror)
+public:
+    explicit PortMappingMirror(WanConnectionService *service);
+    virtual ~PortMappingMirror();
+
+    /**
+     * @brief isValid
+     * @return true once the table was enumerated at least once
+     */
+    bool isValid() const;
+
+    /**
+     * @brief age
+     * @return milliseconds since the last full enumeration, -1 if never synced
+     */
+    qint64 age() const;
+
+    /**
+     * @brief isSyncing
+     * @return true while an enumeration is running
+     */
+    bool isSyncing() const;
+
+    /**
+     * @brief setRefreshInterval
+     * @param msec period of full revalidations, 0 disables them
+     */
+    void setRefreshInterval(int msec);
+    int refreshInterval() const;
+
+    bool contains(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost = QString()) const;
+
+    /**
+     * @brief portMap
+     * @return the cached entry or a PortMap with externalPort 0 if not mapped
+     */
+    WanConnectionService::PortMap portMap(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost = QString()) const;
+
+    std::vector<WanConnectionService::PortMap> portMaps() const;
+    int count() const;
+
+public Q_SLOTS:
+    /**
+     * Enumerates the whole table again, local changes done meanwhile
+     * are replayed on top of the result.
+     */
+    void revalidate();
+
+Q_SIGNALS:
+    void synced(bool success);
+
+protected:
+    friend class WanConnectionService;
+    void insert(const WanConnectionService::PortMap &portMap);
+    void remove(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost);
+
+    PortMappingMirrorPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPPORTMAPPINGMIRROR_H
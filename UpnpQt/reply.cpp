@@ -17,6 +17,7 @@
  */
 #include "reply.h"
 
+#include <QPointer>
 #include <QTimer>
 
 using namespace UpnpQt;
@@ -36,6 +37,11 @@ bool Reply::error() const
     return m_error;
 }
 
+Reply::UpnpError Reply::upnpError() const
+{
+    return m_upnpError;
+}
+
 QString Reply::errorCode() const
 {
     return m_errorCode;
@@ -51,33 +57,66 @@ QVariant Reply::value() const
     return m_value;
 }
 
+void Reply::setAutoDelete(bool enabled)
+{
+    m_autoDelete = enabled;
+}
+
+bool Reply::autoDelete() const
+{
+    return m_autoDelete;
+}
+
 void Reply::finish()
 {
-    Q_EMIT finished(this);
+    emitFinished();
 }
 
 void Reply::finishWithData(const QVariant &data)
 {
     m_value = data;
-    Q_EMIT finished(this);
+    emitFinished();
 }
 
 void Reply::finishWithError(const QString &msg, const QString &code)
 {
-    m_error = true;
-    m_errorString = msg;
-    m_errorCode = code;
-    Q_EMIT finished(this);
+    setError(msg, code);
+    emitFinished();
 }
 
 void Reply::finishWithErrorLater(const QString &msg, const QString &code)
+{
+    setError(msg, code);
+    QTimer::singleShot(0, this, [this] {
+        emitFinished();
+    });
+}
+
+void Reply::setError(const QString &msg, const QString &code)
 {
     m_error = true;
     m_errorString = msg;
     m_errorCode = code;
-    QTimer::singleShot(0, this, [this] {
-       Q_EMIT finished(this);
-    });
+
+    bool ok;
+    const int value = code.toInt(&ok);
+    // codes are 3 digits, vendor ones included
+    m_upnpError = ok && value > 0 && value < 1000 ? UpnpError(value) : UnknownError;
+}
+
+void Reply::emitFinished()
+{
+    // a receiver may delete the reply itself
+    QPointer<Reply> self(this);
+    Q_EMIT finished(this);
+    if (self.isNull()) {
+        return;
+    }
+
+    if (m_autoDelete) {
+        // receivers run first, even a queued one posted from the same thread
+        deleteLater();
+    }
 }
 
 #include "moc_reply.cpp"
@@ -22,6 +22,8 @@
 
 #include <QVariant>
 
+#include <utility>
+
 #include <UpnpQt/global.h>
 
 namespace UpnpQt {
@@ -30,13 +32,69 @@ class UPNPQT_LIBRARY Reply : public QObject
 {
     Q_OBJECT
 public:
+    /**
+     * UPnP error codes from the UPnPError of SOAP faults,
+     * UnknownError when the failure didn't carry one.
+     */
+    enum UpnpError {
+        UnknownError = -1,
+        NoError = 0,
+        InvalidAction = 401,
+        InvalidArgs = 402,
+        ActionFailed = 501,
+        ArgumentValueInvalid = 600,
+        ArgumentValueOutOfRange = 601,
+        OptionalActionNotImplemented = 602,
+        OutOfMemory = 603,
+        HumanInterventionRequired = 604,
+        StringArgumentTooLong = 605,
+        ActionNotAuthorized = 606,
+        PinholeSpaceExhausted = 701,
+        FirewallDisabled = 702,
+        InboundPinholeNotAllowed = 703,
+        NoSuchEntry = 704,
+        ProtocolNotSupported = 705,
+        InternalPortWildcardingNotAllowed = 706,
+        ProtocolWildcardingNotAllowed = 707,
+        SpecifiedArrayIndexInvalid = 713,
+        NoSuchEntryInArray = 714,
+        WildCardNotPermittedInSrcIP = 715,
+        WildCardNotPermittedInExtPort = 716,
+        ConflictInMappingEntry = 718,
+        SamePortValuesRequired = 724,
+        OnlyPermanentLeasesSupported = 725,
+        RemoteHostOnlySupportsWildcard = 726,
+        ExternalPortOnlySupportsWildcard = 727,
+        NoPortMapsAvailable = 728,
+        ConflictWithOtherMechanisms = 729,
+        PortMappingNotFound = 730,
+        ReadOnly = 731,
+        WildCardNotPermittedInIntPort = 732,
+        InconsistentParameters = 733,
+    };
+    Q_ENUM(UpnpError)
+
     explicit Reply(QObject *parent = nullptr);
     virtual ~Reply();
 
     bool error() const;
+    UpnpError upnpError() const;
     QString errorCode() const;
     QString errorString() const;
-    QVariant value() const;
+    virtual QVariant value() const;
+
+    /**
+     * @brief setAutoDelete
+     * @param enabled deletes the reply once finished was delivered, defaults to true.
+     * Replies used to live until their service was destroyed, code reading a
+     * reply after its finished slot returned must turn this off. It can be
+     * turned off from a slot connected to finished to keep the reply around,
+     * receivers living in another thread must turn it off before the action
+     * finishes and delete the reply themselves. Deleting the reply from a
+     * finished slot is still fine.
+     */
+    void setAutoDelete(bool enabled);
+    bool autoDelete() const;
 
     void finish();
     void finishWithData(const QVariant &data);
@@ -47,10 +105,50 @@ Q_SIGNALS:
     void finished(Reply *reply);
 
 private:
+    void setError(const QString &msg, const QString &code);
+    void emitFinished();
+
     QVariant m_value;
     QString m_errorCode;
     QString m_errorString;
+    UpnpError m_upnpError = NoError;
     bool m_error = false;
+    bool m_autoDelete = true;
+};
+
+/**
+ * Reply carrying a result of type T, it's moved out with takeResult()
+ * instead of being boxed in a QVariant, value() still works for code
+ * written against Reply by boxing a copy on demand.
+ */
+template <typename T>
+class TypedReply : public Reply
+{
+public:
+    explicit TypedReply(QObject *parent = nullptr) : Reply(parent) {}
+
+    const T &result() const { return m_result; }
+    T takeResult() { return std::move(m_result); }
+
+    QVariant value() const override {
+        return m_hasResult ? QVariant::fromValue(m_result) : Reply::value();
+    }
+
+    void finishWithResult(T &&result) {
+        m_result = std::move(result);
+        m_hasResult = true;
+        finish();
+    }
+
+    void finishWithResult(const T &result) {
+        m_result = result;
+        m_hasResult = true;
+        finish();
+    }
+
+private:
+    T m_result;
+    bool m_hasResult = false;
 };
 
 }
@@ -18,11 +18,112 @@
 #include "service.h"
 #include "service_p.h"
 #include "device.h"
+#include "soapenvelope.h"
+#include "eventlistener.h"
+#include "reply.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "localaddress_p.h"
 
 #include <QUrl>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QXmlStreamReader>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_SERVICE, "upnpqt.service", QtInfoMsg)
 
 using namespace UpnpQt;
 
+static bool isTransientFailure(QNetworkReply *reply, const std::pair<QString, QString> &error)
+{
+    switch (reply->error()) {
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::UnknownNetworkError:
+    case QNetworkReply::ServiceUnavailableError:
+        return true;
+    case QNetworkReply::InternalServerError:
+    {
+        // A SOAP fault with a proper UPnP error (713, 714, 718...) is an answer,
+        // only a bare 500 or ActionFailed means the router choked on it
+        return error.first.isEmpty() || error.first == QLatin1String("501");
+    }
+    default:
+        return false;
+    }
+}
+
+ServicePrivate::ServicePrivate()
+{
+    retryPolicies[Service::ReadOnlyAction].maxAttempts = 3;
+    retryPolicies[Service::IdempotentAction].maxAttempts = 3;
+    retryPolicies[Service::NonIdempotentAction].maxAttempts = 1;
+}
+
+void ServicePrivate::post(Service *q, const QNetworkRequest &request, const QByteArray &body,
+                          Service::ActionClass actionClass, int attempt,
+                          const std::function<void (QNetworkReply *, const QByteArray &, const std::pair<QString, QString> &)> &callback)
+{
+    QNetworkReply *reply = q->device()->nam()->post(request, body);
+    QObject::connect(reply, &QNetworkReply::finished, q, [=] {
+        reply->deleteLater();
+
+        const QByteArray data = reply->readAll();
+        std::pair<QString, QString> error;
+        if (reply->error()) {
+            error = SoapEnvelope::responseError(data);
+        }
+
+        if (attempt < retryPolicies[actionClass].maxAttempts && isTransientFailure(reply, error)) {
+            if (retryTokens >= 1) {
+                retryTokens -= 1;
+                ++retryStats.retries;
+
+                const int delay = backoffDelay(actionClass, attempt);
+                qCDebug(UPNPQT_SERVICE) << "retrying" << request.rawHeader("SOAPAction") << reply->error()
+                                        << "attempt" << attempt + 1 << "in" << delay << "ms";
+                QTimer::singleShot(delay, q, [=] {
+                    post(q, request, body, actionClass, attempt + 1, callback);
+                });
+                return;
+            }
+            ++retryStats.budgetDenied;
+            qCDebug(UPNPQT_SERVICE) << "retry budget exhausted" << request.rawHeader("SOAPAction");
+        }
+
+        if (attempt > 1) {
+            if (reply->error()) {
+                ++retryStats.failedAfterRetry;
+            } else {
+                ++retryStats.recovered;
+            }
+        } else if (!reply->error()) {
+            retryTokens = qMin(double(retryMaxTokens), retryTokens + retryTokenRatio);
+        }
+
+        callback(reply, data, error);
+    });
+}
+
+int ServicePrivate::backoffDelay(Service::ActionClass actionClass, int attempt) const
+{
+    const Service::RetryPolicy &policy = retryPolicies[actionClass];
+
+    // exponential backoff capped at maxBackoff, half of it randomized
+    // so replies failing together don't retry together
+    qint64 cap = qint64(policy.initialBackoff) << qMin(attempt - 1, 16);
+    cap = qMin(cap, qint64(policy.maxBackoff));
+    const int half = int(cap / 2);
+    return half + QRandomGenerator::global()->bounded(half + 1);
+}
+
 Service::Service(ServicePrivate *priv, QObject *parent) : QObject(parent)
   , d_ptr(priv)
 {
@@ -31,7 +132,23 @@ Service::Service(ServicePrivate *priv, QObject *parent) : QObject(parent)
 
 Service::~Service()
 {
+    Q_D(Service);
+    if (!d->eventPath.isEmpty()) {
+        EventListener::instance()->unregisterCallback(d->eventPath);
+    }
 
+    if (d->metricsInFlight) {
+        // their answers are never going to be delivered
+        Metrics::instance()->actionsAbandoned(d->metricsGateway, d->metricsInFlight);
+    }
+
+    // device() is null already when destroyed along with it
+    if (!d->sid.isEmpty() && d->subscriptionNam) {
+        QNetworkRequest request(d->subscriptionUrl);
+        request.setRawHeader(QByteArrayLiteral("SID"), d->sid);
+        QNetworkReply *reply = d->subscriptionNam->sendCustomRequest(request, QByteArrayLiteral("UNSUBSCRIBE"));
+        connect(reply, &QNetworkReply::finished, reply, &QNetworkReply::deleteLater);
+    }
 }
 
 QString Service::id() const
@@ -64,4 +181,275 @@ QUrl Service::scpdUrl() const
     return d->scpdurl;
 }
 
+int Service::version() const
+{
+    Q_D(const Service);
+    return d->type.section(QLatin1Char(':'), -1).toInt();
+}
+
+Device *Service::device() const
+{
+    return qobject_cast<Device *>(parent());
+}
+
+void Service::setRetryPolicy(Service::ActionClass actionClass, const Service::RetryPolicy &policy)
+{
+    Q_D(Service);
+    d->retryPolicies[actionClass] = policy;
+}
+
+Service::RetryPolicy Service::retryPolicy(Service::ActionClass actionClass) const
+{
+    Q_D(const Service);
+    return d->retryPolicies[actionClass];
+}
+
+void Service::setRetryBudget(int maxTokens, double tokenRatio)
+{
+    Q_D(Service);
+    d->retryMaxTokens = maxTokens;
+    d->retryTokenRatio = tokenRatio;
+    d->retryTokens = qMin(d->retryTokens, double(maxTokens));
+}
+
+Service::RetryStats Service::retryStats() const
+{
+    Q_D(const Service);
+    return d->retryStats;
+}
+
+Reply *Service::subscribe(int timeout)
+{
+    Q_D(Service);
+    auto ret = new Reply(this);
+
+    if (d->eventsuburl.isEmpty()) {
+        ret->finishWithErrorLater(QStringLiteral("Service has no eventing"));
+        return ret;
+    }
+
+    EventListener *listener = EventListener::instance();
+    if (!listener->isListening()) {
+        ret->finishWithErrorLater(QStringLiteral("Not listening for events"));
+        return ret;
+    }
+
+    if (d->eventPath.isEmpty()) {
+        d->eventPath = listener->registerCallback(this, [=] (const HttpServer::Request &request) {
+            d->notify(this, request);
+        });
+    }
+
+    if (!d->renewTimer) {
+        d->renewTimer = new QTimer(this);
+        d->renewTimer->setSingleShot(true);
+        connect(d->renewTimer, &QTimer::timeout, this, [=] {
+            d->sendSubscribe(this, nullptr, d->eventTimeout);
+        });
+    }
+
+    d->sid.clear();
+    d->sendSubscribe(this, ret, timeout);
+    return ret;
+}
+
+Reply *Service::unsubscribe()
+{
+    Q_D(Service);
+    auto ret = new Reply(this);
+
+    if (d->sid.isEmpty()) {
+        ret->finishWithErrorLater(QStringLiteral("Not subscribed"));
+        return ret;
+    }
+
+    d->renewTimer->stop();
+
+    QNetworkRequest request(d->absoluteUrl(this, d->eventsuburl));
+    request.setRawHeader(QByteArrayLiteral("SID"), d->sid);
+    d->sid.clear();
+
+    QNetworkReply *reply = device()->nam()->sendCustomRequest(request, QByteArrayLiteral("UNSUBSCRIBE"));
+    connect(reply, &QNetworkReply::finished, this, [=] {
+        reply->deleteLater();
+        qCDebug(UPNPQT_SERVICE) << "UNSUBSCRIBE" << reply->error();
+        if (reply->error()) {
+            ret->finishWithError(reply->errorString());
+        } else {
+            ret->finish();
+        }
+    });
+
+    return ret;
+}
+
+bool Service::isSubscribed() const
+{
+    Q_D(const Service);
+    return !d->sid.isEmpty();
+}
+
+QUrl ServicePrivate::absoluteUrl(Service *q, const QUrl &path) const
+{
+    QUrl url(q->device()->urlBase());
+    url.setPath(path.path());
+    url.setQuery(path.query());
+    return url;
+}
+
+void ServicePrivate::sendSubscribe(Service *q, Reply *ret, int timeout)
+{
+    const QUrl url = absoluteUrl(q, eventsuburl);
+    QNetworkRequest request(url);
+
+    const bool renewing = !sid.isEmpty();
+    if (renewing) {
+        request.setRawHeader(QByteArrayLiteral("SID"), sid);
+    } else {
+        const QHostAddress local = localAddressTowards(url);
+        QUrl callback;
+        callback.setScheme(QStringLiteral("http"));
+        callback.setHost(local.toString());
+        callback.setPort(EventListener::instance()->port());
+        callback.setPath(QString::fromLatin1(eventPath));
+
+        QByteArray callbackHeader = callback.toEncoded();
+        callbackHeader.prepend('<');
+        callbackHeader.append('>');
+        request.setRawHeader(QByteArrayLiteral("CALLBACK"), callbackHeader);
+        request.setRawHeader(QByteArrayLiteral("NT"), QByteArrayLiteral("upnp:event"));
+    }
+    request.setRawHeader(QByteArrayLiteral("TIMEOUT"), QByteArrayLiteral("Second-") + QByteArray::number(timeout));
+
+    QNetworkReply *reply = q->device()->nam()->sendCustomRequest(request, QByteArrayLiteral("SUBSCRIBE"));
+    QObject::connect(reply, &QNetworkReply::finished, q, [=] {
+        reply->deleteLater();
+
+        qCDebug(UPNPQT_SERVICE) << "SUBSCRIBE" << url << renewing << reply->error() << reply->rawHeader(QByteArrayLiteral("SID"));
+        if (reply->error()) {
+            if (renewing) {
+                // the gateway might have rebooted and forgotten us, start over
+                sid.clear();
+                sendSubscribe(q, ret, timeout);
+                return;
+            }
+
+            if (ret) {
+                ret->finishWithError(reply->errorString());
+            } else {
+                Q_EMIT q->subscriptionLost();
+            }
+            return;
+        }
+
+        sid = reply->rawHeader(QByteArrayLiteral("SID"));
+        subscriptionUrl = url;
+        if (Device *dev = q->device()) {
+            subscriptionNam = dev->nam();
+        }
+        eventTimeout = timeout;
+
+        const QByteArray granted = reply->rawHeader(QByteArrayLiteral("TIMEOUT")).toLower();
+        int seconds = timeout;
+        if (granted.startsWith("second-")) {
+            bool ok;
+            const int value = granted.mid(7).toInt(&ok);
+            if (ok && value > 0) {
+                seconds = value;
+            }
+        }
+
+        // renew at half of the granted time, an "infinite" one is renewed anyway
+        renewTimer->start(qMax(1, seconds / 2) * 1000);
+
+        if (ret) {
+            ret->finishWithData(QString::fromLatin1(sid));
+        }
+    });
+}
+
+void ServicePrivate::notify(Service *q, const HttpServer::Request &request)
+{
+    if (request.headers.value(QByteArrayLiteral("sid")) != sid) {
+        qCDebug(UPNPQT_SERVICE) << "NOTIFY with unknown SID" << request.headers.value(QByteArrayLiteral("sid"));
+        return;
+    }
+
+    // <e:propertyset><e:property><Variable>value</Variable></e:property>...
+    std::vector<std::pair<QString, QString>> changes;
+    QXmlStreamReader xml(request.body);
+    while (!xml.atEnd()) {
+        QXmlStreamReader::TokenType type = xml.readNext();
+        if (type == QXmlStreamReader::StartElement && xml.name() == QLatin1String("property")) {
+            while (!xml.atEnd()) {
+                type = xml.readNext();
+                if (type == QXmlStreamReader::StartElement) {
+                    const QString name = xml.name().toString();
+                    changes.push_back(std::make_pair(name, xml.readElementText()));
+                } else if (type == QXmlStreamReader::EndElement) {
+                    break;
+                }
+            }
+        }
+    }
+
+    qCDebug(UPNPQT_SERVICE) << "NOTIFY" << request.headers.value(QByteArrayLiteral("seq")) << changes.size();
+    for (const auto &change : changes) {
+        Q_EMIT q->stateVariableChanged(change.first, change.second);
+    }
+}
+
+void Service::callAction(SoapEnvelope &envelope, Service::ActionClass actionClass, const std::function<void (QNetworkReply *, const QByteArray &, const std::pair<QString, QString> &)> &callback)
+{
+    Q_D(Service);
+    Device *dev = device();
+    const QUrl url = d->absoluteUrl(this, d->controlurl);
+
+    const QByteArray body = envelope.render();
+    Metrics *metrics = Metrics::instance();
+    Tracer *tracer = Tracer::instance();
+    if (!metrics->isEnabled() && !tracer->isEnabled()) {
+        d->post(this, envelope.request(url), body, actionClass, 1, callback);
+    } else {
+        const QString gateway = dev->urlBase();
+        const QString action = envelope.action();
+        QElapsedTimer elapsed;
+        elapsed.start();
+        const bool counted = metrics->isEnabled();
+        if (counted) {
+            metrics->actionStarted(gateway);
+            d->metricsGateway = gateway;
+            ++d->metricsInFlight;
+        }
+        quint64 span = 0;
+        if (tracer->isEnabled()) {
+            span = tracer->begin(QLatin1String("soap.") + action, QStringLiteral("action"), tracer->correlationId(gateway), {
+                                     {QStringLiteral("gateway"), gateway},
+                                 });
+        }
+        d->post(this, envelope.request(url), body, actionClass, 1, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+            int errorCode = 0;
+            if (reply->error()) {
+                bool ok;
+                errorCode = error.first.toInt(&ok);
+                if (!ok || errorCode == 0) {
+                    errorCode = Reply::UnknownError;
+                }
+            }
+            if (counted) {
+                --d->metricsInFlight;
+                metrics->actionFinished(gateway, action, elapsed.elapsed(), errorCode);
+            }
+            if (span) {
+                tracer->end(span, {
+                                {QStringLiteral("error"), QString::number(errorCode)},
+                            });
+            }
+            callback(reply, data, error);
+        });
+    }
+
+    qCDebug(UPNPQT_SERVICE) << dev->urlBase() << url << body.constData();
+}
+
 #include "moc_service.cpp"
@@ -20,11 +20,17 @@
 
 #include <QObject>
 
+#include <functional>
+
 #include <UpnpQt/global.h>
 
 class QUrl;
+class QNetworkReply;
 namespace UpnpQt {
 
+class Reply;
+class Device;
+class SoapEnvelope;
 class ServicePrivate;
 class UPNPQT_LIBRARY Service : public QObject
 {
@@ -34,13 +40,107 @@ public:
     explicit Service(ServicePrivate *priv, QObject *parent = nullptr);
     ~Service();
 
+    /**
+     * Classifies actions by what repeating them does to the gateway,
+     * only read-only and idempotent actions are retried by default.
+     */
+    enum ActionClass {
+        ReadOnlyAction = 0,
+        IdempotentAction,
+        NonIdempotentAction,
+    };
+    Q_ENUM(ActionClass)
+
+    struct RetryPolicy {
+        /** Total attempts including the first one, 1 disables retrying */
+        int maxAttempts = 1;
+        /** Backoff before the first retry in ms, doubled on each further retry */
+        int initialBackoff = 200;
+        /** Upper bound for the backoff in ms, before jitter is applied */
+        int maxBackoff = 2000;
+    };
+
+    struct RetryStats {
+        quint64 retries = 0;
+        quint64 recovered = 0;
+        quint64 failedAfterRetry = 0;
+        quint64 budgetDenied = 0;
+    };
+
     QString id() const;
     QString type() const;
     QUrl controlUrl() const;
     QUrl eventsubUrl() const;
     QUrl scpdUrl() const;
 
+    /**
+     * @brief version
+     * @return the version suffix of the service type, 2 for "...:WANIPConnection:2"
+     */
+    int version() const;
+
+    Device *device() const;
+
+    /**
+     * @brief setRetryPolicy
+     *
+     * Transient failures (connection resets, timeouts, HTTP 500 without
+     * a UPnP error code or with ActionFailed 501) of actions in actionClass
+     * are retried with exponential backoff and jitter according to policy.
+     */
+    void setRetryPolicy(ActionClass actionClass, const RetryPolicy &policy);
+    RetryPolicy retryPolicy(ActionClass actionClass) const;
+
+    /**
+     * @brief setRetryBudget
+     *
+     * Retries draw one token from a bucket holding at most maxTokens,
+     * each action that succeeds on the first attempt refills tokenRatio
+     * tokens, so a failing gateway is not hammered with retries.
+     */
+    void setRetryBudget(int maxTokens, double tokenRatio = 0.1);
+
+    /**
+     * @brief retryStats
+     * @return counters of retries done by this service
+     */
+    RetryStats retryStats() const;
+
+    /**
+     * @brief subscribe
+     *
+     * Subscribes to GENA events of this service, evented state variables are
+     * delivered with stateVariableChanged() and the subscription is renewed
+     * automatically until unsubscribe() is called.
+     * @param timeout requested subscription duration in seconds
+     * @return QString with the subscription id (SID)
+     */
+    Reply *subscribe(int timeout = 1800);
+
+    /**
+     * @brief unsubscribe
+     * @return when Reply emits finished error must be false
+     */
+    Reply *unsubscribe();
+
+    bool isSubscribed() const;
+
+Q_SIGNALS:
+    void stateVariableChanged(const QString &name, const QString &value);
+
+    /**
+     * Emitted when renewing the subscription failed and subscribing again did not work either.
+     */
+    void subscriptionLost();
+
 protected:
+    /**
+     * Posts the envelope to the control URL, retrying transient failures,
+     * callback is called once with the reply of the last attempt and its
+     * SOAP fault, parsed once for the retry check, the metrics and callback.
+     */
+    void callAction(SoapEnvelope &envelope, ActionClass actionClass, const std::function<void(QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error)> &callback);
+
     ServicePrivate *d_ptr;
 };
 
@@ -18,19 +18,56 @@
 #ifndef UPNPSERVICE_P_H
 #define UPNPSERVICE_P_H
 
+#include "service.h"
+#include "httpserver.h"
+
 #include <QString>
 #include <QUrl>
+#include <QNetworkRequest>
+#include <QNetworkAccessManager>
+#include <QPointer>
+
+class QTimer;
 
 namespace UpnpQt {
 
 class ServicePrivate
 {
 public:
+    ServicePrivate();
+
+    void post(Service *q, const QNetworkRequest &request, const QByteArray &body,
+              Service::ActionClass actionClass, int attempt,
+              const std::function<void(QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error)> &callback);
+    int backoffDelay(Service::ActionClass actionClass, int attempt) const;
+
+    QUrl absoluteUrl(Service *q, const QUrl &url) const;
+    void sendSubscribe(Service *q, Reply *ret, int timeout);
+    void notify(Service *q, const HttpServer::Request &request);
+
     QString id;
     QString type;
     QUrl controlurl;
     QUrl eventsuburl;
     QUrl scpdurl;
+
+    Service::RetryPolicy retryPolicies[3];
+    Service::RetryStats retryStats;
+    double retryTokens = 10;
+    double retryTokenRatio = 0.1;
+    int retryMaxTokens = 10;
+
+    // actions counted by Metrics that haven't finished yet
+    QString metricsGateway;
+    int metricsInFlight = 0;
+
+    QByteArray eventPath;
+    QByteArray sid;
+    // kept to unsubscribe when the device is already gone
+    QUrl subscriptionUrl;
+    QPointer<QNetworkAccessManager> subscriptionNam;
+    QTimer *renewTimer = nullptr;
+    int eventTimeout = 1800;
 };
 
 }
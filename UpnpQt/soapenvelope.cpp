@@ -61,6 +61,11 @@ void SoapEnvelope::writeTextElement(const QString &qualifiedName, const QString
     }
 }
 
+QString SoapEnvelope::action() const
+{
+    return m_action;
+}
+
 QByteArray SoapEnvelope::render()
 {
     if (m_open) {
@@ -34,6 +34,8 @@ public:
 
     void writeTextElement(const QString &qualifiedName, const QString &text);
 
+    QString action() const;
+
     QByteArray render();
     QNetworkRequest request(const QUrl &url) const;
 
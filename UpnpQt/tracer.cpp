@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "tracer.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QThread>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <deque>
+#include <map>
+
+namespace UpnpQt {
+
+class TracerPrivate
+{
+public:
+    void pushFinished(Tracer::Span &&span);
+    void trimOpen();
+
+    mutable QMutex mutex;
+    QElapsedTimer clock;
+    // ordered by id, the first one is the oldest
+    std::map<quint64, Tracer::Span> open;
+    std::deque<Tracer::Span> finished;
+    QHash<QString, quint64> bindings;
+    size_t capacity = 10000;
+    quint64 nextSpanId = 1;
+    QAtomicInteger<quint64> nextCorrelationId{1};
+    QAtomicInt enabled{0};
+};
+
+}
+
+using namespace UpnpQt;
+
+void TracerPrivate::pushFinished(Tracer::Span &&span)
+{
+    finished.push_back(std::move(span));
+    if (finished.size() > capacity) {
+        finished.pop_front();
+    }
+}
+
+void TracerPrivate::trimOpen()
+{
+    // spans of replies deleted with their service or of abandoned
+    // discoveries never end, the oldest are closed as abandoned
+    const qint64 now = clock.nsecsElapsed() / 1000;
+    while (open.size() > capacity) {
+        auto it = open.begin();
+        Tracer::Span &span = it->second;
+        span.duration = now - span.start;
+        span.args.push_back(std::make_pair(QStringLiteral("abandoned"), QStringLiteral("1")));
+        pushFinished(std::move(span));
+        open.erase(it);
+    }
+}
+
+Tracer::Tracer()
+    : d_ptr(new TracerPrivate)
+{
+    d_ptr->clock.start();
+}
+
+Tracer::~Tracer()
+{
+    delete d_ptr;
+}
+
+Tracer *Tracer::instance()
+{
+    static Tracer tracer;
+    return &tracer;
+}
+
+void Tracer::setEnabled(bool enabled)
+{
+    Q_D(Tracer);
+    d->enabled.store(enabled ? 1 : 0);
+}
+
+bool Tracer::isEnabled() const
+{
+    Q_D(const Tracer);
+    return d->enabled.load();
+}
+
+void Tracer::setCapacity(int spans)
+{
+    Q_D(Tracer);
+    QMutexLocker locker(&d->mutex);
+    d->capacity = size_t(qMax(1, spans));
+    while (d->finished.size() > d->capacity) {
+        d->finished.pop_front();
+    }
+    d->trimOpen();
+}
+
+quint64 Tracer::newCorrelationId()
+{
+    Q_D(Tracer);
+    return d->nextCorrelationId.fetchAndAddRelaxed(1);
+}
+
+void Tracer::bind(const QString &key, quint64 correlationId)
+{
+    Q_D(Tracer);
+    if (!d->enabled.load()) {
+        return;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    d->bindings.insert(key, correlationId);
+}
+
+quint64 Tracer::correlationId(const QString &key) const
+{
+    Q_D(const Tracer);
+    if (!d->enabled.load()) {
+        return 0;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    return d->bindings.value(key);
+}
+
+void Tracer::unbind(const QString &key, quint64 correlationId)
+{
+    Q_D(Tracer);
+    QMutexLocker locker(&d->mutex);
+    auto it = d->bindings.find(key);
+    if (it != d->bindings.end() && it.value() == correlationId) {
+        d->bindings.erase(it);
+    }
+}
+
+quint64 Tracer::begin(const QString &name, const QString &category, quint64 correlationId, const Args &args)
+{
+    Q_D(Tracer);
+    if (!d->enabled.load()) {
+        return 0;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    const quint64 id = d->nextSpanId++;
+    Span &span = d->open[id];
+    span.name = name;
+    span.category = category;
+    span.args = args;
+    span.id = id;
+    span.correlationId = correlationId;
+    span.start = d->clock.nsecsElapsed() / 1000;
+    span.threadId = quint64(quintptr(QThread::currentThreadId()));
+    d->trimOpen();
+    return id;
+}
+
+void Tracer::end(quint64 spanId, const Args &args)
+{
+    Q_D(Tracer);
+    if (!spanId) {
+        return;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    auto it = d->open.find(spanId);
+    if (it == d->open.end()) {
+        // cleared while open
+        return;
+    }
+
+    Span &span = it->second;
+    span.duration = d->clock.nsecsElapsed() / 1000 - span.start;
+    span.args.insert(span.args.end(), args.begin(), args.end());
+    d->pushFinished(std::move(span));
+    d->open.erase(it);
+}
+
+std::vector<Tracer::Span> Tracer::spans() const
+{
+    Q_D(const Tracer);
+    QMutexLocker locker(&d->mutex);
+    return std::vector<Span>(d->finished.begin(), d->finished.end());
+}
+
+QByteArray Tracer::toChromeTrace() const
+{
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    QJsonArray events;
+    for (const Span &span : spans()) {
+        QJsonObject args{
+            {QStringLiteral("correlation"), QString::number(span.correlationId)},
+        };
+        for (const auto &arg : span.args) {
+            args.insert(arg.first, arg.second);
+        }
+
+        events.append(QJsonObject{
+                          {QStringLiteral("name"), span.name},
+                          {QStringLiteral("cat"), span.category},
+                          {QStringLiteral("ph"), QStringLiteral("X")},
+                          {QStringLiteral("ts"), double(span.start)},
+                          {QStringLiteral("dur"), double(span.duration)},
+                          {QStringLiteral("pid"), double(pid)},
+                          {QStringLiteral("tid"), double(span.threadId)},
+                          {QStringLiteral("id"), QString::number(span.correlationId)},
+                          {QStringLiteral("args"), args},
+                      });
+    }
+
+    return QJsonDocument(QJsonObject{
+                             {QStringLiteral("traceEvents"), events},
+                             {QStringLiteral("displayTimeUnit"), QStringLiteral("ms")},
+                         }).toJson(QJsonDocument::Compact);
+}
+
+void Tracer::clear()
+{
+    Q_D(Tracer);
+    QMutexLocker locker(&d->mutex);
+    d->open.clear();
+    d->finished.clear();
+    d->bindings.clear();
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_TRACER_H
+#define UPNPQT_TRACER_H
+
+#include <QString>
+#include <QByteArray>
+
+#include <utility>
+#include <vector>
+
+#include <UpnpQt/global.h>
+
+namespace UpnpQt {
+
+/**
+ * Records timestamped spans of discovery and actions.
+ *
+ * Disabled by default, when enabled Discover traces the M-SEARCH until
+ * the first answer, every description download and Device::fromXml, all
+ * sharing the correlation id of that discovery. Service actions on the
+ * devices found carry the same id, so the whole path up to the first
+ * AddPortMapping reads as one timeline in chrome://tracing or Perfetto.
+ */
+class TracerPrivate;
+class UPNPQT_LIBRARY Tracer
+{
+    Q_DECLARE_PRIVATE(Tracer)
+public:
+    typedef std::vector<std::pair<QString, QString>> Args;
+
+    struct Span {
+        QString name;
+        QString category;
+        Args args;
+        quint64 id = 0;
+        quint64 correlationId = 0;
+        /** usec since the tracer was created */
+        qint64 start = 0;
+        qint64 duration = 0;
+        quint64 threadId = 0;
+    };
+
+    static Tracer *instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    /**
+     * @brief setCapacity
+     * @param spans finished spans kept, older ones are dropped, defaults to 10000.
+     * At most as many spans are kept open, past that the oldest is
+     * finished with an "abandoned" arg.
+     */
+    void setCapacity(int spans);
+
+    quint64 newCorrelationId();
+
+    /**
+     * @brief bind associates key (i.e. a device URL) to a correlation id
+     */
+    void bind(const QString &key, quint64 correlationId);
+    quint64 correlationId(const QString &key) const;
+
+    /**
+     * @brief unbind removes the binding of key if it is still to correlationId
+     */
+    void unbind(const QString &key, quint64 correlationId);
+
+    /**
+     * @brief begin
+     *
+     * Callers building args should check isEnabled() first, only
+     * the atomic load is free when tracing is off.
+     * @return the span id to end it with, 0 when disabled
+     */
+    quint64 begin(const QString &name, const QString &category, quint64 correlationId, const Args &args = Args());
+    void end(quint64 spanId, const Args &args = Args());
+
+    std::vector<Span> spans() const;
+
+    /**
+     * @brief toChromeTrace
+     * @return finished spans as Chrome trace-event JSON
+     */
+    QByteArray toChromeTrace() const;
+    void clear();
+
+private:
+    Tracer();
+    ~Tracer();
+
+    TracerPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPQT_TRACER_H
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "trafficsampler.h"
+#include "wancommoninterfaceconfigservice.h"
+#include "reply.h"
+
+#include <QTimer>
+#include <QPointer>
+#include <QElapsedTimer>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_TRAFFIC, "upnpqt.traffic", QtInfoMsg)
+
+namespace UpnpQt {
+
+class TrafficSamplerPrivate
+{
+public:
+    void poll();
+    void queryLinkRate();
+    void record(quint64 sent, qint64 sentAt, quint64 received, qint64 receivedAt);
+    static bool delta(quint64 previous, quint64 current, qint64 msec, quint64 maxRate, quint64 *delta);
+
+    TrafficSampler *q_ptr;
+    QPointer<WanCommonInterfaceConfigService> service;
+    QTimer timer;
+    QElapsedTimer clock;
+    // ring buffer, head is the next slot to write
+    std::vector<TrafficSampler::Sample> ring;
+    int head = 0;
+    int count = 0;
+    int capacity = 60;
+    // each counter is stamped when its own answer arrives
+    qint64 lastSentAt = -1;
+    qint64 lastReceivedAt = -1;
+    quint64 lastSent = 0;
+    quint64 lastReceived = 0;
+    // bytes per second from GetCommonLinkProperties, 0 when unknown
+    quint64 maxSentRate = 0;
+    quint64 maxReceivedRate = 0;
+    int generation = 0;
+    bool inFlight = false;
+    bool linkQueried = false;
+};
+
+}
+
+using namespace UpnpQt;
+
+TrafficSampler::TrafficSampler(WanCommonInterfaceConfigService *service, QObject *parent) : QObject(parent)
+  , d_ptr(new TrafficSamplerPrivate)
+{
+    Q_D(TrafficSampler);
+    d->q_ptr = this;
+    d->service = service;
+    d->ring.resize(size_t(d->capacity));
+    d->timer.setInterval(1000);
+    connect(&d->timer, &QTimer::timeout, this, [=] {
+        d->poll();
+    });
+
+    if (service) {
+        // a poll in flight never finishes once the service is gone
+        connect(service, &QObject::destroyed, this, [=] {
+            qCDebug(UPNPQT_TRAFFIC) << "service destroyed, stopping";
+            stop();
+        });
+    }
+}
+
+TrafficSampler::~TrafficSampler()
+{
+    delete d_ptr;
+}
+
+void TrafficSampler::setInterval(int msec)
+{
+    Q_D(TrafficSampler);
+    d->timer.setInterval(qMax(1, msec));
+}
+
+int TrafficSampler::interval() const
+{
+    Q_D(const TrafficSampler);
+    return d->timer.interval();
+}
+
+void TrafficSampler::setCapacity(int samples)
+{
+    Q_D(TrafficSampler);
+    const std::vector<Sample> kept = this->samples();
+    d->capacity = qMax(1, samples);
+    d->ring.assign(size_t(d->capacity), Sample());
+    d->head = 0;
+    d->count = 0;
+
+    const int first = qMax(0, int(kept.size()) - d->capacity);
+    for (size_t i = size_t(first); i < kept.size(); ++i) {
+        d->ring[size_t(d->head)] = kept[i];
+        d->head = (d->head + 1) % d->capacity;
+        ++d->count;
+    }
+}
+
+int TrafficSampler::capacity() const
+{
+    Q_D(const TrafficSampler);
+    return d->capacity;
+}
+
+void TrafficSampler::start()
+{
+    Q_D(TrafficSampler);
+    if (d->timer.isActive()) {
+        return;
+    }
+
+    d->clock.start();
+    d->lastSentAt = -1;
+    d->lastReceivedAt = -1;
+    d->timer.start();
+    d->queryLinkRate();
+    d->poll();
+}
+
+void TrafficSampler::stop()
+{
+    Q_D(TrafficSampler);
+    d->timer.stop();
+    // answers of a poll in flight are ignored
+    ++d->generation;
+    d->inFlight = false;
+}
+
+bool TrafficSampler::isRunning() const
+{
+    Q_D(const TrafficSampler);
+    return d->timer.isActive();
+}
+
+std::vector<TrafficSampler::Sample> TrafficSampler::samples() const
+{
+    Q_D(const TrafficSampler);
+    std::vector<Sample> ret;
+    ret.reserve(size_t(d->count));
+    for (int i = d->count; i > 0; --i) {
+        ret.push_back(d->ring[size_t((d->head - i + d->capacity) % d->capacity)]);
+    }
+    return ret;
+}
+
+int TrafficSampler::sampleCount() const
+{
+    Q_D(const TrafficSampler);
+    return d->count;
+}
+
+TrafficSampler::Sample TrafficSampler::latest() const
+{
+    Q_D(const TrafficSampler);
+    if (d->count == 0) {
+        return Sample();
+    }
+    return d->ring[size_t((d->head - 1 + d->capacity) % d->capacity)];
+}
+
+TrafficSampler::Sample TrafficSampler::average(int count) const
+{
+    Q_D(const TrafficSampler);
+    const int n = count > 0 ? qMin(count, d->count) : d->count;
+
+    Sample ret;
+    for (int i = 1; i <= n; ++i) {
+        const Sample &sample = d->ring[size_t((d->head - i + d->capacity) % d->capacity)];
+        ret.sentRate += sample.sentRate;
+        ret.receivedRate += sample.receivedRate;
+        if (i == 1) {
+            ret.timestamp = sample.timestamp;
+        }
+    }
+    if (n > 0) {
+        ret.sentRate /= n;
+        ret.receivedRate /= n;
+    }
+    return ret;
+}
+
+void TrafficSamplerPrivate::poll()
+{
+    if (inFlight || !service) {
+        return;
+    }
+    inFlight = true;
+
+    // one after the other, so both go over the same keep-alive connection
+    const int current = generation;
+    auto received = service->getTotalBytesReceived();
+    QObject::connect(received, &Reply::finished, q_ptr, [=] {
+        if (current != generation) {
+            return;
+        }
+        if (received->error() || !service) {
+            qCDebug(UPNPQT_TRAFFIC) << "GetTotalBytesReceived failed" << received->errorCode() << received->errorString();
+            inFlight = false;
+            return;
+        }
+
+        const quint64 receivedBytes = received->result();
+        const qint64 receivedAt = clock.elapsed();
+        auto sent = service->getTotalBytesSent();
+        QObject::connect(sent, &Reply::finished, q_ptr, [=] {
+            if (current != generation) {
+                return;
+            }
+            inFlight = false;
+            if (sent->error()) {
+                qCDebug(UPNPQT_TRAFFIC) << "GetTotalBytesSent failed" << sent->errorCode() << sent->errorString();
+                return;
+            }
+            record(sent->result(), clock.elapsed(), receivedBytes, receivedAt);
+        });
+    });
+}
+
+void TrafficSamplerPrivate::queryLinkRate()
+{
+    if (linkQueried || !service) {
+        return;
+    }
+    linkQueried = true;
+
+    auto reply = service->getCommonLinkProperties();
+    QObject::connect(reply, &Reply::finished, q_ptr, [=] {
+        if (reply->error()) {
+            qCDebug(UPNPQT_TRAFFIC) << "GetCommonLinkProperties failed" << reply->errorCode() << reply->errorString();
+            return;
+        }
+        const WanCommonInterfaceConfigService::LinkProperties link = reply->result();
+        maxSentRate = link.upstreamMaxBitRate / 8;
+        maxReceivedRate = link.downstreamMaxBitRate / 8;
+    });
+}
+
+void TrafficSamplerPrivate::record(quint64 sent, qint64 sentAt, quint64 received, qint64 receivedAt)
+{
+    const qint64 previousSentAt = lastSentAt;
+    const qint64 previousReceivedAt = lastReceivedAt;
+    const quint64 previousSent = lastSent;
+    const quint64 previousReceived = lastReceived;
+    lastSentAt = sentAt;
+    lastReceivedAt = receivedAt;
+    lastSent = sent;
+    lastReceived = received;
+
+    const qint64 sentMsec = sentAt - previousSentAt;
+    const qint64 receivedMsec = receivedAt - previousReceivedAt;
+    quint64 sentDelta;
+    quint64 receivedDelta;
+    if (previousSentAt < 0 || previousReceivedAt < 0 || sentMsec <= 0 || receivedMsec <= 0 ||
+            !delta(previousSent, sent, sentMsec, maxSentRate, &sentDelta) ||
+            !delta(previousReceived, received, receivedMsec, maxReceivedRate, &receivedDelta)) {
+        // the first poll or the counters were reset, the next one gives a rate
+        return;
+    }
+
+    TrafficSampler::Sample sample;
+    sample.timestamp = sentAt;
+    sample.sentRate = double(sentDelta) * 1000.0 / double(sentMsec);
+    sample.receivedRate = double(receivedDelta) * 1000.0 / double(receivedMsec);
+
+    ring[size_t(head)] = sample;
+    head = (head + 1) % capacity;
+    count = qMin(count + 1, capacity);
+
+    Q_EMIT q_ptr->sampled(sample);
+}
+
+bool TrafficSamplerPrivate::delta(quint64 previous, quint64 current, qint64 msec, quint64 maxRate, quint64 *delta)
+{
+    if (current >= previous) {
+        *delta = current - previous;
+        return true;
+    }
+
+    if (previous > 0xffffffffULL) {
+        return false;
+    }
+
+    // the ui4 counter wrapped, unless that means more traffic than the
+    // link could carry in the interval (twice its rate, or 10 Gbit/s when
+    // unknown) which is a gateway restart resetting it
+    const quint64 rate = maxRate > 0 ? maxRate * 2 : Q_UINT64_C(1250000000);
+    *delta = current + (Q_UINT64_C(1) << 32) - previous;
+    return *delta <= rate * quint64(msec) / 1000;
+}
+
+#include "moc_trafficsampler.cpp"
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPTRAFFICSAMPLER_H
+#define UPNPTRAFFICSAMPLER_H
+
+#include <QObject>
+
+#include <vector>
+
+#include <UpnpQt/global.h>
+
+namespace UpnpQt {
+
+class WanCommonInterfaceConfigService;
+
+/**
+ * Polls the byte counters of a WANCommonInterfaceConfig service and
+ * keeps the rates of the last capacity() intervals in a ring buffer.
+ *
+ * Both counters are read one after the other so the requests share one
+ * keep-alive connection, a tick is skipped while the previous one is
+ * still in flight. Each counter is timestamped when its own answer
+ * arrives and its rate is computed over its own interval.
+ *
+ * Counters going backwards are taken as a 32 bit wrap, or as a reset when
+ * the previous value didn't fit in 32 bits or the wrap would mean more
+ * than twice the link rate reported by GetCommonLinkProperties over the
+ * interval (10 Gbit/s when the gateway doesn't report one).
+ *
+ * The sampler stops when the service is destroyed.
+ */
+class TrafficSamplerPrivate;
+class UPNPQT_LIBRARY TrafficSampler : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(TrafficSampler)
+public:
+    struct Sample {
+        /** msec since the sampler started, when the sent counter was read */
+        qint64 timestamp = 0;
+        /** bytes per second, each over the interval between its own counter reads */
+        double sentRate = 0;
+        double receivedRate = 0;
+    };
+
+    explicit TrafficSampler(WanCommonInterfaceConfigService *service, QObject *parent = nullptr);
+    virtual ~TrafficSampler();
+
+    /**
+     * @brief setInterval
+     * @param msec time between samples, defaults to 1000
+     */
+    void setInterval(int msec);
+    int interval() const;
+
+    /**
+     * @brief setCapacity
+     * @param samples kept in the ring buffer, defaults to 60, older ones are dropped
+     */
+    void setCapacity(int samples);
+    int capacity() const;
+
+    void start();
+    void stop();
+    bool isRunning() const;
+
+    /**
+     * @brief samples
+     * @return the buffered samples, oldest first
+     */
+    std::vector<Sample> samples() const;
+    int sampleCount() const;
+
+    /**
+     * @brief latest
+     * @return the newest sample, a zero one before the second poll
+     */
+    Sample latest() const;
+
+    /**
+     * @brief average
+     * @param count number of newest samples to average, 0 for all buffered
+     */
+    Sample average(int count = 0) const;
+
+Q_SIGNALS:
+    void sampled(const UpnpQt::TrafficSampler::Sample &sample);
+
+private:
+    TrafficSamplerPrivate *d_ptr;
+};
+
+}
+
+Q_DECLARE_METATYPE(UpnpQt::TrafficSampler::Sample)
+
+#endif // UPNPTRAFFICSAMPLER_H
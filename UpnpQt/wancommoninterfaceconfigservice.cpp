@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "wancommoninterfaceconfigservice.h"
+#include "soapenvelope.h"
+#include "reply.h"
+
+#include <QNetworkReply>
+#include <QXmlStreamReader>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_WANCOMMON, "upnpqt.wancommon", QtInfoMsg)
+
+using namespace UpnpQt;
+
+WanCommonInterfaceConfigService::WanCommonInterfaceConfigService(ServicePrivate *priv, QObject *parent)
+    : Service(priv, parent)
+{
+
+}
+
+TypedReply<WanCommonInterfaceConfigService::LinkProperties> *WanCommonInterfaceConfigService::getCommonLinkProperties()
+{
+    auto ret = new TypedReply<LinkProperties>(this);
+    qCDebug(UPNPQT_WANCOMMON) << "getCommonLinkProperties";
+
+    SoapEnvelope envelope(QStringLiteral("GetCommonLinkProperties"), type());
+
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_WANCOMMON) << "getCommonLinkProperties downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+            return;
+        }
+
+        LinkProperties properties;
+        QXmlStreamReader xml(data);
+        while (!xml.atEnd()) {
+            if (xml.readNext() != QXmlStreamReader::StartElement) {
+                continue;
+            }
+
+            const QStringRef name = xml.name();
+            if (name == QLatin1String("NewWANAccessType")) {
+                properties.accessType = xml.readElementText();
+            } else if (name == QLatin1String("NewLayer1UpstreamMaxBitRate")) {
+                properties.upstreamMaxBitRate = xml.readElementText().toUInt();
+            } else if (name == QLatin1String("NewLayer1DownstreamMaxBitRate")) {
+                properties.downstreamMaxBitRate = xml.readElementText().toUInt();
+            } else if (name == QLatin1String("NewPhysicalLinkStatus")) {
+                properties.physicalLinkStatus = xml.readElementText();
+            }
+        }
+        ret->finishWithResult(properties);
+    });
+    return ret;
+}
+
+TypedReply<quint64> *WanCommonInterfaceConfigService::getTotalBytesSent()
+{
+    return getCounter(QStringLiteral("GetTotalBytesSent"), QLatin1String("NewTotalBytesSent"));
+}
+
+TypedReply<quint64> *WanCommonInterfaceConfigService::getTotalBytesReceived()
+{
+    return getCounter(QStringLiteral("GetTotalBytesReceived"), QLatin1String("NewTotalBytesReceived"));
+}
+
+TypedReply<quint64> *WanCommonInterfaceConfigService::getTotalPacketsSent()
+{
+    return getCounter(QStringLiteral("GetTotalPacketsSent"), QLatin1String("NewTotalPacketsSent"));
+}
+
+TypedReply<quint64> *WanCommonInterfaceConfigService::getTotalPacketsReceived()
+{
+    return getCounter(QStringLiteral("GetTotalPacketsReceived"), QLatin1String("NewTotalPacketsReceived"));
+}
+
+TypedReply<quint64> *WanCommonInterfaceConfigService::getCounter(const QString &action, QLatin1String argument)
+{
+    auto ret = new TypedReply<quint64>(this);
+    qCDebug(UPNPQT_WANCOMMON) << action;
+
+    SoapEnvelope envelope(action, type());
+
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_WANCOMMON) << action << "downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+            return;
+        }
+
+        QXmlStreamReader xml(data);
+        while (!xml.atEnd()) {
+            if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == argument) {
+                bool ok;
+                const quint64 value = xml.readElementText().trimmed().toULongLong(&ok);
+                if (ok) {
+                    ret->finishWithResult(value);
+                    return;
+                }
+                break;
+            }
+        }
+        ret->finishWithError(QStringLiteral("Invalid response"));
+    });
+    return ret;
+}
+
+#include "moc_wancommoninterfaceconfigservice.cpp"
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef WANCOMMONINTERFACECONFIGSERVICE_H
+#define WANCOMMONINTERFACECONFIGSERVICE_H
+
+#include <QObject>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/service.h>
+#include <UpnpQt/reply.h>
+
+namespace UpnpQt {
+
+/**
+ * WANCommonInterfaceConfig:1, properties and traffic counters of the
+ * WAN link, see TrafficSampler to turn the counters into rates.
+ */
+class UPNPQT_LIBRARY WanCommonInterfaceConfigService : public Service
+{
+    Q_OBJECT
+public:
+    explicit WanCommonInterfaceConfigService(ServicePrivate *priv, QObject *parent = nullptr);
+
+    struct LinkProperties {
+        /** "DSL", "POTS", "Cable", "Ethernet"... */
+        QString accessType;
+        /** bits per second */
+        quint32 upstreamMaxBitRate = 0;
+        quint32 downstreamMaxBitRate = 0;
+        /** "Up", "Down", "Initializing" or "Unavailable" */
+        QString physicalLinkStatus;
+    };
+
+    TypedReply<LinkProperties> *getCommonLinkProperties();
+
+    /**
+     * @brief getTotalBytesSent
+     * @return the counter, most gateways report it in 32 bits and let it wrap
+     */
+    TypedReply<quint64> *getTotalBytesSent();
+    TypedReply<quint64> *getTotalBytesReceived();
+    TypedReply<quint64> *getTotalPacketsSent();
+    TypedReply<quint64> *getTotalPacketsReceived();
+
+private:
+    TypedReply<quint64> *getCounter(const QString &action, QLatin1String argument);
+};
+
+}
+
+Q_DECLARE_METATYPE(UpnpQt::WanCommonInterfaceConfigService::LinkProperties)
+
+#endif // WANCOMMONINTERFACECONFIGSERVICE_H
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "wanconnectionresponse.h"
+
+#include <QDomDocument>
+#include <QXmlStreamReader>
+#include <QSet>
+
+using namespace UpnpQt;
+
+namespace {
+
+QDomElement responseElement(QDomDocument &doc, const QByteArray &data, const QString &response)
+{
+    doc.setContent(data, true);
+    return doc
+            .documentElement()
+            .firstChildElement(QStringLiteral("Body"))
+            .firstChildElement(response);
+}
+
+// reads the children of the current element, GetSpecificPortMappingEntry and
+// GetGenericPortMappingEntry responses name two of them unlike the listing
+WanConnectionService::PortMap parsePortMappingEntry(QXmlStreamReader &xml)
+{
+    WanConnectionService::PortMap map;
+    while (!xml.atEnd()) {
+        QXmlStreamReader::TokenType type = xml.readNext();
+        if (type == QXmlStreamReader::StartElement) {
+            const QStringRef name = xml.name();
+            if (name == QLatin1String("NewRemoteHost")) {
+                map.setRemoteHost(xml.readElementText());
+            } else if (name == QLatin1String("NewExternalPort")) {
+                map.externalPort = quint16(xml.readElementText().toUInt());
+            } else if (name == QLatin1String("NewProtocol")) {
+                map.setSockType(xml.readElementText() == QLatin1String("TCP") ? QAbstractSocket::TcpSocket : QAbstractSocket::UdpSocket);
+            } else if (name == QLatin1String("NewInternalPort")) {
+                map.internalPort = quint16(xml.readElementText().toUInt());
+            } else if (name == QLatin1String("NewInternalClient")) {
+                map.setInternalAddress(xml.readElementText());
+            } else if (name == QLatin1String("NewEnabled")) {
+                map.enabled = xml.readElementText() == QLatin1String("1");
+            } else if (name == QLatin1String("NewDescription") || name == QLatin1String("NewPortMappingDescription")) {
+                map.setDescription(xml.readElementText());
+            } else if (name == QLatin1String("NewLeaseTime") || name == QLatin1String("NewLeaseDuration")) {
+                map.leaseDuration = xml.readElementText().toInt();
+            } else {
+                xml.skipCurrentElement();
+            }
+        } else if (type == QXmlStreamReader::EndElement) {
+            break;
+        }
+    }
+    return map;
+}
+
+WanConnectionService::PortMap parseResponsePortMap(const QByteArray &data, QLatin1String response)
+{
+    QXmlStreamReader xml(data);
+    while (!xml.atEnd()) {
+        if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == response) {
+            return parsePortMappingEntry(xml);
+        }
+    }
+    return WanConnectionService::PortMap();
+}
+
+std::vector<WanConnectionService::PortMap> parsePortListing(const QString &portListing)
+{
+    std::vector<WanConnectionService::PortMap> portMaps;
+    // a page mostly repeats a few descriptions, entries share one copy of each
+    QSet<QString> descriptions;
+    QXmlStreamReader xml(portListing);
+    while (!xml.atEnd()) {
+        QXmlStreamReader::TokenType type = xml.readNext();
+        if (type == QXmlStreamReader::StartElement && xml.name() == QLatin1String("PortMappingEntry")) {
+            WanConnectionService::PortMap map = parsePortMappingEntry(xml);
+            map.setDescription(*descriptions.insert(map.description()));
+            portMaps.push_back(std::move(map));
+        }
+    }
+    return portMaps;
+}
+
+}
+
+quint16 WanConnectionResponse::addAnyPortMapping(const QByteArray &data)
+{
+    QDomDocument doc;
+    const QDomElement res = responseElement(doc, data, QStringLiteral("AddAnyPortMappingResponse"));
+    return quint16(res.firstChildElement(QStringLiteral("NewReservedPort")).text().toUInt());
+}
+
+WanConnectionService::PortMap WanConnectionResponse::specificPortMappingEntry(const QByteArray &data)
+{
+    return parseResponsePortMap(data, QLatin1String("GetSpecificPortMappingEntryResponse"));
+}
+
+WanConnectionService::PortMap WanConnectionResponse::genericPortMappingEntry(const QByteArray &data)
+{
+    return parseResponsePortMap(data, QLatin1String("GetGenericPortMappingEntryResponse"));
+}
+
+std::vector<WanConnectionService::PortMap> WanConnectionResponse::listOfPortMappings(const QByteArray &data)
+{
+    // the listing is an XML document escaped inside NewPortListing
+    QString portListing;
+    QXmlStreamReader xml(data);
+    while (!xml.atEnd()) {
+        QXmlStreamReader::TokenType type = xml.readNext();
+        if (type == QXmlStreamReader::StartElement && xml.name() == QLatin1String("NewPortListing")) {
+            portListing = xml.readElementText();
+            break;
+        }
+    }
+    return parsePortListing(portListing);
+}
+
+QVariantHash WanConnectionResponse::statusInfo(const QByteArray &data)
+{
+    QDomDocument doc;
+    const QDomElement res = responseElement(doc, data, QStringLiteral("GetStatusInfoResponse"));
+    return QVariantHash{
+        {QStringLiteral("ConnectionStatus"), res.firstChildElement(QStringLiteral("NewConnectionStatus")).text()},
+        {QStringLiteral("LastConnectionError"), res.firstChildElement(QStringLiteral("NewLastConnectionError")).text()},
+        {QStringLiteral("Uptime"), res.firstChildElement(QStringLiteral("NewUptime")).text()},
+    };
+}
+
+QString WanConnectionResponse::externalIp(const QByteArray &data)
+{
+    QDomDocument doc;
+    return responseElement(doc, data, QStringLiteral("GetExternalIPAddressResponse"))
+            .firstChildElement(QStringLiteral("NewExternalIPAddress"))
+            .text();
+}
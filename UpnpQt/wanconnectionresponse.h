@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPWANCONNECTIONRESPONSE_H
+#define UPNPWANCONNECTIONRESPONSE_H
+
+#include "wanconnectionservice.h"
+
+namespace UpnpQt {
+
+/**
+ * Decoding of the WanConnectionService action responses, kept apart
+ * from the actions so it can be measured on its own.
+ */
+class WanConnectionResponse
+{
+public:
+    static quint16 addAnyPortMapping(const QByteArray &data);
+
+    /**
+     * externalPort, sockType and remoteHost are not part of the response
+     */
+    static WanConnectionService::PortMap specificPortMappingEntry(const QByteArray &data);
+    static WanConnectionService::PortMap genericPortMappingEntry(const QByteArray &data);
+    static std::vector<WanConnectionService::PortMap> listOfPortMappings(const QByteArray &data);
+    static QVariantHash statusInfo(const QByteArray &data);
+    static QString externalIp(const QByteArray &data);
+};
+
+}
+
+#endif // UPNPWANCONNECTIONRESPONSE_H
@@ -17,14 +17,22 @@
  */
 #include "wanconnectionservice.h"
 #include "soapenvelope.h"
+#include "wanconnectionresponse.h"
 #include "device.h"
 #include "reply.h"
+#include "portmappingenumerator.h"
+#include "portmappingmirror.h"
 
 #include <QUrl>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 
-#include <QDomDocument>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSet>
+
+#include <algorithm>
+#include <memory>
 
 #include <QLoggingCategory>
 
@@ -32,14 +40,374 @@ Q_LOGGING_CATEGORY(UPNPQT_WANSRV, "upnpqt.wansrv", QtInfoMsg)
 
 using namespace UpnpQt;
 
+namespace {
+
+struct PortMappingBatch {
+    std::vector<WanConnectionService::BatchResult> results;
+    size_t next = 0;
+    size_t done = 0;
+    bool add;
+};
+
+void runBatch(WanConnectionService *srv, TypedReply<std::vector<WanConnectionService::BatchResult>> *ret, const std::shared_ptr<PortMappingBatch> &batch)
+{
+    const size_t index = batch->next++;
+    const WanConnectionService::PortMap &map = batch->results[index].portMap;
+
+    Reply *reply;
+    if (batch->add) {
+        reply = srv->addPortMapping(map.externalPort, map.internalAddress(), map.internalPort, map.sockType(),
+                                    map.description(), map.enabled, map.leaseDuration, map.remoteHost());
+    } else {
+        reply = srv->deletePortMapping(map.externalPort, map.sockType(), map.remoteHost());
+    }
+
+    QObject::connect(reply, &Reply::finished, ret, [=] {
+        WanConnectionService::BatchResult &result = batch->results[index];
+        result.error = reply->error();
+        result.errorCode = reply->errorCode();
+        result.errorString = reply->errorString();
+
+        if (++batch->done == batch->results.size()) {
+            ret->finishWithResult(std::move(batch->results));
+        } else if (batch->next < batch->results.size()) {
+            runBatch(srv, ret, batch);
+        }
+    });
+}
+
+// taken holds the ports an enumeration found mapped to someone else,
+// it is only used when there is no valid mirror
+quint16 pickFreePort(PortMappingMirror *mirror, const QSet<quint16> &taken, const WanConnectionService::PortMap &map, const std::vector<quint16> &tried)
+{
+    const bool useMirror = mirror && mirror->isValid();
+    quint32 port = map.externalPort ? map.externalPort : 49152;
+    for (int i = 0; i < 65536; ++i, port = port >= 65535 ? 1024 : port + 1) {
+        if (std::find(tried.begin(), tried.end(), quint16(port)) != tried.end()) {
+            continue;
+        }
+
+        if (useMirror) {
+            if (mirror->contains(quint16(port), map.sockType(), map.remoteHost())) {
+                // re-adding our own mapping just updates it
+                const WanConnectionService::PortMap existing = mirror->portMap(quint16(port), map.sockType(), map.remoteHost());
+                if (existing.internalHostAddress() != map.internalHostAddress() || existing.internalPort != map.internalPort) {
+                    continue;
+                }
+            }
+        } else if (taken.contains(quint16(port))) {
+            continue;
+        }
+        return quint16(port);
+    }
+    return 0;
+}
+
+bool conflicts(const WanConnectionService::PortMap &existing, const WanConnectionService::PortMap &map)
+{
+    if (existing.sockType() != map.sockType()) {
+        return false;
+    }
+    if (!existing.remoteHost().isEmpty() && !map.remoteHost().isEmpty() && existing.remoteHost() != map.remoteHost()) {
+        return false;
+    }
+    return existing.internalHostAddress() != map.internalHostAddress() || existing.internalPort != map.internalPort;
+}
+
+void addAnyPortMappingFallback(WanConnectionService *srv, TypedReply<quint16> *ret, const WanConnectionService::PortMap &map,
+                               const std::shared_ptr<QSet<quint16>> &taken, const std::vector<quint16> &tried)
+{
+    PortMappingMirror *mirror = srv->mirror();
+    if (!taken && !(mirror && mirror->isValid())) {
+        // one walk of the table instead of a round trip per taken port
+        auto ports = std::make_shared<QSet<quint16>>();
+        auto enumerator = new PortMappingEnumerator(srv, ret);
+        QObject::connect(enumerator, &PortMappingEnumerator::entry, ret, [=] (const WanConnectionService::PortMap &portMap) {
+            if (conflicts(portMap, map)) {
+                ports->insert(portMap.externalPort);
+            }
+        });
+        QObject::connect(enumerator, &PortMappingEnumerator::finished, ret, [=] {
+            if (enumerator->error()) {
+                // what was listed still helps, conflicts are retried
+                qCDebug(UPNPQT_WANSRV) << "AddAnyPortMapping fallback enumeration failed" << enumerator->errorCode() << ports->size();
+            }
+            enumerator->deleteLater();
+            addAnyPortMappingFallback(srv, ret, map, ports, tried);
+        });
+        enumerator->start();
+        return;
+    }
+
+    const quint16 port = pickFreePort(mirror, taken ? *taken : QSet<quint16>(), map, tried);
+    if (port == 0 || tried.size() >= 8) {
+        ret->finishWithErrorLater(QStringLiteral("NoPortMapsAvailable"), QStringLiteral("728"));
+        return;
+    }
+
+    Reply *reply = srv->addPortMapping(port, map.internalAddress(), map.internalPort, map.sockType(),
+                                       map.description(), map.enabled, map.leaseDuration, map.remoteHost());
+    QObject::connect(reply, &Reply::finished, ret, [=] {
+        if (!reply->error()) {
+            ret->finishWithResult(port);
+        } else if (reply->upnpError() == Reply::ConflictInMappingEntry) {
+            // taken since the mirror or the enumeration saw the table,
+            // never sent again
+            std::vector<quint16> next = tried;
+            next.push_back(port);
+            addAnyPortMappingFallback(srv, ret, map, taken ? taken : std::make_shared<QSet<quint16>>(), next);
+        } else {
+            ret->finishWithError(reply->errorString(), reply->errorCode());
+        }
+    });
+}
+
+void startBatch(WanConnectionService *srv, TypedReply<std::vector<WanConnectionService::BatchResult>> *ret, const std::vector<WanConnectionService::PortMap> &portMaps, int window, bool add)
+{
+    auto batch = std::make_shared<PortMappingBatch>();
+    batch->add = add;
+    batch->results.resize(portMaps.size());
+    for (size_t i = 0; i < portMaps.size(); ++i) {
+        batch->results[i].portMap = portMaps[i];
+    }
+
+    if (portMaps.empty()) {
+        QTimer::singleShot(0, ret, [=] {
+            ret->finishWithResult(std::move(batch->results));
+        });
+        return;
+    }
+
+    const size_t inFlight = std::min(portMaps.size(), size_t(qMax(1, window)));
+    for (size_t i = 0; i < inFlight; ++i) {
+        runBatch(srv, ret, batch);
+    }
+}
+
+}
+
+namespace UpnpQt {
+
+class WanConnectionServicePrivate
+{
+public:
+    PortMappingMirror *mirror = nullptr;
+    QTimer *pollTimer = nullptr;
+    QElapsedTimer subscribeClock;
+    QString externalIp;
+    QString connectionStatus;
+    int portMappingEntries = -1;
+    int minPollInterval = 5000;
+    int maxPollInterval = 300000;
+    int pollInterval = 5000;
+    bool monitoring = false;
+};
+
+struct WanConnectionService::PortMap::Extra : public QSharedData
+{
+    // IPv6 addresses with their formatted text, or the verbatim text of
+    // something that is not an IP with a null address
+    QHostAddress internalAddress;
+    QString internalText;
+    QHostAddress remoteHost;
+    QString remoteText;
+};
+
+}
+
+static_assert(sizeof(void *) != 8 || sizeof(WanConnectionService::PortMap) <= 40,
+              "PortMap is meant to stay at 40 bytes on 64 bit builds");
+
+static QString formatIPv4(quint32 ipv4)
+{
+    char buf[16];
+    const int len = qsnprintf(buf, sizeof(buf), "%u.%u.%u.%u",
+                              ipv4 >> 24, (ipv4 >> 16) & 0xff, (ipv4 >> 8) & 0xff, ipv4 & 0xff);
+    return QString::fromLatin1(buf, len);
+}
+
+WanConnectionService::PortMap::PortMap(quint16 externalPort, const QString &internalAddress, quint16 internalPort,
+                                       QAbstractSocket::SocketType sockType, const QString &description,
+                                       bool enabled, int leaseDuration, const QString &remoteHost)
+    : externalPort(externalPort)
+    , internalPort(internalPort)
+    , leaseDuration(leaseDuration)
+    , enabled(enabled)
+{
+    setInternalAddress(internalAddress);
+    setRemoteHost(remoteHost);
+    setSockType(sockType);
+    setDescription(description);
+}
+
+WanConnectionService::PortMap::PortMap(const PortMap &other) = default;
+
+WanConnectionService::PortMap::PortMap(PortMap &&other) noexcept = default;
+
+WanConnectionService::PortMap::~PortMap() = default;
+
+WanConnectionService::PortMap &WanConnectionService::PortMap::operator=(const PortMap &other) = default;
+
+WanConnectionService::PortMap &WanConnectionService::PortMap::operator=(PortMap &&other) noexcept = default;
+
+void WanConnectionService::PortMap::setInternalAddress(const QString &address)
+{
+    QHostAddress host;
+    if (address.isEmpty() || host.setAddress(address)) {
+        setAddress(false, host, QString());
+    } else {
+        qCWarning(UPNPQT_WANSRV) << "PortMap address is not an IP, keeping it verbatim" << address;
+        setAddress(false, host, address);
+    }
+}
+
+void WanConnectionService::PortMap::setInternalAddress(const QHostAddress &address)
+{
+    setAddress(false, address, QString());
+}
+
+QString WanConnectionService::PortMap::internalAddress() const
+{
+    switch (m_internalKind) {
+    case IPv4Address:
+        return formatIPv4(m_internalIPv4);
+    case OtherAddress:
+        return m_extra->internalText;
+    default:
+        return QString();
+    }
+}
+
+QHostAddress WanConnectionService::PortMap::internalHostAddress() const
+{
+    switch (m_internalKind) {
+    case IPv4Address:
+        return QHostAddress(m_internalIPv4);
+    case OtherAddress:
+        return m_extra->internalAddress;
+    default:
+        return QHostAddress();
+    }
+}
+
+void WanConnectionService::PortMap::setRemoteHost(const QString &address)
+{
+    QHostAddress host;
+    if (address.isEmpty() || host.setAddress(address)) {
+        setAddress(true, host, QString());
+    } else {
+        // dropping it would turn a single remote host into the wildcard
+        qCWarning(UPNPQT_WANSRV) << "PortMap address is not an IP, keeping it verbatim" << address;
+        setAddress(true, host, address);
+    }
+}
+
+void WanConnectionService::PortMap::setRemoteHost(const QHostAddress &address)
+{
+    setAddress(true, address, QString());
+}
+
+QString WanConnectionService::PortMap::remoteHost() const
+{
+    switch (m_remoteKind) {
+    case IPv4Address:
+        return formatIPv4(m_remoteIPv4);
+    case OtherAddress:
+        return m_extra->remoteText;
+    default:
+        return QString();
+    }
+}
+
+QHostAddress WanConnectionService::PortMap::remoteHostAddress() const
+{
+    switch (m_remoteKind) {
+    case IPv4Address:
+        return QHostAddress(m_remoteIPv4);
+    case OtherAddress:
+        return m_extra->remoteHost;
+    default:
+        return QHostAddress();
+    }
+}
+
+void WanConnectionService::PortMap::setSockType(QAbstractSocket::SocketType sockType)
+{
+    m_sockType = qint8(sockType);
+}
+
+QAbstractSocket::SocketType WanConnectionService::PortMap::sockType() const
+{
+    return QAbstractSocket::SocketType(m_sockType);
+}
+
+void WanConnectionService::PortMap::setDescription(const QString &description)
+{
+    m_description = description;
+}
+
+QString WanConnectionService::PortMap::description() const
+{
+    return m_description;
+}
+
+void WanConnectionService::PortMap::setAddress(bool remote, const QHostAddress &address, const QString &text)
+{
+    quint32 &ipv4 = remote ? m_remoteIPv4 : m_internalIPv4;
+    quint8 &kind = remote ? m_remoteKind : m_internalKind;
+
+    ipv4 = 0;
+    if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+        ipv4 = address.toIPv4Address();
+        kind = IPv4Address;
+    } else if (address.protocol() == QAbstractSocket::IPv6Protocol || !text.isEmpty()) {
+        if (!m_extra) {
+            m_extra = new Extra;
+        } else {
+            m_extra.detach();
+        }
+        // formatted once here, the getters return it as stored
+        (remote ? m_extra->remoteHost : m_extra->internalAddress) = address;
+        (remote ? m_extra->remoteText : m_extra->internalText) = text.isEmpty() ? address.toString() : text;
+        kind = OtherAddress;
+        return;
+    } else {
+        kind = NoAddress;
+    }
+
+    if (m_extra) {
+        if (m_internalKind != OtherAddress && m_remoteKind != OtherAddress) {
+            m_extra.reset();
+        } else {
+            m_extra.detach();
+            (remote ? m_extra->remoteHost : m_extra->internalAddress) = QHostAddress();
+            (remote ? m_extra->remoteText : m_extra->internalText) = QString();
+        }
+    }
+}
+
 WanConnectionService::WanConnectionService(UpnpQt::ServicePrivate *priv, QObject *parent)
     : Service(priv, parent)
+    , d_ptr(new WanConnectionServicePrivate)
 {
+    Q_D(WanConnectionService);
+    connect(this, &Service::stateVariableChanged, this, &WanConnectionService::updateStateVariable);
+    connect(this, &Service::subscriptionLost, this, [=] {
+        if (d->monitoring) {
+            qCDebug(UPNPQT_WANSRV) << "subscription lost, polling";
+            startPolling();
+        }
+    });
+}
 
+WanConnectionService::~WanConnectionService()
+{
+    delete d_ptr;
 }
 
 Reply *WanConnectionService::addPortMapping(quint16 externalPort, const QString &internalAddress, quint16 internalPort, QAbstractSocket::SocketType sockType, const QString &description, bool enabled, int leaseDuration, const QString &remoteHost)
 {
+    Q_D(WanConnectionService);
     auto ret = new Reply(this);
     qCDebug(UPNPQT_WANSRV) << "addPortMapping" << externalPort << internalAddress << sockType << remoteHost;
 
@@ -55,27 +423,19 @@ Reply *WanConnectionService::addPortMapping(quint16 externalPort, const QString
     envelope.writeTextElement(QStringLiteral("NewPortMappingDescription"), description);
     envelope.writeTextElement(QStringLiteral("NewLeaseDuration"), QString::number(leaseDuration));
 
-    auto device = qobject_cast<Device*>(parent());
-    QUrl url(device->urlBase());
-    url.setPath(controlUrl().path());
-    url.setQuery(controlUrl().query());
-
-    QNetworkReply *reply = device->nam()->post(envelope.request(url), envelope.render());
-    connect(reply, &QNetworkReply::finished, this, [=] {
-        reply->deleteLater();
-
-        const QByteArray data = reply->readAll();
+    callAction(envelope, NonIdempotentAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
         qCDebug(UPNPQT_WANSRV) << "addPortMapping downloaded XML" << reply->error() << data.constData();
         if (reply->error()) {
-            auto error = SoapEnvelope::responseError(data);
             ret->finishWithError(error.second, error.first);
         } else {
+            if (d->mirror) {
+                d->mirror->insert(PortMap(externalPort, internalAddress, internalPort, sockType,
+                                         description, enabled, leaseDuration, remoteHost));
+            }
             ret->finish();
         }
     });
 
-    qCDebug(UPNPQT_WANSRV) << device->urlBase() << url << envelope.render().constData();
-
     return ret;
 }
 
@@ -84,8 +444,77 @@ Reply *WanConnectionService::addPortMapping(quint16 externalPort, const QHostAdd
     return addPortMapping(externalPort, internalAddress.toString(), internalPort, sockType, description, enabled, leaseDuration, remoteHost.toString());
 }
 
+TypedReply<quint16> *WanConnectionService::addAnyPortMapping(quint16 externalPort, const QString &internalAddress, quint16 internalPort, QAbstractSocket::SocketType sockType, const QString &description, bool enabled, int leaseDuration, const QString &remoteHost)
+{
+    Q_D(WanConnectionService);
+    auto ret = new TypedReply<quint16>(this);
+    qCDebug(UPNPQT_WANSRV) << "addAnyPortMapping" << externalPort << internalAddress << sockType << remoteHost;
+
+    const PortMap map(externalPort, internalAddress, internalPort, sockType, description, enabled, leaseDuration, remoteHost);
+
+    if (version() < 2) {
+        addAnyPortMappingFallback(this, ret, map, nullptr, std::vector<quint16>());
+        return ret;
+    }
+
+    SoapEnvelope envelope(QStringLiteral("AddAnyPortMapping"), type());
+
+    envelope.writeTextElement(QStringLiteral("NewRemoteHost"), remoteHost);
+    envelope.writeTextElement(QStringLiteral("NewExternalPort"), QString::number(externalPort));
+    envelope.writeTextElement(QStringLiteral("NewProtocol"),
+                              sockType == QAbstractSocket::TcpSocket ? QStringLiteral("TCP") : QStringLiteral("UDP"));
+    envelope.writeTextElement(QStringLiteral("NewInternalPort"), QString::number(internalPort));
+    envelope.writeTextElement(QStringLiteral("NewInternalClient"), internalAddress);
+    envelope.writeTextElement(QStringLiteral("NewEnabled"), enabled ? QStringLiteral("1") : QStringLiteral("0"));
+    envelope.writeTextElement(QStringLiteral("NewPortMappingDescription"), description);
+    envelope.writeTextElement(QStringLiteral("NewLeaseDuration"), QString::number(leaseDuration));
+
+    callAction(envelope, NonIdempotentAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_WANSRV) << "addAnyPortMapping downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            if (error.first == QLatin1String("401") || error.first == QLatin1String("602")) {
+                addAnyPortMappingFallback(this, ret, map, nullptr, std::vector<quint16>());
+            } else {
+                ret->finishWithError(error.second, error.first);
+            }
+        } else {
+            const quint16 port = WanConnectionResponse::addAnyPortMapping(data);
+            if (d->mirror) {
+                PortMap reserved = map;
+                reserved.externalPort = port;
+                d->mirror->insert(reserved);
+            }
+            ret->finishWithResult(port);
+        }
+    });
+
+    return ret;
+}
+
+TypedReply<quint16> *WanConnectionService::addAnyPortMapping(quint16 externalPort, const QHostAddress &internalAddress, quint16 internalPort, QAbstractSocket::SocketType sockType, const QString &description, bool enabled, int leaseDuration, const QHostAddress &remoteHost)
+{
+    return addAnyPortMapping(externalPort, internalAddress.toString(), internalPort, sockType, description, enabled, leaseDuration, remoteHost.toString());
+}
+
+TypedReply<std::vector<WanConnectionService::BatchResult>> *WanConnectionService::addPortMappings(const std::vector<PortMap> &portMaps, int window)
+{
+    auto ret = new TypedReply<std::vector<BatchResult>>(this);
+    qCDebug(UPNPQT_WANSRV) << "addPortMappings" << portMaps.size() << "window" << window;
+    startBatch(this, ret, portMaps, window, true);
+    return ret;
+}
+
+TypedReply<std::vector<WanConnectionService::BatchResult>> *WanConnectionService::deletePortMappings(const std::vector<PortMap> &portMaps, int window)
+{
+    auto ret = new TypedReply<std::vector<BatchResult>>(this);
+    qCDebug(UPNPQT_WANSRV) << "deletePortMappings" << portMaps.size() << "window" << window;
+    startBatch(this, ret, portMaps, window, false);
+    return ret;
+}
+
 Reply *WanConnectionService::deletePortMapping(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost)
 {
+    Q_D(WanConnectionService);
     auto ret = new Reply(this);
     qCDebug(UPNPQT_WANSRV) << "deletePortMapping port " << externalPort << sockType << remoteHost;
 
@@ -96,26 +525,20 @@ Reply *WanConnectionService::deletePortMapping(quint16 externalPort, QAbstractSo
     envelope.writeTextElement(QStringLiteral("NewProtocol"),
                               sockType == QAbstractSocket::TcpSocket ? QStringLiteral("TCP") : QStringLiteral("UDP"));
 
-    auto device = qobject_cast<Device*>(parent());
-    QUrl url(device->urlBase());
-    url.setPath(controlUrl().path());
-    url.setQuery(controlUrl().query());
-
-    QNetworkReply *reply = device->nam()->post(envelope.request(url), envelope.render());
-    connect(reply, &QNetworkReply::finished, this, [=] {
-        reply->deleteLater();
-
-        const QByteArray data = reply->readAll();
+    callAction(envelope, IdempotentAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
         qCDebug(UPNPQT_WANSRV) << "downloaded XML DeletePortMapping" << reply->error() << data.constData();
         if (reply->error()) {
-            auto error = SoapEnvelope::responseError(data);
+            if (d->mirror && error.first == QLatin1String("714")) {
+                d->mirror->remove(externalPort, sockType, remoteHost);
+            }
             ret->finishWithError(error.second, error.first);
         } else {
+            if (d->mirror) {
+                d->mirror->remove(externalPort, sockType, remoteHost);
+            }
             ret->finish();
         }
     });
-
-    qCDebug(UPNPQT_WANSRV) << device->urlBase() << url << envelope.render().constData();
     return ret;
 }
 
@@ -124,10 +547,11 @@ Reply *WanConnectionService::deletePortMapping(quint16 externalPort, QAbstractSo
     return deletePortMapping(externalPort, sockType, remoteHost.toString());
 }
 
-Reply *WanConnectionService::getSpecificPortMappingEntry(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost)
+TypedReply<WanConnectionService::PortMap> *WanConnectionService::getSpecificPortMappingEntry(quint16 externalPort, QAbstractSocket::SocketType sockType, const QString &remoteHost)
 {
+    Q_D(WanConnectionService);
     qCDebug(UPNPQT_WANSRV) << "Forwarding port " << externalPort << sockType << remoteHost;
-    auto ret = new Reply(this);
+    auto ret = new TypedReply<PortMap>(this);
 
     SoapEnvelope envelope(QStringLiteral("GetSpecificPortMappingEntry"), type());
 
@@ -136,184 +560,306 @@ Reply *WanConnectionService::getSpecificPortMappingEntry(quint16 externalPort, Q
     envelope.writeTextElement(QStringLiteral("NewProtocol"),
                             sockType == QAbstractSocket::TcpSocket ? QStringLiteral("TCP") : QStringLiteral("UDP"));
 
-    auto device = qobject_cast<Device*>(parent());
-    QUrl url(device->urlBase());
-    url.setPath(controlUrl().path());
-    url.setQuery(controlUrl().query());
-
-    QNetworkReply *reply = device->nam()->post(envelope.request(url), envelope.render());
-    connect(reply, &QNetworkReply::finished, this, [=] {
-        reply->deleteLater();
-
-        const QByteArray data = reply->readAll();
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
         qCDebug(UPNPQT_WANSRV) << "downloaded XML GetSpecificPortMappingEntry" << reply->error() << data.constData();
         if (reply->error()) {
-            auto error = SoapEnvelope::responseError(data);
+            if (d->mirror && error.first == QLatin1String("714")) {
+                d->mirror->remove(externalPort, sockType, remoteHost);
+            }
             ret->finishWithError(error.second, error.first);
         } else {
-            QDomDocument doc;
-            doc.setContent(data, true);
-            const QDomElement res = doc
-                    .documentElement()
-                    .firstChildElement(QStringLiteral("Body"))
-                    .firstChildElement(QStringLiteral("GetSpecificPortMappingEntryResponse"));
-            qCDebug(UPNPQT_WANSRV) << res.firstChildElement(QStringLiteral("NewLeaseDuration")).text();
-            PortMap map;
-            map.internalPort = quint16(res.firstChildElement(QStringLiteral("NewInternalPort")).text().toUInt());
-            map.internalAddress = res.firstChildElement(QStringLiteral("NewInternalClient")).text();
+            PortMap map = WanConnectionResponse::specificPortMappingEntry(data);
             map.externalPort = externalPort;
-            map.sockType = sockType;
-            map.enabled = res.firstChildElement(QStringLiteral("NewEnabled")).text() == QLatin1String("1");
-            map.description = res.firstChildElement(QStringLiteral("NewPortMappingDescription")).text();
-            map.leaseDuration = res.firstChildElement(QStringLiteral("NewLeaseDuration")).text().toInt();
-            map.remoteHost = remoteHost;
-            ret->finishWithData(QVariant::fromValue(map));
+            map.setSockType(sockType);
+            map.setRemoteHost(remoteHost);
+            if (d->mirror) {
+                d->mirror->insert(map);
+            }
+            ret->finishWithResult(std::move(map));
         }
     });
-
-    qCDebug(UPNPQT_WANSRV) << device->urlBase() << url << envelope.render().constData();
     return ret;
 }
 
-Reply *WanConnectionService::getSpecificPortMappingEntry(quint16 externalPort, QAbstractSocket::SocketType sockType, const QHostAddress &remoteHost)
+TypedReply<WanConnectionService::PortMap> *WanConnectionService::getSpecificPortMappingEntry(quint16 externalPort, QAbstractSocket::SocketType sockType, const QHostAddress &remoteHost)
 {
     return getSpecificPortMappingEntry(externalPort, sockType, remoteHost.toString());
 }
 
-Reply *WanConnectionService::getGenericPortMapping()
+TypedReply<std::vector<WanConnectionService::PortMap>> *WanConnectionService::getGenericPortMapping(int window)
 {
-    auto ret = new Reply(this);
-    getGenericPortMapping(ret);
+    auto ret = new TypedReply<std::vector<PortMap>>(this);
+    qCDebug(UPNPQT_WANSRV) << "getGenericPortMapping window" << window;
+
+    auto portMaps = std::make_shared<std::vector<PortMap>>();
+    auto enumerator = new PortMappingEnumerator(this, ret);
+    enumerator->setWindow(window);
+    connect(enumerator, &PortMappingEnumerator::entry, ret, [=] (const PortMap &portMap) {
+        portMaps->push_back(portMap);
+    });
+    connect(enumerator, &PortMappingEnumerator::finished, ret, [=] {
+        enumerator->deleteLater();
+        if (enumerator->error()) {
+            ret->finishWithError(enumerator->errorString(), enumerator->errorCode());
+        } else {
+            ret->finishWithResult(std::move(*portMaps));
+        }
+    });
+    enumerator->start();
+
     return ret;
 }
 
-Reply *WanConnectionService::getStatusInfo()
+TypedReply<std::vector<WanConnectionService::PortMap>> *WanConnectionService::getListOfPortMappings(quint16 startPort, quint16 endPort, QAbstractSocket::SocketType sockType, bool manage, int numberOfPorts)
 {
-    qCDebug(UPNPQT_WANSRV) << "GetStatusInfo";
-    auto ret = new Reply(this);
+    auto ret = new TypedReply<std::vector<PortMap>>(this);
+    qCDebug(UPNPQT_WANSRV) << "getListOfPortMappings" << startPort << endPort << sockType << manage << numberOfPorts;
 
-    SoapEnvelope envelope(QStringLiteral("GetStatusInfo"), type());
+    SoapEnvelope envelope(QStringLiteral("GetListOfPortMappings"), type());
+
+    envelope.writeTextElement(QStringLiteral("NewStartPort"), QString::number(startPort));
+    envelope.writeTextElement(QStringLiteral("NewEndPort"), QString::number(endPort));
+    envelope.writeTextElement(QStringLiteral("NewProtocol"),
+                              sockType == QAbstractSocket::TcpSocket ? QStringLiteral("TCP") : QStringLiteral("UDP"));
+    envelope.writeTextElement(QStringLiteral("NewManage"), manage ? QStringLiteral("1") : QStringLiteral("0"));
+    envelope.writeTextElement(QStringLiteral("NewNumberOfPorts"), QString::number(numberOfPorts));
+
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_WANSRV) << "downloaded XML GetListOfPortMappings" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+            return;
+        }
 
-    auto device = qobject_cast<Device*>(parent());
-    QUrl url(device->urlBase());
-    url.setPath(controlUrl().path());
-    url.setQuery(controlUrl().query());
+        ret->finishWithResult(WanConnectionResponse::listOfPortMappings(data));
+    });
+    return ret;
+}
 
-    QNetworkReply *reply = device->nam()->post(envelope.request(url), envelope.render());
-    connect(reply, &QNetworkReply::finished, this, [=] {
-        reply->deleteLater();
+TypedReply<QVariantHash> *WanConnectionService::getStatusInfo()
+{
+    qCDebug(UPNPQT_WANSRV) << "GetStatusInfo";
+    auto ret = new TypedReply<QVariantHash>(this);
 
-        const QByteArray data = reply->readAll();
+    SoapEnvelope envelope(QStringLiteral("GetStatusInfo"), type());
+
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
         qCDebug(UPNPQT_WANSRV) << "GetStatusInfo downloaded XML" << reply->error() << data.constData();
         if (reply->error()) {
-            auto error = SoapEnvelope::responseError(data);
             ret->finishWithError(error.second, error.first);
         } else {
-            QDomDocument doc;
-            doc.setContent(data, true);
-            const QDomElement res = doc
-                    .documentElement()
-                    .firstChildElement(QStringLiteral("Body"))
-                    .firstChildElement(QStringLiteral("GetStatusInfoResponse"));
-            ret->finishWithData(QVariantHash{
-                                    {QStringLiteral("ConnectionStatus"), res.firstChildElement(QStringLiteral("NewConnectionStatus")).text()},
-                                    {QStringLiteral("LastConnectionError"), res.firstChildElement(QStringLiteral("NewLastConnectionError")).text()},
-                                    {QStringLiteral("Uptime"), res.firstChildElement(QStringLiteral("NewUptime")).text()},
-                                });
+            ret->finishWithResult(WanConnectionResponse::statusInfo(data));
         }
     });
-
-    qCDebug(UPNPQT_WANSRV) << device->urlBase() << url << envelope.render().constData();
     return ret;
 }
 
-Reply *WanConnectionService::getExternalIp()
+TypedReply<QString> *WanConnectionService::getExternalIp()
 {
-    auto ret = new Reply(this);
-    qCDebug(UPNPQT_WANSRV) << "getExternalIp" << parent() << parent()->parent() << qobject_cast<Device*>(parent()->parent())->urlBase();
+    auto ret = new TypedReply<QString>(this);
+    qCDebug(UPNPQT_WANSRV) << "getExternalIp" << device()->urlBase();
 
     SoapEnvelope envelope(QStringLiteral("GetExternalIPAddress"), type());
 
-    auto device = qobject_cast<Device*>(parent());
-    QUrl url(device->urlBase());
-    url.setPath(controlUrl().path());
-    url.setQuery(controlUrl().query());
-
-    QNetworkReply *reply = device->nam()->post(envelope.request(url), envelope.render());
-    connect(reply, &QNetworkReply::finished, this, [=] {
-        reply->deleteLater();
-
-        QByteArray data = reply->readAll();
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
         qCDebug(UPNPQT_WANSRV) << "getExternalIp downloaded XML" << reply->error() << data.constData();
         if (!reply->error()) {
-            QDomDocument doc;
-            doc.setContent(data, true);
-            const QDomElement res = doc
-                    .documentElement()
-                    .firstChildElement(QStringLiteral("Body"))
-                    .firstChildElement(QStringLiteral("GetExternalIPAddressResponse"))
-                    .firstChildElement(QStringLiteral("NewExternalIPAddress"));
-            ret->finishWithData(res.text());
+            ret->finishWithResult(WanConnectionResponse::externalIp(data));
         } else {
             ret->finishWithError(QStringLiteral("error"));
         }
     });
-
-    qCDebug(UPNPQT_WANSRV) << "getExternalIp" << device->urlBase() << url << envelope.render().constData();
     return ret;
 }
 
-void WanConnectionService::getGenericPortMapping(Reply *ret, int index, const std::vector<PortMap> &portMaps)
+TypedReply<WanConnectionService::PortMap> *WanConnectionService::getGenericPortMappingEntry(int index)
 {
-    qCDebug(UPNPQT_WANSRV) << "getGenericPortMapping";
+    auto ret = new TypedReply<PortMap>(this);
+    qCDebug(UPNPQT_WANSRV) << "getGenericPortMappingEntry" << index;
+
     SoapEnvelope envelope(QStringLiteral("GetGenericPortMappingEntry"), type());
 
     envelope.writeTextElement(QStringLiteral("NewPortMappingIndex"), QString::number(index));
 
-    auto device = qobject_cast<Device*>(parent());
-    QUrl url(device->urlBase());
-    url.setPath(controlUrl().path());
-    url.setQuery(controlUrl().query());
-
-    QNetworkReply *reply = device->nam()->post(envelope.request(url), envelope.render());
-    connect(reply, &QNetworkReply::finished, this, [=] {
-        reply->deleteLater();
-
-        const QByteArray data = reply->readAll();
-        qCDebug(UPNPQT_WANSRV) << "downloaded XML" << reply->error() << data.constData();
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_WANSRV) << "downloaded XML GetGenericPortMappingEntry" << index << reply->error() << data.constData();
         if (!reply->error()) {
-            QDomDocument doc;
-            doc.setContent(data, true);
-            const QDomElement res = doc
-                    .documentElement()
-                    .firstChildElement(QStringLiteral("Body"))
-                    .firstChildElement(QStringLiteral("GetGenericPortMappingEntryResponse"));
-            qCDebug(UPNPQT_WANSRV) << res.firstChildElement(QStringLiteral("NewLeaseDuration")).text();
-            PortMap map;
-            map.internalPort = quint16(res.firstChildElement(QStringLiteral("NewInternalPort")).text().toUInt());
-            map.internalAddress = res.firstChildElement(QStringLiteral("NewInternalClient")).text();
-            map.externalPort = quint16(res.firstChildElement(QStringLiteral("NewExternalPort")).text().toUInt());
-            map.sockType = res.firstChildElement(QStringLiteral("NewProtocol")).text() == QLatin1String("TCP")
-                    ? QAbstractSocket::TcpSocket : QAbstractSocket::UdpSocket;
-            map.enabled = res.firstChildElement(QStringLiteral("NewEnabled")).text() == QLatin1String("1");
-            map.description = res.firstChildElement(QStringLiteral("NewPortMappingDescription")).text();
-            map.leaseDuration = res.firstChildElement(QStringLiteral("NewLeaseDuration")).text().toInt();
-            map.remoteHost = res.firstChildElement(QStringLiteral("NewRemoteHost")).text();
-
-            std::vector<PortMap> maps = portMaps;
-            maps.push_back(map);
-            getGenericPortMapping(ret, index + 1, maps);
+            PortMap map = WanConnectionResponse::genericPortMappingEntry(data);
+            ret->finishWithResult(std::move(map));
         } else {
-            auto error = SoapEnvelope::responseError(data);
-            if (error.first == QLatin1String("713") || error.second == QLatin1String("SpecifiedArrayIndexInvalid")) {
-                ret->finishWithData(QVariant::fromValue(portMaps));
-            } else {
-                ret->finishWithError(error.second, error.first);
+            ret->finishWithError(error.second, error.first);
+        }
+    });
+    return ret;
+}
+
+void WanConnectionService::setMirrorEnabled(bool enabled, int refreshInterval)
+{
+    Q_D(WanConnectionService);
+    if (enabled) {
+        if (!d->mirror) {
+            d->mirror = new PortMappingMirror(this);
+            d->mirror->revalidate();
+        }
+        d->mirror->setRefreshInterval(refreshInterval);
+    } else {
+        delete d->mirror;
+        d->mirror = nullptr;
+    }
+}
+
+PortMappingMirror *WanConnectionService::mirror() const
+{
+    Q_D(const WanConnectionService);
+    return d->mirror;
+}
+
+void WanConnectionService::startMonitoring(int minPollInterval, int maxPollInterval)
+{
+    Q_D(WanConnectionService);
+    d->minPollInterval = qMax(1000, minPollInterval);
+    d->maxPollInterval = qMax(d->minPollInterval, maxPollInterval);
+    if (d->monitoring) {
+        return;
+    }
+    d->monitoring = true;
+
+    d->subscribeClock.start();
+    Reply *reply = subscribe();
+    connect(reply, &Reply::finished, this, [=] {
+        if (reply->error() && d->monitoring) {
+            qCDebug(UPNPQT_WANSRV) << "eventing not available, polling" << reply->errorString();
+            startPolling();
+        }
+    });
+}
+
+void WanConnectionService::stopMonitoring()
+{
+    Q_D(WanConnectionService);
+    d->monitoring = false;
+    if (d->pollTimer) {
+        d->pollTimer->stop();
+    }
+    if (isSubscribed()) {
+        unsubscribe();
+    }
+}
+
+bool WanConnectionService::isPolling() const
+{
+    Q_D(const WanConnectionService);
+    return d->pollTimer && d->pollTimer->isActive();
+}
+
+QString WanConnectionService::externalIp() const
+{
+    Q_D(const WanConnectionService);
+    return d->externalIp;
+}
+
+QString WanConnectionService::connectionStatus() const
+{
+    Q_D(const WanConnectionService);
+    return d->connectionStatus;
+}
+
+bool WanConnectionService::updateStateVariable(const QString &name, const QString &value)
+{
+    Q_D(WanConnectionService);
+    if (name == QLatin1String("ExternalIPAddress")) {
+        if (value != d->externalIp) {
+            d->externalIp = value;
+            Q_EMIT externalIpChanged(value);
+            return true;
+        }
+    } else if (name == QLatin1String("ConnectionStatus")) {
+        if (value != d->connectionStatus) {
+            d->connectionStatus = value;
+            Q_EMIT connectionStatusChanged(value);
+            return true;
+        }
+    } else if (name == QLatin1String("PortMappingNumberOfEntries")) {
+        const int entries = value.toInt();
+        if (entries != d->portMappingEntries) {
+            d->portMappingEntries = entries;
+            if (d->mirror && d->mirror->isValid() && d->mirror->count() != entries) {
+                d->mirror->revalidate();
+            }
+            Q_EMIT portMappingNumberOfEntriesChanged(entries);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WanConnectionService::startPolling()
+{
+    Q_D(WanConnectionService);
+    if (!d->pollTimer) {
+        d->pollTimer = new QTimer(this);
+        d->pollTimer->setSingleShot(true);
+        connect(d->pollTimer, &QTimer::timeout, this, &WanConnectionService::poll);
+    }
+    d->pollInterval = d->minPollInterval;
+    poll();
+}
+
+void WanConnectionService::poll()
+{
+    Q_D(WanConnectionService);
+    auto pending = std::make_shared<int>(2);
+    auto changed = std::make_shared<bool>(false);
+    auto done = [=] {
+        if (--*pending == 0 && d->monitoring && !isSubscribed()) {
+            // back off while the gateway state is stable
+            d->pollInterval = *changed ? d->minPollInterval : qMin(d->pollInterval * 2, d->maxPollInterval);
+            d->pollTimer->start(d->pollInterval);
+
+            if (d->subscribeClock.elapsed() >= d->maxPollInterval) {
+                resubscribe();
             }
         }
+    };
+
+    TypedReply<QString> *ip = getExternalIp();
+    connect(ip, &Reply::finished, this, [=] {
+        if (!ip->error() && updateStateVariable(QStringLiteral("ExternalIPAddress"), ip->result())) {
+            *changed = true;
+        }
+        done();
     });
 
-    qCDebug(UPNPQT_WANSRV) << device->urlBase() << url << envelope.render().constData();
+    TypedReply<QVariantHash> *status = getStatusInfo();
+    connect(status, &Reply::finished, this, [=] {
+        if (!status->error()) {
+            const QVariantHash &info = status->result();
+            if (updateStateVariable(QStringLiteral("ConnectionStatus"), info.value(QStringLiteral("ConnectionStatus")).toString())) {
+                *changed = true;
+            }
+        }
+        done();
+    });
+}
+
+void WanConnectionService::resubscribe()
+{
+    Q_D(WanConnectionService);
+    // the gateway may have come back with eventing after a reboot
+    d->subscribeClock.start();
+    Reply *reply = subscribe();
+    connect(reply, &Reply::finished, this, [=] {
+        if (reply->error()) {
+            return;
+        }
+
+        if (d->monitoring) {
+            qCDebug(UPNPQT_WANSRV) << "subscribed again, stop polling";
+            d->pollTimer->stop();
+        } else {
+            unsubscribe();
+        }
+    });
 }
 
 #include "moc_wanconnectionservice.cpp"
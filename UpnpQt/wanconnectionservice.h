@@ -21,28 +21,104 @@
 #include <QObject>
 #include <QHostAddress>
 #include <QAbstractSocket>
+#include <QExplicitlySharedDataPointer>
 
 #include <UpnpQt/global.h>
 #include <UpnpQt/service.h>
+#include <UpnpQt/reply.h>
 
 namespace UpnpQt {
 
-class Reply;
+class PortMappingMirror;
+class WanConnectionServicePrivate;
 class UPNPQT_LIBRARY WanConnectionService : public Service
 {
     Q_OBJECT
+    Q_DECLARE_PRIVATE(WanConnectionService)
 public:
     explicit WanConnectionService(ServicePrivate *priv, QObject *parent = nullptr);
+    virtual ~WanConnectionService();
 
-    struct PortMap {
-        quint16 externalPort;
-        QString internalAddress;
-        quint16 internalPort;
-        QAbstractSocket::SocketType sockType;
-        QString description;
-        bool enabled = true;
+    /**
+     * A port mapping kept small for large tables: IPv4 addresses and the
+     * protocol are stored inline, IPv6 addresses and strings that are not
+     * an IP live in a block shared between copies and only allocated for
+     * them. Descriptions parsed from one listing, or kept in a mirror,
+     * share one string.
+     */
+    class UPNPQT_LIBRARY PortMap
+    {
+    public:
+        PortMap() = default;
+        PortMap(quint16 externalPort, const QString &internalAddress, quint16 internalPort,
+                QAbstractSocket::SocketType sockType, const QString &description,
+                bool enabled = true, int leaseDuration = 0, const QString &remoteHost = QString());
+        PortMap(const PortMap &other);
+        PortMap(PortMap &&other) noexcept;
+        ~PortMap();
+        PortMap &operator=(const PortMap &other);
+        PortMap &operator=(PortMap &&other) noexcept;
+
+        /**
+         * @brief setInternalAddress
+         * @param address "x.x.x.x" or an IPv6 address, anything else is kept
+         * verbatim and internalHostAddress() returns a null address for it
+         */
+        void setInternalAddress(const QString &address);
+        void setInternalAddress(const QHostAddress &address);
+        /**
+         * @brief internalAddress
+         * @return IPv4 addresses are formatted on each call, others are returned as stored
+         */
+        QString internalAddress() const;
+        QHostAddress internalHostAddress() const;
+
+        /**
+         * @brief setRemoteHost
+         * @param address empty for any remote host, strings that are not an
+         * IP are kept verbatim and remoteHostAddress() returns a null address for them
+         */
+        void setRemoteHost(const QString &address);
+        void setRemoteHost(const QHostAddress &address);
+        QString remoteHost() const;
+        QHostAddress remoteHostAddress() const;
+
+        void setSockType(QAbstractSocket::SocketType sockType);
+        QAbstractSocket::SocketType sockType() const;
+
+        void setDescription(const QString &description);
+        QString description() const;
+
+        quint16 externalPort = 0;
+        quint16 internalPort = 0;
         int leaseDuration = 0;
-        QString remoteHost;
+        bool enabled = true;
+
+    private:
+        enum AddressKind : quint8 {
+            NoAddress,
+            IPv4Address,
+            // IPv6 or not an IP, kept in Extra
+            OtherAddress,
+        };
+        struct Extra;
+
+        void setAddress(bool remote, const QHostAddress &address, const QString &text);
+
+        quint32 m_internalIPv4 = 0;
+        quint32 m_remoteIPv4 = 0;
+        qint8 m_sockType = QAbstractSocket::TcpSocket;
+        quint8 m_internalKind = NoAddress;
+        quint8 m_remoteKind = NoAddress;
+        QString m_description;
+        QExplicitlySharedDataPointer<Extra> m_extra;
+    };
+
+    struct BatchResult {
+        PortMap portMap;
+        bool error = false;
+        QString errorCode;
+        QString errorString;
     };
 
     /**
@@ -77,6 +153,58 @@ public:
                           int leaseDuration = 0,
                           const QHostAddress &remoteHost = QHostAddress());
 
+    /**
+     * @brief addAnyPortMapping
+     *
+     * Like addPortMapping but the gateway may pick another external port
+     * if externalPort is taken. IGDv2 gateways do it with AddAnyPortMapping
+     * in one round trip. On IGDv1 a free port is picked from the mirror
+     * when it is enabled and synced, otherwise the table is enumerated once
+     * first. A port the gateway still reports as ConflictInMappingEntry is
+     * never sent again, up to 8 ports are tried.
+     * @param externalPort preferred external port, 0 for any
+     * @return quint16 with the external port actually mapped
+     */
+    TypedReply<quint16> *addAnyPortMapping(quint16 externalPort,
+                                           const QString &internalAddress,
+                                           quint16 internalPort,
+                                           QAbstractSocket::SocketType sockType,
+                                           const QString &description,
+                                           bool enabled = true,
+                                           int leaseDuration = 0,
+                                           const QString &remoteHost = QString());
+    TypedReply<quint16> *addAnyPortMapping(quint16 externalPort,
+                                           const QHostAddress &internalAddress,
+                                           quint16 internalPort,
+                                           QAbstractSocket::SocketType sockType,
+                                           const QString &description,
+                                           bool enabled = true,
+                                           int leaseDuration = 0,
+                                           const QHostAddress &remoteHost = QHostAddress());
+
+    /**
+     * @brief addPortMappings
+     *
+     * Adds all port maps keeping at most window requests in flight,
+     * which is friendlier to the gateway than issuing them all at once.
+     * @param portMaps
+     * @param window maximum number of concurrent requests
+     * @return std::vector<BatchResult> in the same order as portMaps, error
+     * is only set on each BatchResult
+     */
+    TypedReply<std::vector<BatchResult>> *addPortMappings(const std::vector<PortMap> &portMaps, int window = 4);
+
+    /**
+     * @brief deletePortMappings
+     *
+     * Deletes all port maps (matched by externalPort, sockType and remoteHost)
+     * keeping at most window requests in flight.
+     * @param portMaps
+     * @param window maximum number of concurrent requests
+     * @return std::vector<BatchResult> in the same order as portMaps
+     */
+    TypedReply<std::vector<BatchResult>> *deletePortMappings(const std::vector<PortMap> &portMaps, int window = 4);
+
     /**
      * @brief deletePortMapping
      * @param externalPort
@@ -102,9 +230,9 @@ public:
      * @param remoteHost format: "x.x.x.x"
      * @return PortMap
      */
-    Reply *getSpecificPortMappingEntry(quint16 externalPort,
-                                       QAbstractSocket::SocketType sockType,
-                                       const QString &remoteHost = QString());
+    TypedReply<PortMap> *getSpecificPortMappingEntry(quint16 externalPort,
+                                                     QAbstractSocket::SocketType sockType,
+                                                     const QString &remoteHost = QString());
 
     /**
      * @brief getSpecificPortMappingEntry Overload with QHostAddress
@@ -113,34 +241,116 @@ public:
      * @param remoteHost format: "x.x.x.x"
      * @return PortMap
      */
-    Reply *getSpecificPortMappingEntry(quint16 externalPort,
-                                       QAbstractSocket::SocketType sockType,
-                                       const QHostAddress &remoteHost);
+    TypedReply<PortMap> *getSpecificPortMappingEntry(quint16 externalPort,
+                                                     QAbstractSocket::SocketType sockType,
+                                                     const QHostAddress &remoteHost);
+
+    /**
+     * @brief getGenericPortMappingEntry
+     * @param index position of the entry in the gateway table
+     * @return PortMap, fails with SpecifiedArrayIndexInvalid (713) past the last entry
+     */
+    TypedReply<PortMap> *getGenericPortMappingEntry(int index);
 
     /**
      * @brief getGenericPortMapping
+     *
+     * Enumerates the whole table, on IGDv2 gateways with GetListOfPortMappings
+     * in pages, otherwise keeping window index requests in flight and
+     * stopping at the first SpecifiedArrayIndexInvalid.
+     * @param window maximum number of concurrent requests
      * @return std::vector<PortMap> with all port maps
      */
-    Reply *getGenericPortMapping();
+    TypedReply<std::vector<PortMap>> *getGenericPortMapping(int window = 4);
+
+    /**
+     * @brief getListOfPortMappings
+     *
+     * IGDv2 only (WANIPConnection:2), returns up to numberOfPorts entries
+     * of a port range in a single round trip.
+     * @param startPort
+     * @param endPort
+     * @param sockType
+     * @param manage true to list the mappings of all clients, not only ours
+     * @param numberOfPorts maximum number of entries, 0 means no limit
+     * @return std::vector<PortMap>, fails with PortMappingNotFound (730) when the range is empty
+     */
+    TypedReply<std::vector<PortMap>> *getListOfPortMappings(quint16 startPort,
+                                                            quint16 endPort,
+                                                            QAbstractSocket::SocketType sockType,
+                                                            bool manage = true,
+                                                            int numberOfPorts = 0);
 
     /**
      * @brief getStatusInfo
      * @return QVariantHash with parsed info
      */
-    Reply *getStatusInfo();
+    TypedReply<QVariantHash> *getStatusInfo();
 
     /**
      * @brief getExternalIp
      * @return QString with external IP
      */
-    Reply *getExternalIp();
+    TypedReply<QString> *getExternalIp();
+
+    /**
+     * @brief setMirrorEnabled
+     *
+     * Keeps a local copy of the port mapping table, filled by one enumeration
+     * and updated by the add, delete and query actions done through this service.
+     * @param enabled
+     * @param refreshInterval period of full revalidations in ms, 0 disables them
+     */
+    void setMirrorEnabled(bool enabled, int refreshInterval = 0);
+
+    /**
+     * @brief mirror
+     * @return the local table or nullptr if not enabled
+     */
+    PortMappingMirror *mirror() const;
+
+    /**
+     * @brief startMonitoring
+     *
+     * Watches ExternalIPAddress, ConnectionStatus and PortMappingNumberOfEntries,
+     * through a GENA subscription when the gateway supports eventing, otherwise
+     * by polling getExternalIp() and getStatusInfo(), backing off while nothing
+     * changes. While polling a new subscription is tried every maxPollInterval,
+     * polling stops once it succeeds. Changes are reported by the typed
+     * signals below, the mirror is revalidated when the number of entries
+     * doesn't match it anymore.
+     * @param minPollInterval polling interval in ms after a change
+     * @param maxPollInterval polling interval in ms after a long time without changes
+     */
+    void startMonitoring(int minPollInterval = 5000, int maxPollInterval = 300000);
+    void stopMonitoring();
+
+    /**
+     * @brief isPolling
+     * @return true if monitoring fell back to polling
+     */
+    bool isPolling() const;
+
+    QString externalIp() const;
+    QString connectionStatus() const;
+
+Q_SIGNALS:
+    void externalIpChanged(const QString &externalIp);
+    void connectionStatusChanged(const QString &connectionStatus);
+    void portMappingNumberOfEntriesChanged(int entries);
 
 private:
-    void getGenericPortMapping(Reply *ret, int index = 0, const std::vector<PortMap> &portMaps = std::vector<PortMap>());
+    bool updateStateVariable(const QString &name, const QString &value);
+    void startPolling();
+    void poll();
+    void resubscribe();
+
+    WanConnectionServicePrivate *d_ptr;
 };
 
 }
 
 Q_DECLARE_METATYPE(UpnpQt::WanConnectionService::PortMap)
+Q_DECLARE_METATYPE(UpnpQt::WanConnectionService::BatchResult)
 
 #endif // WANCONNECTIONSERVICE_H
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "wanipv6firewallcontrolservice.h"
+#include "soapenvelope.h"
+#include "reply.h"
+
+#include <QNetworkReply>
+#include <QXmlStreamReader>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_FIREWALL, "upnpqt.firewall", QtInfoMsg)
+
+using namespace UpnpQt;
+
+namespace {
+
+QString protocolNumber(QAbstractSocket::SocketType sockType)
+{
+    // IANA protocol numbers, 65535 is the wildcard
+    switch (sockType) {
+    case QAbstractSocket::TcpSocket:
+        return QStringLiteral("6");
+    case QAbstractSocket::UdpSocket:
+        return QStringLiteral("17");
+    default:
+        return QStringLiteral("65535");
+    }
+}
+
+void writePinhole(SoapEnvelope &envelope, const WanIpv6FirewallControlService::Pinhole &pinhole)
+{
+    envelope.writeTextElement(QStringLiteral("RemoteHost"), pinhole.remoteHost.isNull() ? QString() : pinhole.remoteHost.toString());
+    envelope.writeTextElement(QStringLiteral("RemotePort"), QString::number(pinhole.remotePort));
+    envelope.writeTextElement(QStringLiteral("InternalClient"), pinhole.internalClient.toString());
+    envelope.writeTextElement(QStringLiteral("InternalPort"), QString::number(pinhole.internalPort));
+    envelope.writeTextElement(QStringLiteral("Protocol"), protocolNumber(pinhole.sockType));
+}
+
+QString responseValue(const QByteArray &data, QLatin1String name)
+{
+    QXmlStreamReader xml(data);
+    while (!xml.atEnd()) {
+        if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == name) {
+            return xml.readElementText();
+        }
+    }
+    return QString();
+}
+
+}
+
+WanIpv6FirewallControlService::WanIpv6FirewallControlService(ServicePrivate *priv, QObject *parent)
+    : Service(priv, parent)
+{
+
+}
+
+TypedReply<WanIpv6FirewallControlService::FirewallStatus> *WanIpv6FirewallControlService::getFirewallStatus()
+{
+    auto ret = new TypedReply<FirewallStatus>(this);
+    qCDebug(UPNPQT_FIREWALL) << "getFirewallStatus";
+
+    SoapEnvelope envelope(QStringLiteral("GetFirewallStatus"), type());
+
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_FIREWALL) << "getFirewallStatus downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+        } else {
+            FirewallStatus status;
+            status.firewallEnabled = responseValue(data, QLatin1String("FirewallEnabled")) == QLatin1String("1");
+            status.inboundPinholeAllowed = responseValue(data, QLatin1String("InboundPinholeAllowed")) == QLatin1String("1");
+            ret->finishWithResult(status);
+        }
+    });
+    return ret;
+}
+
+TypedReply<int> *WanIpv6FirewallControlService::getOutboundPinholeTimeout(const Pinhole &pinhole)
+{
+    auto ret = new TypedReply<int>(this);
+    qCDebug(UPNPQT_FIREWALL) << "getOutboundPinholeTimeout" << pinhole.internalClient << pinhole.internalPort;
+
+    SoapEnvelope envelope(QStringLiteral("GetOutboundPinholeTimeout"), type());
+    writePinhole(envelope, pinhole);
+
+    callAction(envelope, ReadOnlyAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_FIREWALL) << "getOutboundPinholeTimeout downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+        } else {
+            ret->finishWithResult(responseValue(data, QLatin1String("OutboundPinholeTimeout")).toInt());
+        }
+    });
+    return ret;
+}
+
+TypedReply<quint16> *WanIpv6FirewallControlService::addPinhole(const Pinhole &pinhole)
+{
+    auto ret = new TypedReply<quint16>(this);
+    qCDebug(UPNPQT_FIREWALL) << "addPinhole" << pinhole.internalClient << pinhole.internalPort << pinhole.sockType << pinhole.remoteHost;
+
+    SoapEnvelope envelope(QStringLiteral("AddPinhole"), type());
+    writePinhole(envelope, pinhole);
+    envelope.writeTextElement(QStringLiteral("LeaseTime"), QString::number(qBound(1, pinhole.leaseTime, 86400)));
+
+    callAction(envelope, NonIdempotentAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_FIREWALL) << "addPinhole downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+        } else {
+            ret->finishWithResult(quint16(responseValue(data, QLatin1String("UniqueID")).toUInt()));
+        }
+    });
+    return ret;
+}
+
+Reply *WanIpv6FirewallControlService::updatePinhole(quint16 uniqueId, int leaseTime)
+{
+    auto ret = new Reply(this);
+    qCDebug(UPNPQT_FIREWALL) << "updatePinhole" << uniqueId << leaseTime;
+
+    SoapEnvelope envelope(QStringLiteral("UpdatePinhole"), type());
+    envelope.writeTextElement(QStringLiteral("UniqueID"), QString::number(uniqueId));
+    envelope.writeTextElement(QStringLiteral("NewLeaseTime"), QString::number(qBound(1, leaseTime, 86400)));
+
+    callAction(envelope, IdempotentAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_FIREWALL) << "updatePinhole downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+        } else {
+            ret->finish();
+        }
+    });
+    return ret;
+}
+
+Reply *WanIpv6FirewallControlService::deletePinhole(quint16 uniqueId)
+{
+    auto ret = new Reply(this);
+    qCDebug(UPNPQT_FIREWALL) << "deletePinhole" << uniqueId;
+
+    SoapEnvelope envelope(QStringLiteral("DeletePinhole"), type());
+    envelope.writeTextElement(QStringLiteral("UniqueID"), QString::number(uniqueId));
+
+    callAction(envelope, IdempotentAction, [=] (QNetworkReply *reply, const QByteArray &data, const std::pair<QString, QString> &error) {
+        qCDebug(UPNPQT_FIREWALL) << "deletePinhole downloaded XML" << reply->error() << data.constData();
+        if (reply->error()) {
+            ret->finishWithError(error.second, error.first);
+        } else {
+            ret->finish();
+        }
+    });
+    return ret;
+}
+
+#include "moc_wanipv6firewallcontrolservice.cpp"
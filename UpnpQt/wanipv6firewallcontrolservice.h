@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef WANIPV6FIREWALLCONTROLSERVICE_H
+#define WANIPV6FIREWALLCONTROLSERVICE_H
+
+#include <QObject>
+#include <QAbstractSocket>
+#include <QHostAddress>
+
+#include <UpnpQt/global.h>
+#include <UpnpQt/service.h>
+#include <UpnpQt/reply.h>
+
+namespace UpnpQt {
+
+/**
+ * WANIPv6FirewallControl:1, opens inbound pinholes to IPv6 hosts
+ * behind the gateway, where there is no NAT to map ports on.
+ */
+class UPNPQT_LIBRARY WanIpv6FirewallControlService : public Service
+{
+    Q_OBJECT
+public:
+    explicit WanIpv6FirewallControlService(ServicePrivate *priv, QObject *parent = nullptr);
+
+    struct Pinhole {
+        /** null for any remote host */
+        QHostAddress remoteHost;
+        /** 0 for any remote port */
+        quint16 remotePort = 0;
+        QHostAddress internalClient;
+        /** 0 for any internal port, if the gateway allows it */
+        quint16 internalPort = 0;
+        /** UnknownSocketType for any protocol */
+        QAbstractSocket::SocketType sockType = QAbstractSocket::TcpSocket;
+        /** seconds, from 1 to 86400 */
+        int leaseTime = 3600;
+        /** assigned by the gateway on addPinhole() */
+        quint16 uniqueId = 0;
+    };
+
+    struct FirewallStatus {
+        bool firewallEnabled = false;
+        bool inboundPinholeAllowed = false;
+    };
+
+    TypedReply<FirewallStatus> *getFirewallStatus();
+
+    /**
+     * @brief getOutboundPinholeTimeout
+     * @return seconds an outbound flow stays open without traffic
+     */
+    TypedReply<int> *getOutboundPinholeTimeout(const Pinhole &pinhole);
+
+    /**
+     * @brief addPinhole
+     * @return the UniqueID identifying the pinhole in the other actions
+     */
+    TypedReply<quint16> *addPinhole(const Pinhole &pinhole);
+
+    /**
+     * @brief updatePinhole extends the lease of a pinhole
+     * @param leaseTime in seconds, from 1 to 86400
+     * @return fails with NoSuchEntry (704) when the pinhole expired
+     */
+    Reply *updatePinhole(quint16 uniqueId, int leaseTime);
+    Reply *deletePinhole(quint16 uniqueId);
+};
+
+}
+
+Q_DECLARE_METATYPE(UpnpQt::WanIpv6FirewallControlService::Pinhole)
+Q_DECLARE_METATYPE(UpnpQt::WanIpv6FirewallControlService::FirewallStatus)
+
+#endif // WANIPV6FIREWALLCONTROLSERVICE_H
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_TESTHELPERS_H
+#define UPNPQT_TESTHELPERS_H
+
+#include <UpnpQt/discover.h>
+#include <UpnpQt/device.h>
+#include <UpnpQt/internetgatewaydevice.h>
+#include <UpnpQt/reply.h>
+
+#include "igdemulator.h"
+
+#include <QSignalSpy>
+#include <QtTest>
+
+namespace UpnpQt {
+
+/**
+ * Discovers emulator by its description URL, the device is owned by discover.
+ * @return nullptr if it wasn't discovered within timeout
+ */
+inline InternetGatewayDevice *discoverEmulator(Discover *discover, IgdEmulator *emulator, int timeout = 5000)
+{
+    InternetGatewayDevice *igd = nullptr;
+    const QMetaObject::Connection connection = QObject::connect(discover, &Discover::discovered, [&igd] (Device *device) {
+        if (!igd) {
+            igd = qobject_cast<InternetGatewayDevice *>(device);
+        }
+    });
+    discover->discoverLocation(emulator->location());
+    QTest::qWaitFor([&igd] { return igd != nullptr; }, timeout);
+    QObject::disconnect(connection);
+    return igd;
+}
+
+/**
+ * Waits for reply to finish, it's kept alive so its result can be read,
+ * the caller deletes it.
+ */
+inline bool waitForReply(Reply *reply, int timeout = 5000)
+{
+    reply->setAutoDelete(false);
+    QSignalSpy finished(reply, &Reply::finished);
+    return finished.wait(timeout);
+}
+
+}
+
+#endif // UPNPQT_TESTHELPERS_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "testhelpers.h"
+
+#include <UpnpQt/mappingregistry.h>
+
+using namespace UpnpQt;
+
+class TestMappingRegistry : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void renew();
+    void destroyedWhileRenewing();
+    void migrate();
+    void orphanLost();
+
+private:
+    InternetGatewayDevice *startGateway(IgdEmulator **emulator);
+    static bool hasPort(IgdEmulator *emulator, quint16 port);
+    static WanConnectionService::PortMap portMap(quint16 port);
+
+    Discover *m_discover = nullptr;
+    MappingRegistry *m_registry = nullptr;
+    std::vector<IgdEmulator *> m_emulators;
+};
+
+void TestMappingRegistry::init()
+{
+    qRegisterMetaType<WanConnectionService::PortMap>();
+    m_discover = new Discover;
+    m_registry = new MappingRegistry;
+    m_registry->setJitter(0);
+    m_registry->setCoalesceInterval(100);
+}
+
+void TestMappingRegistry::cleanup()
+{
+    delete m_registry;
+    delete m_discover;
+    qDeleteAll(m_emulators);
+    m_emulators.clear();
+}
+
+InternetGatewayDevice *TestMappingRegistry::startGateway(IgdEmulator **emulator)
+{
+    auto igd = new IgdEmulator;
+    m_emulators.push_back(igd);
+    if (!igd->start()) {
+        return nullptr;
+    }
+    *emulator = igd;
+    return discoverEmulator(m_discover, igd);
+}
+
+bool TestMappingRegistry::hasPort(IgdEmulator *emulator, quint16 port)
+{
+    for (const WanConnectionService::PortMap &portMap : emulator->portMaps()) {
+        if (portMap.externalPort == port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+WanConnectionService::PortMap TestMappingRegistry::portMap(quint16 port)
+{
+    // a 2s lease is renewed every second
+    return WanConnectionService::PortMap(port, QStringLiteral("192.168.1.50"), port, QAbstractSocket::TcpSocket,
+                                         QStringLiteral("registry"), true, 2);
+}
+
+void TestMappingRegistry::renew()
+{
+    IgdEmulator *emulator = nullptr;
+    InternetGatewayDevice *igd = startGateway(&emulator);
+    QVERIFY(igd);
+
+    QSignalSpy renewed(m_registry, &MappingRegistry::renewed);
+    QSignalSpy lost(m_registry, &MappingRegistry::lost);
+    const quint64 id = m_registry->add(igd->wanIpOrPppConnectionService(), portMap(31000));
+
+    // added, then renewed twice
+    QTRY_VERIFY_WITH_TIMEOUT(renewed.count() >= 3, 5000);
+    QCOMPARE(lost.count(), 0);
+    QCOMPARE(renewed.first().first().toULongLong(), id);
+    QVERIFY(hasPort(emulator, 31000));
+
+    m_registry->remove(id);
+    QVERIFY(!m_registry->contains(id));
+    QTRY_VERIFY(!hasPort(emulator, 31000));
+}
+
+void TestMappingRegistry::destroyedWhileRenewing()
+{
+    IgdEmulator *first = nullptr;
+    IgdEmulator *second = nullptr;
+    InternetGatewayDevice *from = startGateway(&first);
+    InternetGatewayDevice *to = startGateway(&second);
+    QVERIFY(from);
+    QVERIFY(to);
+
+    QSignalSpy renewed(m_registry, &MappingRegistry::renewed);
+    const quint64 id = m_registry->add(from->wanIpOrPppConnectionService(), portMap(31001));
+    QTRY_COMPARE(renewed.count(), 1);
+
+    // the renewal is sent but never answered before the gateway goes away
+    QSignalSpy actions(first, &IgdEmulator::actionReceived);
+    first->setLatency(60000);
+    QTRY_VERIFY_WITH_TIMEOUT(actions.count() >= 1, 3000);
+    delete from;
+
+    // the mapping waits for another gateway instead of staying in flight
+    QVERIFY(m_registry->contains(id));
+    QCOMPARE(m_registry->migrate(nullptr, to->wanIpOrPppConnectionService()), 1);
+    QTRY_COMPARE(renewed.count(), 2);
+    QCOMPARE(renewed.last().first().toULongLong(), id);
+    QVERIFY(hasPort(second, 31001));
+}
+
+void TestMappingRegistry::migrate()
+{
+    IgdEmulator *first = nullptr;
+    IgdEmulator *second = nullptr;
+    InternetGatewayDevice *from = startGateway(&first);
+    InternetGatewayDevice *to = startGateway(&second);
+    QVERIFY(from);
+    QVERIFY(to);
+
+    QSignalSpy renewed(m_registry, &MappingRegistry::renewed);
+    const quint64 id = m_registry->add(from->wanIpOrPppConnectionService(), portMap(31002));
+    QTRY_COMPARE(renewed.count(), 1);
+
+    QCOMPARE(m_registry->migrate(from->wanIpOrPppConnectionService(), to->wanIpOrPppConnectionService()), 1);
+    QTRY_COMPARE(renewed.count(), 2);
+    QVERIFY(hasPort(second, 31002));
+    QCOMPARE(int(m_registry->portMaps(to->wanIpOrPppConnectionService()).size()), 1);
+    QVERIFY(m_registry->portMaps(from->wanIpOrPppConnectionService()).empty());
+
+    // renewed on the new gateway from then on
+    QSignalSpy actions(first, &IgdEmulator::actionReceived);
+    QTRY_VERIFY_WITH_TIMEOUT(renewed.count() >= 3, 5000);
+    QCOMPARE(actions.count(), 0);
+    QVERIFY(m_registry->contains(id));
+}
+
+void TestMappingRegistry::orphanLost()
+{
+    IgdEmulator *emulator = nullptr;
+    InternetGatewayDevice *igd = startGateway(&emulator);
+    QVERIFY(igd);
+
+    m_registry->setOrphanGracePeriod(300);
+    QSignalSpy renewed(m_registry, &MappingRegistry::renewed);
+    QSignalSpy lost(m_registry, &MappingRegistry::lost);
+    const quint64 id = m_registry->add(igd->wanIpOrPppConnectionService(), portMap(31003));
+    QTRY_COMPARE(renewed.count(), 1);
+
+    // no gateway adopts it within the grace period
+    delete igd;
+    QVERIFY(m_registry->contains(id));
+    QTRY_COMPARE_WITH_TIMEOUT(lost.count(), 1, 3000);
+    QCOMPARE(lost.first().first().toULongLong(), id);
+    QVERIFY(!m_registry->contains(id));
+}
+
+QTEST_GUILESS_MAIN(TestMappingRegistry)
+
+#include "testmappingregistry.moc"
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "testhelpers.h"
+#include "daemonprotocol.h"
+
+#include <UpnpQt/wanconnectionservice.h>
+
+#include <QBuffer>
+
+using namespace UpnpQt;
+
+class TestPortMap : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void addresses_data();
+    void addresses();
+    void hostAddresses();
+    void daemonStream();
+    void gatewayRoundTrip_data();
+    void gatewayRoundTrip();
+    void remoteHostIsNotWildcard();
+
+private:
+    IgdEmulator *m_emulator = nullptr;
+    Discover *m_discover = nullptr;
+    WanConnectionService *m_service = nullptr;
+};
+
+void TestPortMap::initTestCase()
+{
+    m_emulator = new IgdEmulator(this);
+    QVERIFY(m_emulator->start());
+    m_discover = new Discover(this);
+
+    InternetGatewayDevice *igd = discoverEmulator(m_discover, m_emulator);
+    QVERIFY(igd);
+    m_service = igd->wanIpOrPppConnectionService();
+    QVERIFY(m_service);
+}
+
+void TestPortMap::cleanupTestCase()
+{
+    delete m_discover;
+    delete m_emulator;
+}
+
+void TestPortMap::addresses_data()
+{
+    QTest::addColumn<QString>("address");
+    QTest::addColumn<QString>("expected");
+    QTest::addColumn<bool>("isAddress");
+
+    QTest::newRow("wildcard") << QString() << QString() << false;
+    QTest::newRow("ipv4") << QStringLiteral("192.168.1.10") << QStringLiteral("192.168.1.10") << true;
+    QTest::newRow("ipv6") << QStringLiteral("2001:db8::1") << QStringLiteral("2001:db8::1") << true;
+    QTest::newRow("ipv6 scope id") << QStringLiteral("fe80::1%eth0") << QStringLiteral("fe80::1%eth0") << true;
+    QTest::newRow("ipv6 long form") << QStringLiteral("2001:0db8:0000:0000:0000:0000:0000:0001") << QStringLiteral("2001:db8::1") << true;
+    QTest::newRow("host name") << QStringLiteral("router.lan") << QStringLiteral("router.lan") << false;
+    QTest::newRow("invalid") << QStringLiteral("192.168.1.300") << QStringLiteral("192.168.1.300") << false;
+}
+
+void TestPortMap::addresses()
+{
+    QFETCH(QString, address);
+    QFETCH(QString, expected);
+    QFETCH(bool, isAddress);
+
+    WanConnectionService::PortMap portMap;
+    portMap.setInternalAddress(address);
+    portMap.setRemoteHost(address);
+
+    // strings that are not an IP are kept, never turned into the wildcard
+    QCOMPARE(portMap.internalAddress(), expected);
+    QCOMPARE(portMap.remoteHost(), expected);
+    QCOMPARE(!portMap.internalHostAddress().isNull(), isAddress);
+    QCOMPARE(!portMap.remoteHostAddress().isNull(), isAddress);
+    if (isAddress) {
+        QCOMPARE(portMap.remoteHostAddress(), QHostAddress(address));
+    }
+
+    const WanConnectionService::PortMap copy = portMap;
+    QCOMPARE(copy.internalAddress(), expected);
+    QCOMPARE(copy.remoteHost(), expected);
+}
+
+void TestPortMap::hostAddresses()
+{
+    QHostAddress scoped(QStringLiteral("fe80::2"));
+    scoped.setScopeId(QStringLiteral("eth1"));
+
+    WanConnectionService::PortMap portMap;
+    portMap.setInternalAddress(scoped);
+    QCOMPARE(portMap.internalHostAddress(), scoped);
+    QCOMPARE(portMap.internalHostAddress().scopeId(), QStringLiteral("eth1"));
+
+    portMap.setRemoteHost(QHostAddress(QStringLiteral("198.51.100.7")));
+    QCOMPARE(portMap.remoteHost(), QStringLiteral("198.51.100.7"));
+
+    portMap.setRemoteHost(QHostAddress());
+    QVERIFY(portMap.remoteHost().isEmpty());
+}
+
+void TestPortMap::daemonStream()
+{
+    const WanConnectionService::PortMap portMap(4242, QStringLiteral("fe80::1%eth0"), 42, QAbstractSocket::UdpSocket,
+                                                QStringLiteral("stream"), false, 3600, QStringLiteral("router.lan"));
+
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(DaemonProtocol::StreamVersion);
+        out << portMap;
+    }
+
+    WanConnectionService::PortMap read;
+    QDataStream in(data);
+    in.setVersion(DaemonProtocol::StreamVersion);
+    in >> read;
+
+    QCOMPARE(in.status(), QDataStream::Ok);
+    QCOMPARE(read.externalPort, portMap.externalPort);
+    QCOMPARE(read.internalPort, portMap.internalPort);
+    QCOMPARE(read.leaseDuration, portMap.leaseDuration);
+    QCOMPARE(read.enabled, portMap.enabled);
+    QCOMPARE(read.sockType(), portMap.sockType());
+    QCOMPARE(read.internalAddress(), portMap.internalAddress());
+    QCOMPARE(read.internalHostAddress(), portMap.internalHostAddress());
+    QCOMPARE(read.remoteHost(), portMap.remoteHost());
+    QCOMPARE(read.description(), portMap.description());
+}
+
+void TestPortMap::gatewayRoundTrip_data()
+{
+    QTest::addColumn<quint16>("port");
+    QTest::addColumn<QString>("internalClient");
+    QTest::addColumn<QString>("remoteHost");
+
+    QTest::newRow("wildcard") << quint16(20000) << QStringLiteral("192.168.1.30") << QString();
+    QTest::newRow("remote host") << quint16(20001) << QStringLiteral("192.168.1.31") << QStringLiteral("198.51.100.7");
+}
+
+void TestPortMap::gatewayRoundTrip()
+{
+    QFETCH(quint16, port);
+    QFETCH(QString, internalClient);
+    QFETCH(QString, remoteHost);
+
+    Reply *add = m_service->addPortMapping(port, internalClient, 80, QAbstractSocket::TcpSocket,
+                                           QStringLiteral("round trip"), true, 3600, remoteHost);
+    QVERIFY(waitForReply(add));
+    QVERIFY2(!add->error(), qPrintable(add->errorString()));
+    delete add;
+
+    auto get = m_service->getSpecificPortMappingEntry(port, QAbstractSocket::TcpSocket, remoteHost);
+    QVERIFY(waitForReply(get));
+    QVERIFY2(!get->error(), qPrintable(get->errorString()));
+    const WanConnectionService::PortMap portMap = get->result();
+    delete get;
+
+    QCOMPARE(portMap.internalAddress(), internalClient);
+    QCOMPARE(portMap.internalHostAddress(), QHostAddress(internalClient));
+    QCOMPARE(portMap.internalPort, quint16(80));
+    QCOMPARE(portMap.description(), QStringLiteral("round trip"));
+    QVERIFY(portMap.enabled);
+
+    bool found = false;
+    for (const WanConnectionService::PortMap &stored : m_emulator->portMaps()) {
+        if (stored.externalPort == port) {
+            QCOMPARE(stored.remoteHost(), remoteHost);
+            QCOMPARE(stored.internalAddress(), internalClient);
+            found = true;
+        }
+    }
+    QVERIFY(found);
+}
+
+void TestPortMap::remoteHostIsNotWildcard()
+{
+    const quint16 port = 20100;
+    Reply *add = m_service->addPortMapping(port, QStringLiteral("192.168.1.32"), 80, QAbstractSocket::TcpSocket,
+                                           QStringLiteral("single remote"), true, 3600, QStringLiteral("198.51.100.8"));
+    QVERIFY(waitForReply(add));
+    QVERIFY2(!add->error(), qPrintable(add->errorString()));
+    delete add;
+
+    // a mapping for one remote host is not the wildcard one
+    auto get = m_service->getSpecificPortMappingEntry(port, QAbstractSocket::TcpSocket);
+    QVERIFY(waitForReply(get));
+    QVERIFY(get->error());
+    QCOMPARE(get->upnpError(), Reply::NoSuchEntryInArray);
+    delete get;
+
+    Reply *del = m_service->deletePortMapping(port, QAbstractSocket::TcpSocket, QHostAddress(QStringLiteral("198.51.100.8")));
+    QVERIFY(waitForReply(del));
+    QVERIFY2(!del->error(), qPrintable(del->errorString()));
+    delete del;
+}
+
+QTEST_GUILESS_MAIN(TestPortMap)
+
+#include "testportmap.moc"
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "testhelpers.h"
+
+#include <UpnpQt/portmappingenumerator.h>
+
+#include <set>
+
+using namespace UpnpQt;
+
+class TestPortMappingEnumerator : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void cleanup();
+
+    void pageSharedLastPort();
+    void pageBothProtocols();
+    void pageCappedByGateway();
+    void indexWalk();
+    void internalClientFilter();
+
+private:
+    bool startGateway(int version);
+    bool enumerate(PortMappingEnumerator *enumerator, std::vector<WanConnectionService::PortMap> &entries);
+    static std::set<QString> keys(const std::vector<WanConnectionService::PortMap> &portMaps);
+
+    IgdEmulator *m_emulator = nullptr;
+    Discover *m_discover = nullptr;
+    WanConnectionService *m_service = nullptr;
+};
+
+void TestPortMappingEnumerator::cleanup()
+{
+    delete m_discover;
+    delete m_emulator;
+    m_discover = nullptr;
+    m_emulator = nullptr;
+    m_service = nullptr;
+}
+
+bool TestPortMappingEnumerator::startGateway(int version)
+{
+    m_emulator = new IgdEmulator;
+    m_emulator->setVersion(version);
+    if (!m_emulator->start()) {
+        return false;
+    }
+
+    m_discover = new Discover;
+    InternetGatewayDevice *igd = discoverEmulator(m_discover, m_emulator);
+    m_service = igd ? igd->wanIpOrPppConnectionService() : nullptr;
+    return m_service != nullptr;
+}
+
+bool TestPortMappingEnumerator::enumerate(PortMappingEnumerator *enumerator, std::vector<WanConnectionService::PortMap> &entries)
+{
+    connect(enumerator, &PortMappingEnumerator::entry, this, [&entries] (const WanConnectionService::PortMap &portMap) {
+        entries.push_back(portMap);
+    });
+    QSignalSpy finished(enumerator, &PortMappingEnumerator::finished);
+    enumerator->start();
+    return finished.wait(10000) && !enumerator->error();
+}
+
+std::set<QString> TestPortMappingEnumerator::keys(const std::vector<WanConnectionService::PortMap> &portMaps)
+{
+    std::set<QString> ret;
+    for (const WanConnectionService::PortMap &portMap : portMaps) {
+        const QString key = QString::number(int(portMap.sockType())) % QLatin1Char('/') %
+                QString::number(portMap.externalPort) % QLatin1Char('/') % portMap.remoteHost();
+        ret.insert(key);
+    }
+    return ret;
+}
+
+void TestPortMappingEnumerator::pageSharedLastPort()
+{
+    QVERIFY(startGateway(2));
+
+    // 4998, 4999 and 5000 for any remote host, then two more on 5000
+    // for single remote hosts that don't fit in the first page
+    m_emulator->populate(3, 4998);
+    QVERIFY(m_emulator->addPortMap(WanConnectionService::PortMap(5000, QStringLiteral("192.168.1.20"), 5000, QAbstractSocket::TcpSocket,
+                                                                 QStringLiteral("remote-a"), true, 0, QStringLiteral("198.51.100.1"))));
+    QVERIFY(m_emulator->addPortMap(WanConnectionService::PortMap(5000, QStringLiteral("192.168.1.21"), 5000, QAbstractSocket::TcpSocket,
+                                                                 QStringLiteral("remote-b"), true, 0, QStringLiteral("198.51.100.2"))));
+
+    PortMappingEnumerator enumerator(m_service);
+    enumerator.setPageSize(4);
+
+    std::vector<WanConnectionService::PortMap> entries;
+    QVERIFY(enumerate(&enumerator, entries));
+    QCOMPARE(int(entries.size()), 5);
+    QCOMPARE(keys(entries), keys(m_emulator->portMaps()));
+}
+
+void TestPortMappingEnumerator::pageBothProtocols()
+{
+    QVERIFY(startGateway(2));
+
+    m_emulator->populate(10, 7000);
+    for (quint16 port = 6000; port < 6003; ++port) {
+        QVERIFY(m_emulator->addPortMap(WanConnectionService::PortMap(port, QStringLiteral("192.168.1.40"), port, QAbstractSocket::UdpSocket,
+                                                                     QStringLiteral("udp"))));
+    }
+
+    PortMappingEnumerator enumerator(m_service);
+    enumerator.setPageSize(4);
+
+    std::vector<WanConnectionService::PortMap> entries;
+    QVERIFY(enumerate(&enumerator, entries));
+    QCOMPARE(int(entries.size()), 13);
+    QCOMPARE(keys(entries), keys(m_emulator->portMaps()));
+}
+
+void TestPortMappingEnumerator::pageCappedByGateway()
+{
+    QVERIFY(startGateway(2));
+
+    // the gateway answers 5 entries at most whatever the page size asked
+    m_emulator->setMaxPageSize(5);
+    m_emulator->populate(23, 3000);
+    QVERIFY(m_emulator->addPortMap(WanConnectionService::PortMap(3004, QStringLiteral("192.168.1.30"), 3004, QAbstractSocket::TcpSocket,
+                                                                 QStringLiteral("remote"), true, 0, QStringLiteral("198.51.100.3"))));
+
+    PortMappingEnumerator enumerator(m_service);
+    enumerator.setPageSize(100);
+
+    std::vector<WanConnectionService::PortMap> entries;
+    QVERIFY(enumerate(&enumerator, entries));
+    QCOMPARE(int(entries.size()), 24);
+    QCOMPARE(keys(entries), keys(m_emulator->portMaps()));
+}
+
+void TestPortMappingEnumerator::indexWalk()
+{
+    // IGDv1 has no GetListOfPortMappings, entries come in table order
+    QVERIFY(startGateway(1));
+    m_emulator->populate(7, 8000);
+
+    PortMappingEnumerator enumerator(m_service);
+    enumerator.setWindow(3);
+
+    std::vector<WanConnectionService::PortMap> entries;
+    QVERIFY(enumerate(&enumerator, entries));
+
+    const std::vector<WanConnectionService::PortMap> table = m_emulator->portMaps();
+    QCOMPARE(entries.size(), table.size());
+    for (size_t i = 0; i < table.size(); ++i) {
+        QCOMPARE(entries[i].externalPort, table[i].externalPort);
+    }
+}
+
+void TestPortMappingEnumerator::internalClientFilter()
+{
+    QVERIFY(startGateway(2));
+    m_emulator->populate(5, 9000);
+
+    // populate() maps the first port to 192.168.1.2, given IPv4-mapped here
+    PortMappingEnumerator enumerator(m_service);
+    enumerator.setInternalClient(QStringLiteral("::ffff:192.168.1.2"));
+
+    std::vector<WanConnectionService::PortMap> entries;
+    QVERIFY(enumerate(&enumerator, entries));
+    QCOMPARE(int(entries.size()), 1);
+    QCOMPARE(entries.front().externalPort, quint16(9000));
+}
+
+QTEST_GUILESS_MAIN(TestPortMappingEnumerator)
+
+#include "testportmappingenumerator.moc"
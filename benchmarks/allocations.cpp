@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "allocations.h"
+
+#include <QDebug>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<quint64> s_allocations(0);
+
+#if defined(__GLIBC__)
+
+// QString and QByteArray allocate with malloc, so count at that level,
+// operator new ends up here too
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+}
+
+#else
+
+// elsewhere only operator new is counted, Qt containers are missed
+void *operator new(std::size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+#endif
+
+AllocationCounter::AllocationCounter()
+    : m_start(allocations())
+{
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    const quint64 count = allocations() - m_start;
+    qInfo("allocations: %.1f per iteration (%llu in %llu iterations)",
+          m_iterations ? double(count) / m_iterations : 0.0,
+          static_cast<unsigned long long>(count), static_cast<unsigned long long>(m_iterations));
+}
+
+quint64 AllocationCounter::allocations()
+{
+    return s_allocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_ALLOCATIONS_H
+#define UPNPQT_ALLOCATIONS_H
+
+#include <QtGlobal>
+
+/**
+ * Counts heap allocations of the whole process, QBENCHMARK only
+ * reports time so each benchmark prints allocations per iteration next
+ * to it. On glibc malloc, calloc and realloc are interposed, which also
+ * covers operator new and Qt containers. Elsewhere only operator new is
+ * counted and QString or QByteArray allocations are missed.
+ */
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+
+    inline void iteration() { ++m_iterations; }
+
+    static quint64 allocations();
+
+private:
+    quint64 m_start;
+    quint64 m_iterations = 0;
+};
+
+#endif // UPNPQT_ALLOCATIONS_H
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "allocations.h"
+
+#include <UpnpQt/discover.h>
+#include <UpnpQt/device.h>
+#include <UpnpQt/service.h>
+
+#include "soapenvelope.h"
+#include "wanconnectionresponse.h"
+
+#include <QFile>
+#include <QNetworkRequest>
+#include <QUrl>
+#include <QtTest>
+
+using namespace UpnpQt;
+
+class BenchParsing : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+
+    void fromXml_data();
+    void fromXml();
+
+    void soapEnvelope();
+    void responseError();
+
+    void addAnyPortMappingResponse();
+    void specificPortMappingEntryResponse();
+    void genericPortMappingEntryResponse();
+    void listOfPortMappingsResponse_data();
+    void listOfPortMappingsResponse();
+    void statusInfoResponse();
+    void externalIpResponse();
+
+private:
+    Discover *m_discover = nullptr;
+};
+
+namespace {
+
+QByteArray corpus(const char *name)
+{
+    QFile file(QLatin1String(UPNPQT_CORPUS_DIR "/") + QLatin1String(name));
+    if (!file.open(QFile::ReadOnly)) {
+        qFatal("Missing corpus file %s", name);
+    }
+    return file.readAll();
+}
+
+QByteArray soapResponse(const char *action, const QByteArray &arguments)
+{
+    QByteArray ret;
+    ret.append("<?xml version=\"1.0\"?>\r\n"
+               "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+               "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">\r\n"
+               "<s:Body>\r\n<u:")
+            .append(action)
+            .append("Response xmlns:u=\"urn:schemas-upnp-org:service:WANIPConnection:2\">\r\n")
+            .append(arguments)
+            .append("</u:")
+            .append(action)
+            .append("Response>\r\n</s:Body>\r\n</s:Envelope>\r\n");
+    return ret;
+}
+
+QByteArray portMappingArguments(int port)
+{
+    QByteArray ret;
+    ret.append("<NewRemoteHost></NewRemoteHost>\r\n<NewExternalPort>")
+            .append(QByteArray::number(port))
+            .append("</NewExternalPort>\r\n<NewProtocol>TCP</NewProtocol>\r\n<NewInternalPort>")
+            .append(QByteArray::number(port))
+            .append("</NewInternalPort>\r\n<NewInternalClient>192.168.1.10</NewInternalClient>\r\n"
+                    "<NewEnabled>1</NewEnabled>\r\n<NewPortMappingDescription>Benchmark ")
+            .append(QByteArray::number(port))
+            .append("</NewPortMappingDescription>\r\n<NewLeaseDuration>3600</NewLeaseDuration>\r\n");
+    return ret;
+}
+
+QByteArray portListing(int entries)
+{
+    // the listing is escaped inside NewPortListing
+    QByteArray listing("&lt;?xml version=&quot;1.0&quot; encoding=&quot;UTF-8&quot;?&gt;"
+                       "&lt;p:PortMappingList xmlns:p=&quot;urn:schemas-upnp-org:gw:WANIPConnection&quot;&gt;");
+    for (int i = 0; i < entries; ++i) {
+        const QByteArray port = QByteArray::number(10000 + i);
+        listing.append("&lt;p:PortMappingEntry&gt;"
+                       "&lt;p:NewRemoteHost&gt;&lt;/p:NewRemoteHost&gt;"
+                       "&lt;p:NewExternalPort&gt;").append(port).append("&lt;/p:NewExternalPort&gt;"
+                       "&lt;p:NewProtocol&gt;UDP&lt;/p:NewProtocol&gt;"
+                       "&lt;p:NewInternalPort&gt;").append(port).append("&lt;/p:NewInternalPort&gt;"
+                       "&lt;p:NewInternalClient&gt;192.168.1.10&lt;/p:NewInternalClient&gt;"
+                       "&lt;p:NewEnabled&gt;1&lt;/p:NewEnabled&gt;"
+                       "&lt;p:NewDescription&gt;Benchmark&lt;/p:NewDescription&gt;"
+                       "&lt;p:NewLeaseTime&gt;3600&lt;/p:NewLeaseTime&gt;"
+                       "&lt;/p:PortMappingEntry&gt;");
+    }
+    listing.append("&lt;/p:PortMappingList&gt;");
+
+    QByteArray arguments("<NewPortListing>");
+    arguments.append(listing).append("</NewPortListing>\r\n");
+    return soapResponse("GetListOfPortMappings", arguments);
+}
+
+void destroyDevice(Device *device)
+{
+    // everything is parented to Discover, so free the tree by hand
+    for (Device *child : device->devices()) {
+        destroyDevice(child);
+    }
+    for (Service *service : device->services()) {
+        delete service;
+    }
+    delete device;
+}
+
+}
+
+void BenchParsing::initTestCase()
+{
+    m_discover = new Discover(this);
+}
+
+void BenchParsing::fromXml_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("small") << corpus("igd-small.xml");
+    QTest::newRow("large") << corpus("igd-large.xml");
+    QTest::newRow("nested") << corpus("igd-nested.xml");
+}
+
+void BenchParsing::fromXml()
+{
+    QFETCH(QByteArray, xml);
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        Device *device = Device::fromXml(xml, m_discover);
+        QVERIFY(device);
+        destroyDevice(device);
+    }
+}
+
+void BenchParsing::soapEnvelope()
+{
+    const QUrl url(QStringLiteral("http://192.168.1.1:5000/upnp/control/WANIPConn1"));
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        SoapEnvelope envelope(QStringLiteral("AddPortMapping"), QStringLiteral("urn:schemas-upnp-org:service:WANIPConnection:2"));
+        envelope.writeTextElement(QStringLiteral("NewRemoteHost"), QString());
+        envelope.writeTextElement(QStringLiteral("NewExternalPort"), QString::number(3004));
+        envelope.writeTextElement(QStringLiteral("NewProtocol"), QStringLiteral("TCP"));
+        envelope.writeTextElement(QStringLiteral("NewInternalPort"), QString::number(3004));
+        envelope.writeTextElement(QStringLiteral("NewInternalClient"), QStringLiteral("192.168.1.10"));
+        envelope.writeTextElement(QStringLiteral("NewEnabled"), QStringLiteral("1"));
+        envelope.writeTextElement(QStringLiteral("NewPortMappingDescription"), QStringLiteral("Benchmark"));
+        envelope.writeTextElement(QStringLiteral("NewLeaseDuration"), QString::number(3600));
+        const QByteArray body = envelope.render();
+        const QNetworkRequest request = envelope.request(url);
+        Q_UNUSED(request)
+        QVERIFY(!body.isEmpty());
+    }
+}
+
+void BenchParsing::responseError()
+{
+    const QByteArray data("<?xml version=\"1.0\"?>\r\n"
+                          "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+                          "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">\r\n"
+                          "<s:Body>\r\n<s:Fault>\r\n<faultcode>s:Client</faultcode>\r\n"
+                          "<faultstring>UPnPError</faultstring>\r\n<detail>\r\n"
+                          "<UPnPError xmlns=\"urn:schemas-upnp-org:control-1-0\">\r\n"
+                          "<errorCode>718</errorCode>\r\n<errorDescription>ConflictInMappingEntry</errorDescription>\r\n"
+                          "</UPnPError>\r\n</detail>\r\n</s:Fault>\r\n</s:Body>\r\n</s:Envelope>\r\n");
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        const auto error = SoapEnvelope::responseError(data);
+        QCOMPARE(error.first, QStringLiteral("718"));
+    }
+}
+
+void BenchParsing::addAnyPortMappingResponse()
+{
+    const QByteArray data = soapResponse("AddAnyPortMapping", "<NewReservedPort>3005</NewReservedPort>\r\n");
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        QCOMPARE(WanConnectionResponse::addAnyPortMapping(data), quint16(3005));
+    }
+}
+
+void BenchParsing::specificPortMappingEntryResponse()
+{
+    const QByteArray data = soapResponse("GetSpecificPortMappingEntry", portMappingArguments(3004));
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        const WanConnectionService::PortMap map = WanConnectionResponse::specificPortMappingEntry(data);
+        QCOMPARE(map.internalPort, quint16(3004));
+    }
+}
+
+void BenchParsing::genericPortMappingEntryResponse()
+{
+    const QByteArray data = soapResponse("GetGenericPortMappingEntry", portMappingArguments(3004));
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        const WanConnectionService::PortMap map = WanConnectionResponse::genericPortMappingEntry(data);
+        QCOMPARE(map.externalPort, quint16(3004));
+    }
+}
+
+void BenchParsing::listOfPortMappingsResponse_data()
+{
+    QTest::addColumn<int>("entries");
+
+    QTest::newRow("1") << 1;
+    QTest::newRow("32") << 32;
+    QTest::newRow("256") << 256;
+}
+
+void BenchParsing::listOfPortMappingsResponse()
+{
+    QFETCH(int, entries);
+    const QByteArray data = portListing(entries);
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        const std::vector<WanConnectionService::PortMap> maps = WanConnectionResponse::listOfPortMappings(data);
+        QCOMPARE(int(maps.size()), entries);
+    }
+}
+
+void BenchParsing::statusInfoResponse()
+{
+    const QByteArray data = soapResponse("GetStatusInfo",
+                                         "<NewConnectionStatus>Connected</NewConnectionStatus>\r\n"
+                                         "<NewLastConnectionError>ERROR_NONE</NewLastConnectionError>\r\n"
+                                         "<NewUptime>86400</NewUptime>\r\n");
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        const QVariantHash info = WanConnectionResponse::statusInfo(data);
+        QVERIFY(!info.isEmpty());
+    }
+}
+
+void BenchParsing::externalIpResponse()
+{
+    const QByteArray data = soapResponse("GetExternalIPAddress", "<NewExternalIPAddress>203.0.113.7</NewExternalIPAddress>\r\n");
+
+    AllocationCounter counter;
+    QBENCHMARK {
+        counter.iteration();
+        QCOMPARE(WanConnectionResponse::externalIp(data), QStringLiteral("203.0.113.7"));
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchParsing)
+
+#include "benchparsing.moc"
@@ -0,0 +1,1104 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "igdemulator.h"
+#include "httpserver.h"
+#include "config.h"
+
+#include <QUdpSocket>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <QUuid>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include <algorithm>
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(UPNPQT_EMULATOR, "upnpqt.emulator", QtInfoMsg)
+
+namespace UpnpQt {
+
+class IgdEmulatorPrivate
+{
+public:
+    struct Mapping {
+        WanConnectionService::PortMap portMap;
+        // clock time the lease ends at, 0 for permanent mappings
+        qint64 expires = 0;
+    };
+
+    struct Subscriber {
+        QUrl callback;
+        quint32 seq = 0;
+        qint64 expires = 0;
+    };
+
+    typedef QHash<QString, QString> Arguments;
+    typedef std::vector<std::pair<QString, QString>> Values;
+
+    QString deviceType(const QString &device) const;
+    QString serviceType() const;
+    QUrl urlBase() const;
+    QByteArray server() const;
+    int delay() const;
+    bool chance(double rate) const;
+
+    void readDatagrams();
+    void handle(const HttpServer::Request &request, const HttpServer::Responder &respond);
+    HttpServer::Response description() const;
+    HttpServer::Response control(const HttpServer::Request &request);
+    HttpServer::Response subscribe(const HttpServer::Request &request, QByteArray &newSid);
+    HttpServer::Response unsubscribe(const HttpServer::Request &request);
+
+    HttpServer::Response addPortMapping(const Arguments &args, bool any);
+    HttpServer::Response deletePortMapping(const Arguments &args);
+    HttpServer::Response getSpecificPortMappingEntry(const Arguments &args);
+    HttpServer::Response getGenericPortMappingEntry(const Arguments &args);
+    HttpServer::Response getListOfPortMappings(const Arguments &args);
+
+    HttpServer::Response success(const QString &action, const Values &values = Values()) const;
+    HttpServer::Response fault(int code, const QString &description) const;
+
+    void expire();
+    int find(const QString &remoteHost, quint16 externalPort, QAbstractSocket::SocketType sockType) const;
+    static bool sameAddress(const QHostAddress &stored, const QString &storedString, const QString &requested);
+    int remainingLease(const Mapping &mapping) const;
+    QByteArray propertySet() const;
+    void notify(const QByteArray &sid);
+    void notifyAll();
+
+    IgdEmulator *q_ptr;
+    HttpServer http;
+    QUdpSocket ssdp;
+    QNetworkAccessManager *nam = nullptr;
+    QHostAddress address;
+    QElapsedTimer clock;
+    qint64 startedAt = 0;
+    std::vector<Mapping> table;
+    QHash<QByteArray, Subscriber> subscribers;
+    QUuid uuid = QUuid::createUuid();
+    QString externalIp = QStringLiteral("203.0.113.1");
+    QString connectionStatus = QStringLiteral("Connected");
+    double failureRate = 0;
+    double dropRate = 0;
+    int version = 2;
+    int latency = 0;
+    int jitter = 0;
+    int maxEntries = 1024;
+    int maxPageSize = 0;
+    bool closeConnections = false;
+};
+
+}
+
+using namespace UpnpQt;
+
+static const char descriptionPath[] = "/rootDesc.xml";
+static const char controlPath[] = "/ctl/IPConn";
+static const char eventPath[] = "/evt/IPConn";
+
+namespace {
+
+bool parseAction(const QByteArray &body, QString &action, IgdEmulatorPrivate::Arguments &args)
+{
+    QXmlStreamReader xml(body);
+    while (!xml.atEnd()) {
+        if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == QLatin1String("Body")) {
+            if (!xml.readNextStartElement()) {
+                return false;
+            }
+            action = xml.name().toString();
+            while (xml.readNextStartElement()) {
+                args.insert(xml.name().toString(), xml.readElementText());
+            }
+            return !xml.hasError();
+        }
+    }
+    return false;
+}
+
+bool parseProtocol(const QString &protocol, QAbstractSocket::SocketType &sockType)
+{
+    if (protocol == QLatin1String("TCP")) {
+        sockType = QAbstractSocket::TcpSocket;
+    } else if (protocol == QLatin1String("UDP")) {
+        sockType = QAbstractSocket::UdpSocket;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parsePort(const QString &value, quint16 &port)
+{
+    bool ok;
+    const uint number = value.toUInt(&ok);
+    port = quint16(number);
+    return ok && number <= 65535;
+}
+
+QString protocolName(QAbstractSocket::SocketType sockType)
+{
+    return sockType == QAbstractSocket::TcpSocket ? QStringLiteral("TCP") : QStringLiteral("UDP");
+}
+
+void writeDeviceStart(QXmlStreamWriter &xml, const QString &type, const QString &friendlyName, const QUuid &uuid)
+{
+    xml.writeStartElement(QStringLiteral("device"));
+    xml.writeTextElement(QStringLiteral("deviceType"), type);
+    xml.writeTextElement(QStringLiteral("friendlyName"), friendlyName);
+    xml.writeTextElement(QStringLiteral("manufacturer"), QStringLiteral("UpnpQt"));
+    xml.writeTextElement(QStringLiteral("modelName"), QStringLiteral("IgdEmulator"));
+    xml.writeTextElement(QStringLiteral("modelNumber"), QStringLiteral(UPNPQT_VERSION));
+    xml.writeTextElement(QStringLiteral("UDN"), QLatin1String("uuid:") + uuid.toString(QUuid::WithoutBraces));
+}
+
+}
+
+IgdEmulator::IgdEmulator(QObject *parent) : QObject(parent)
+  , d_ptr(new IgdEmulatorPrivate)
+{
+    Q_D(IgdEmulator);
+    d->q_ptr = this;
+    d->clock.start();
+
+    d->http.setHandler([=] (const HttpServer::Request &request, const HttpServer::Responder &respond) {
+        d->handle(request, respond);
+    });
+    connect(&d->ssdp, &QUdpSocket::readyRead, this, [=] {
+        d->readDatagrams();
+    });
+}
+
+IgdEmulator::~IgdEmulator()
+{
+    delete d_ptr;
+}
+
+bool IgdEmulator::start(const QHostAddress &address)
+{
+    Q_D(IgdEmulator);
+    stop();
+
+    if (!d->http.listen(address)) {
+        qCWarning(UPNPQT_EMULATOR) << "Cannot listen on" << address << d->http.errorString();
+        return false;
+    }
+
+    if (!d->ssdp.bind(address, 0)) {
+        qCWarning(UPNPQT_EMULATOR) << "Cannot bind SSDP socket on" << address << d->ssdp.errorString();
+        d->http.close();
+        return false;
+    }
+
+    d->address = address;
+    d->startedAt = d->clock.elapsed();
+    qCInfo(UPNPQT_EMULATOR) << "Emulating IGDv" << d->version << "at" << location() << "SSDP port" << ssdpPort();
+    return true;
+}
+
+void IgdEmulator::stop()
+{
+    Q_D(IgdEmulator);
+    d->http.close();
+    d->ssdp.close();
+    d->subscribers.clear();
+}
+
+bool IgdEmulator::isRunning() const
+{
+    Q_D(const IgdEmulator);
+    return d->http.isListening();
+}
+
+quint16 IgdEmulator::ssdpPort() const
+{
+    Q_D(const IgdEmulator);
+    return d->ssdp.localPort();
+}
+
+quint16 IgdEmulator::httpPort() const
+{
+    Q_D(const IgdEmulator);
+    return d->http.serverPort();
+}
+
+QUrl IgdEmulator::location() const
+{
+    Q_D(const IgdEmulator);
+    QUrl url = d->urlBase();
+    url.setPath(QLatin1String(descriptionPath));
+    return url;
+}
+
+void IgdEmulator::setVersion(int version)
+{
+    Q_D(IgdEmulator);
+    d->version = qBound(1, version, 2);
+}
+
+int IgdEmulator::version() const
+{
+    Q_D(const IgdEmulator);
+    return d->version;
+}
+
+void IgdEmulator::setExternalIp(const QString &ip)
+{
+    Q_D(IgdEmulator);
+    if (d->externalIp != ip) {
+        d->externalIp = ip;
+        d->notifyAll();
+    }
+}
+
+QString IgdEmulator::externalIp() const
+{
+    Q_D(const IgdEmulator);
+    return d->externalIp;
+}
+
+void IgdEmulator::setConnectionStatus(const QString &status)
+{
+    Q_D(IgdEmulator);
+    if (d->connectionStatus != status) {
+        d->connectionStatus = status;
+        d->notifyAll();
+    }
+}
+
+QString IgdEmulator::connectionStatus() const
+{
+    Q_D(const IgdEmulator);
+    return d->connectionStatus;
+}
+
+void IgdEmulator::setLatency(int msec, int jitter)
+{
+    Q_D(IgdEmulator);
+    d->latency = qMax(0, msec);
+    d->jitter = qMax(0, jitter);
+}
+
+int IgdEmulator::latency() const
+{
+    Q_D(const IgdEmulator);
+    return d->latency;
+}
+
+int IgdEmulator::jitter() const
+{
+    Q_D(const IgdEmulator);
+    return d->jitter;
+}
+
+void IgdEmulator::setFailureRate(double rate)
+{
+    Q_D(IgdEmulator);
+    d->failureRate = qBound(0.0, rate, 1.0);
+}
+
+double IgdEmulator::failureRate() const
+{
+    Q_D(const IgdEmulator);
+    return d->failureRate;
+}
+
+void IgdEmulator::setDropRate(double rate)
+{
+    Q_D(IgdEmulator);
+    d->dropRate = qBound(0.0, rate, 1.0);
+}
+
+double IgdEmulator::dropRate() const
+{
+    Q_D(const IgdEmulator);
+    return d->dropRate;
+}
+
+void IgdEmulator::setCloseConnections(bool close)
+{
+    Q_D(IgdEmulator);
+    d->closeConnections = close;
+}
+
+bool IgdEmulator::closeConnections() const
+{
+    Q_D(const IgdEmulator);
+    return d->closeConnections;
+}
+
+void IgdEmulator::setMaxEntries(int max)
+{
+    Q_D(IgdEmulator);
+    d->maxEntries = qMax(0, max);
+}
+
+int IgdEmulator::maxEntries() const
+{
+    Q_D(const IgdEmulator);
+    return d->maxEntries;
+}
+
+void IgdEmulator::setMaxPageSize(int max)
+{
+    Q_D(IgdEmulator);
+    d->maxPageSize = qMax(0, max);
+}
+
+int IgdEmulator::maxPageSize() const
+{
+    Q_D(const IgdEmulator);
+    return d->maxPageSize;
+}
+
+void IgdEmulator::populate(int count, quint16 firstPort)
+{
+    Q_D(IgdEmulator);
+    d->expire();
+
+    int added = 0;
+    for (int port = firstPort; added < count && port <= 65535 && int(d->table.size()) < d->maxEntries; ++port) {
+        if (d->find(QString(), quint16(port), QAbstractSocket::TcpSocket) >= 0) {
+            continue;
+        }
+
+        IgdEmulatorPrivate::Mapping mapping;
+        mapping.portMap.externalPort = quint16(port);
+        mapping.portMap.setInternalAddress(QLatin1String("192.168.1.") + QString::number(2 + added % 250));
+        mapping.portMap.internalPort = quint16(port);
+        mapping.portMap.setSockType(QAbstractSocket::TcpSocket);
+        mapping.portMap.setDescription(QLatin1String("emulated-") + QString::number(port));
+        d->table.push_back(mapping);
+        ++added;
+    }
+
+    if (added) {
+        d->notifyAll();
+    }
+}
+
+bool IgdEmulator::addPortMap(const WanConnectionService::PortMap &portMap)
+{
+    Q_D(IgdEmulator);
+    d->expire();
+
+    if (int(d->table.size()) >= d->maxEntries ||
+            d->find(portMap.remoteHost(), portMap.externalPort, portMap.sockType()) >= 0) {
+        return false;
+    }
+
+    IgdEmulatorPrivate::Mapping mapping;
+    mapping.portMap = portMap;
+    mapping.expires = portMap.leaseDuration > 0 ? d->clock.elapsed() + qint64(portMap.leaseDuration) * 1000 : 0;
+    d->table.push_back(mapping);
+    d->notifyAll();
+    return true;
+}
+
+int IgdEmulator::entryCount() const
+{
+    Q_D(const IgdEmulator);
+    const_cast<IgdEmulatorPrivate *>(d)->expire();
+    return int(d->table.size());
+}
+
+std::vector<WanConnectionService::PortMap> IgdEmulator::portMaps() const
+{
+    Q_D(const IgdEmulator);
+    const_cast<IgdEmulatorPrivate *>(d)->expire();
+
+    std::vector<WanConnectionService::PortMap> ret;
+    ret.reserve(d->table.size());
+    for (const IgdEmulatorPrivate::Mapping &mapping : d->table) {
+        ret.push_back(mapping.portMap);
+        ret.back().leaseDuration = d->remainingLease(mapping);
+    }
+    return ret;
+}
+
+void IgdEmulator::clear()
+{
+    Q_D(IgdEmulator);
+    if (!d->table.empty()) {
+        d->table.clear();
+        d->notifyAll();
+    }
+}
+
+QString IgdEmulatorPrivate::deviceType(const QString &device) const
+{
+    return QLatin1String("urn:schemas-upnp-org:device:") + device + QLatin1Char(':') + QString::number(version);
+}
+
+QString IgdEmulatorPrivate::serviceType() const
+{
+    return QLatin1String("urn:schemas-upnp-org:service:WANIPConnection:") + QString::number(version);
+}
+
+QUrl IgdEmulatorPrivate::urlBase() const
+{
+    QUrl url;
+    url.setScheme(QStringLiteral("http"));
+    url.setHost(address.toString());
+    url.setPort(http.serverPort());
+    url.setPath(QStringLiteral("/"));
+    return url;
+}
+
+QByteArray IgdEmulatorPrivate::server() const
+{
+    return QByteArrayLiteral("Linux UPnP/1.1 UpnpQt-IgdEmulator/" UPNPQT_VERSION);
+}
+
+int IgdEmulatorPrivate::delay() const
+{
+    return latency + (jitter > 0 ? QRandomGenerator::global()->bounded(jitter + 1) : 0);
+}
+
+bool IgdEmulatorPrivate::chance(double rate) const
+{
+    return rate > 0 && QRandomGenerator::global()->generateDouble() < rate;
+}
+
+void IgdEmulatorPrivate::readDatagrams()
+{
+    while (ssdp.hasPendingDatagrams()) {
+        QByteArray data(int(qMax(qint64(0), ssdp.pendingDatagramSize())), 0);
+        QHostAddress sender;
+        quint16 senderPort = 0;
+        if (ssdp.readDatagram(data.data(), data.size(), &sender, &senderPort) == -1 || !data.startsWith("M-SEARCH")) {
+            continue;
+        }
+
+        QByteArray st;
+        const QList<QByteArray> lines = data.split('\n');
+        for (const QByteArray &line : lines) {
+            if (line.size() > 3 && line.left(3).toUpper() == "ST:") {
+                st = line.mid(3).trimmed();
+            }
+        }
+
+        // like most routers the TR-064 (dslforum) search is left unanswered
+        if (st != "ssdp:all" && st != "upnp:rootdevice" && !st.startsWith("urn:schemas-upnp-org:device:InternetGatewayDevice:")) {
+            qCDebug(UPNPQT_EMULATOR) << "Ignoring M-SEARCH for" << st;
+            continue;
+        }
+
+        if (chance(dropRate)) {
+            qCDebug(UPNPQT_EMULATOR) << "Dropping M-SEARCH from" << sender << senderPort;
+            continue;
+        }
+
+        const QByteArray type = deviceType(QStringLiteral("InternetGatewayDevice")).toLatin1();
+        QByteArray answer;
+        answer.append("HTTP/1.1 200 OK\r\nCACHE-CONTROL: max-age=1800\r\nEXT:\r\nLOCATION: ");
+        answer.append(q_ptr->location().toEncoded());
+        answer.append("\r\nSERVER: ");
+        answer.append(server());
+        answer.append("\r\nST: ");
+        answer.append(type);
+        answer.append("\r\nUSN: uuid:");
+        answer.append(uuid.toByteArray(QUuid::WithoutBraces));
+        answer.append("::");
+        answer.append(type);
+        answer.append("\r\n\r\n");
+
+        QTimer::singleShot(delay(), q_ptr, [=] {
+            ssdp.writeDatagram(answer, sender, senderPort);
+        });
+    }
+}
+
+void IgdEmulatorPrivate::handle(const HttpServer::Request &request, const HttpServer::Responder &respond)
+{
+    HttpServer::Response response;
+    QByteArray newSid;
+    if (chance(dropRate)) {
+        qCDebug(UPNPQT_EMULATOR) << "Dropping" << request.method << request.path;
+        response.abort = true;
+    } else if (request.method == "GET" && request.path == descriptionPath) {
+        response = description();
+    } else if (request.method == "POST" && request.path == controlPath) {
+        response = control(request);
+    } else if (request.method == "SUBSCRIBE" && request.path == eventPath) {
+        response = subscribe(request, newSid);
+    } else if (request.method == "UNSUBSCRIBE" && request.path == eventPath) {
+        response = unsubscribe(request);
+    } else {
+        response.status = 404;
+        response.reason = QByteArrayLiteral("Not Found");
+    }
+    response.close = response.close || closeConnections;
+    response.headers.push_back({QByteArrayLiteral("Server"), server()});
+
+    QTimer::singleShot(delay(), q_ptr, [=] {
+        respond(response);
+        if (!newSid.isEmpty()) {
+            // the initial event carries every variable, sent once the subscriber knows the SID
+            notify(newSid);
+        }
+    });
+}
+
+HttpServer::Response IgdEmulatorPrivate::description() const
+{
+    HttpServer::Response response;
+    response.headers.push_back({QByteArrayLiteral("Content-Type"), QByteArrayLiteral("text/xml; charset=\"utf-8\"")});
+
+    QXmlStreamWriter xml(&response.body);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    xml.writeDefaultNamespace(QStringLiteral("urn:schemas-upnp-org:device-1-0"));
+    xml.writeStartElement(QStringLiteral("root"));
+
+    xml.writeStartElement(QStringLiteral("specVersion"));
+    xml.writeTextElement(QStringLiteral("major"), QStringLiteral("1"));
+    xml.writeTextElement(QStringLiteral("minor"), version >= 2 ? QStringLiteral("1") : QStringLiteral("0"));
+    xml.writeEndElement(); // specVersion
+
+    xml.writeTextElement(QStringLiteral("URLBase"), urlBase().toString());
+
+    writeDeviceStart(xml, deviceType(QStringLiteral("InternetGatewayDevice")), QStringLiteral("UpnpQt IGD Emulator"), uuid);
+    xml.writeStartElement(QStringLiteral("deviceList"));
+
+    writeDeviceStart(xml, deviceType(QStringLiteral("WANDevice")), QStringLiteral("WANDevice"),
+                     QUuid::createUuidV5(uuid, QStringLiteral("WANDevice")));
+    xml.writeStartElement(QStringLiteral("deviceList"));
+
+    writeDeviceStart(xml, deviceType(QStringLiteral("WANConnectionDevice")), QStringLiteral("WANConnectionDevice"),
+                     QUuid::createUuidV5(uuid, QStringLiteral("WANConnectionDevice")));
+    xml.writeStartElement(QStringLiteral("serviceList"));
+    xml.writeStartElement(QStringLiteral("service"));
+    xml.writeTextElement(QStringLiteral("serviceType"), serviceType());
+    xml.writeTextElement(QStringLiteral("serviceId"), QStringLiteral("urn:upnp-org:serviceId:WANIPConn1"));
+    xml.writeTextElement(QStringLiteral("controlURL"), QLatin1String(controlPath));
+    xml.writeTextElement(QStringLiteral("eventSubURL"), QLatin1String(eventPath));
+    xml.writeTextElement(QStringLiteral("SCPDURL"), QStringLiteral("/WANIPCn.xml"));
+    xml.writeEndElement(); // service
+    xml.writeEndElement(); // serviceList
+    xml.writeEndElement(); // WANConnectionDevice
+
+    xml.writeEndElement(); // deviceList
+    xml.writeEndElement(); // WANDevice
+
+    xml.writeEndElement(); // deviceList
+    xml.writeEndElement(); // InternetGatewayDevice
+
+    xml.writeEndElement(); // root
+    xml.writeEndDocument();
+
+    return response;
+}
+
+HttpServer::Response IgdEmulatorPrivate::control(const HttpServer::Request &request)
+{
+    QString action;
+    Arguments args;
+    if (!parseAction(request.body, action, args)) {
+        return fault(402, QStringLiteral("Invalid Args"));
+    }
+
+    qCDebug(UPNPQT_EMULATOR) << "Action" << action << args;
+    Q_EMIT q_ptr->actionReceived(action);
+
+    if (chance(failureRate)) {
+        return fault(501, QStringLiteral("ActionFailed"));
+    }
+
+    expire();
+
+    if (action == QLatin1String("AddPortMapping")) {
+        return addPortMapping(args, false);
+    } else if (action == QLatin1String("AddAnyPortMapping") && version >= 2) {
+        return addPortMapping(args, true);
+    } else if (action == QLatin1String("DeletePortMapping")) {
+        return deletePortMapping(args);
+    } else if (action == QLatin1String("GetSpecificPortMappingEntry")) {
+        return getSpecificPortMappingEntry(args);
+    } else if (action == QLatin1String("GetGenericPortMappingEntry")) {
+        return getGenericPortMappingEntry(args);
+    } else if (action == QLatin1String("GetListOfPortMappings") && version >= 2) {
+        return getListOfPortMappings(args);
+    } else if (action == QLatin1String("GetStatusInfo")) {
+        return success(action, {
+                           {QStringLiteral("NewConnectionStatus"), connectionStatus},
+                           {QStringLiteral("NewLastConnectionError"), QStringLiteral("ERROR_NONE")},
+                           {QStringLiteral("NewUptime"), QString::number((clock.elapsed() - startedAt) / 1000)},
+                       });
+    } else if (action == QLatin1String("GetExternalIPAddress")) {
+        return success(action, {
+                           {QStringLiteral("NewExternalIPAddress"), externalIp},
+                       });
+    }
+
+    return fault(401, QStringLiteral("Invalid Action"));
+}
+
+HttpServer::Response IgdEmulatorPrivate::addPortMapping(const Arguments &args, bool any)
+{
+    QAbstractSocket::SocketType sockType;
+    quint16 externalPort;
+    quint16 internalPort;
+    bool leaseOk;
+    int leaseDuration = args.value(QStringLiteral("NewLeaseDuration")).toInt(&leaseOk);
+    const QString remoteHost = args.value(QStringLiteral("NewRemoteHost"));
+    const QString internalClient = args.value(QStringLiteral("NewInternalClient"));
+    if (!parseProtocol(args.value(QStringLiteral("NewProtocol")), sockType) ||
+            !parsePort(args.value(QStringLiteral("NewExternalPort")), externalPort) ||
+            !parsePort(args.value(QStringLiteral("NewInternalPort")), internalPort) || internalPort == 0 ||
+            internalClient.isEmpty() || !leaseOk || leaseDuration < 0) {
+        return fault(402, QStringLiteral("Invalid Args"));
+    }
+
+    if (externalPort == 0 && !any) {
+        return fault(716, QStringLiteral("WildCardNotPermittedInExtPort"));
+    }
+
+    if (version >= 2 && leaseDuration == 0) {
+        // IGDv2 has no permanent mappings, 0 means the longest lease
+        leaseDuration = 604800;
+    }
+
+    int index = find(remoteHost, externalPort, sockType);
+    if (index >= 0 && !sameAddress(table[index].portMap.internalHostAddress(), table[index].portMap.internalAddress(), internalClient)) {
+        if (!any) {
+            return fault(718, QStringLiteral("ConflictInMappingEntry"));
+        }
+
+        // taken by someone else, reserve the next free port
+        int tries = 0;
+        do {
+            externalPort = externalPort >= 65535 ? 1024 : externalPort + 1;
+        } while (find(remoteHost, externalPort, sockType) >= 0 && ++tries < 65535);
+        if (tries == 65535) {
+            return fault(728, QStringLiteral("NoPortMapsAvailable"));
+        }
+        index = -1;
+    } else if (externalPort == 0) {
+        externalPort = 1024;
+        while (find(remoteHost, externalPort, sockType) >= 0 && externalPort < 65535) {
+            ++externalPort;
+        }
+    }
+
+    if (index < 0 && int(table.size()) >= maxEntries) {
+        return fault(728, QStringLiteral("NoPortMapsAvailable"));
+    }
+
+    Mapping mapping;
+    mapping.portMap.setRemoteHost(remoteHost);
+    mapping.portMap.externalPort = externalPort;
+    mapping.portMap.setSockType(sockType);
+    mapping.portMap.internalPort = internalPort;
+    mapping.portMap.setInternalAddress(internalClient);
+    mapping.portMap.enabled = args.value(QStringLiteral("NewEnabled")) != QLatin1String("0");
+    mapping.portMap.setDescription(args.value(QStringLiteral("NewPortMappingDescription")));
+    mapping.portMap.leaseDuration = leaseDuration;
+    mapping.expires = leaseDuration > 0 ? clock.elapsed() + qint64(leaseDuration) * 1000 : 0;
+
+    if (index >= 0) {
+        // same client refreshing its mapping
+        table[index] = mapping;
+    } else {
+        table.push_back(mapping);
+        notifyAll();
+    }
+
+    if (any) {
+        return success(QStringLiteral("AddAnyPortMapping"), {
+                           {QStringLiteral("NewReservedPort"), QString::number(externalPort)},
+                       });
+    }
+    return success(QStringLiteral("AddPortMapping"));
+}
+
+HttpServer::Response IgdEmulatorPrivate::deletePortMapping(const Arguments &args)
+{
+    QAbstractSocket::SocketType sockType;
+    quint16 externalPort;
+    if (!parseProtocol(args.value(QStringLiteral("NewProtocol")), sockType) ||
+            !parsePort(args.value(QStringLiteral("NewExternalPort")), externalPort)) {
+        return fault(402, QStringLiteral("Invalid Args"));
+    }
+
+    const int index = find(args.value(QStringLiteral("NewRemoteHost")), externalPort, sockType);
+    if (index < 0) {
+        return fault(714, QStringLiteral("NoSuchEntryInArray"));
+    }
+
+    table.erase(table.begin() + index);
+    notifyAll();
+    return success(QStringLiteral("DeletePortMapping"));
+}
+
+HttpServer::Response IgdEmulatorPrivate::getSpecificPortMappingEntry(const Arguments &args)
+{
+    QAbstractSocket::SocketType sockType;
+    quint16 externalPort;
+    if (!parseProtocol(args.value(QStringLiteral("NewProtocol")), sockType) ||
+            !parsePort(args.value(QStringLiteral("NewExternalPort")), externalPort)) {
+        return fault(402, QStringLiteral("Invalid Args"));
+    }
+
+    const int index = find(args.value(QStringLiteral("NewRemoteHost")), externalPort, sockType);
+    if (index < 0) {
+        return fault(714, QStringLiteral("NoSuchEntryInArray"));
+    }
+
+    const Mapping &mapping = table[index];
+    return success(QStringLiteral("GetSpecificPortMappingEntry"), {
+                       {QStringLiteral("NewInternalPort"), QString::number(mapping.portMap.internalPort)},
+                       {QStringLiteral("NewInternalClient"), mapping.portMap.internalAddress()},
+                       {QStringLiteral("NewEnabled"), mapping.portMap.enabled ? QStringLiteral("1") : QStringLiteral("0")},
+                       {QStringLiteral("NewPortMappingDescription"), mapping.portMap.description()},
+                       {QStringLiteral("NewLeaseDuration"), QString::number(remainingLease(mapping))},
+                   });
+}
+
+HttpServer::Response IgdEmulatorPrivate::getGenericPortMappingEntry(const Arguments &args)
+{
+    bool ok;
+    const int index = args.value(QStringLiteral("NewPortMappingIndex")).toInt(&ok);
+    if (!ok || index < 0) {
+        return fault(402, QStringLiteral("Invalid Args"));
+    }
+
+    if (index >= int(table.size())) {
+        return fault(713, QStringLiteral("SpecifiedArrayIndexInvalid"));
+    }
+
+    const Mapping &mapping = table[size_t(index)];
+    return success(QStringLiteral("GetGenericPortMappingEntry"), {
+                       {QStringLiteral("NewRemoteHost"), mapping.portMap.remoteHost()},
+                       {QStringLiteral("NewExternalPort"), QString::number(mapping.portMap.externalPort)},
+                       {QStringLiteral("NewProtocol"), protocolName(mapping.portMap.sockType())},
+                       {QStringLiteral("NewInternalPort"), QString::number(mapping.portMap.internalPort)},
+                       {QStringLiteral("NewInternalClient"), mapping.portMap.internalAddress()},
+                       {QStringLiteral("NewEnabled"), mapping.portMap.enabled ? QStringLiteral("1") : QStringLiteral("0")},
+                       {QStringLiteral("NewPortMappingDescription"), mapping.portMap.description()},
+                       {QStringLiteral("NewLeaseDuration"), QString::number(remainingLease(mapping))},
+                   });
+}
+
+HttpServer::Response IgdEmulatorPrivate::getListOfPortMappings(const Arguments &args)
+{
+    QAbstractSocket::SocketType sockType;
+    quint16 startPort;
+    quint16 endPort;
+    bool ok;
+    int numberOfPorts = args.value(QStringLiteral("NewNumberOfPorts")).toInt(&ok);
+    if (!parseProtocol(args.value(QStringLiteral("NewProtocol")), sockType) ||
+            !parsePort(args.value(QStringLiteral("NewStartPort")), startPort) ||
+            !parsePort(args.value(QStringLiteral("NewEndPort")), endPort) ||
+            startPort > endPort || !ok || numberOfPorts < 0) {
+        return fault(402, QStringLiteral("Invalid Args"));
+    }
+
+    std::vector<const Mapping *> matches;
+    for (const Mapping &mapping : table) {
+        if (mapping.portMap.sockType() == sockType &&
+                mapping.portMap.externalPort >= startPort && mapping.portMap.externalPort <= endPort) {
+            matches.push_back(&mapping);
+        }
+    }
+
+    if (matches.empty()) {
+        return fault(730, QStringLiteral("PortMappingNotFound"));
+    }
+
+    // a stable order, pages starting at the same port return the same entries first
+    std::sort(matches.begin(), matches.end(), [] (const Mapping *a, const Mapping *b) {
+        if (a->portMap.externalPort != b->portMap.externalPort) {
+            return a->portMap.externalPort < b->portMap.externalPort;
+        }
+        return a->portMap.remoteHost() < b->portMap.remoteHost();
+    });
+    if (maxPageSize > 0 && (numberOfPorts == 0 || numberOfPorts > maxPageSize)) {
+        numberOfPorts = maxPageSize;
+    }
+    if (numberOfPorts > 0 && int(matches.size()) > numberOfPorts) {
+        matches.resize(size_t(numberOfPorts));
+    }
+
+    // the listing is a document of its own, escaped as the argument text
+    QString listing;
+    QXmlStreamWriter xml(&listing);
+    xml.writeStartDocument();
+    const QString ns = QStringLiteral("urn:schemas-upnp-org:gw:WANIPConnection");
+    xml.writeNamespace(ns, QStringLiteral("p"));
+    xml.writeStartElement(ns, QStringLiteral("PortMappingList"));
+    for (const Mapping *mapping : matches) {
+        xml.writeStartElement(ns, QStringLiteral("PortMappingEntry"));
+        xml.writeTextElement(ns, QStringLiteral("NewRemoteHost"), mapping->portMap.remoteHost());
+        xml.writeTextElement(ns, QStringLiteral("NewExternalPort"), QString::number(mapping->portMap.externalPort));
+        xml.writeTextElement(ns, QStringLiteral("NewProtocol"), protocolName(mapping->portMap.sockType()));
+        xml.writeTextElement(ns, QStringLiteral("NewInternalPort"), QString::number(mapping->portMap.internalPort));
+        xml.writeTextElement(ns, QStringLiteral("NewInternalClient"), mapping->portMap.internalAddress());
+        xml.writeTextElement(ns, QStringLiteral("NewEnabled"), mapping->portMap.enabled ? QStringLiteral("1") : QStringLiteral("0"));
+        xml.writeTextElement(ns, QStringLiteral("NewDescription"), mapping->portMap.description());
+        xml.writeTextElement(ns, QStringLiteral("NewLeaseTime"), QString::number(remainingLease(*mapping)));
+        xml.writeEndElement(); // PortMappingEntry
+    }
+    xml.writeEndElement(); // PortMappingList
+    xml.writeEndDocument();
+
+    return success(QStringLiteral("GetListOfPortMappings"), {
+                       {QStringLiteral("NewPortListing"), listing},
+                   });
+}
+
+HttpServer::Response IgdEmulatorPrivate::subscribe(const HttpServer::Request &request, QByteArray &newSid)
+{
+    HttpServer::Response response;
+
+    int timeout = 1800;
+    const QByteArray timeoutHeader = request.headers.value(QByteArrayLiteral("timeout"));
+    if (timeoutHeader.startsWith("Second-")) {
+        bool ok;
+        const int requested = timeoutHeader.mid(7).toInt(&ok);
+        if (ok && requested > 0) {
+            timeout = requested;
+        }
+    }
+
+    QByteArray sid = request.headers.value(QByteArrayLiteral("sid"));
+    const QByteArray callback = request.headers.value(QByteArrayLiteral("callback"));
+    if (!sid.isEmpty()) {
+        auto it = subscribers.find(sid);
+        if (!callback.isEmpty()) {
+            response.status = 400;
+            response.reason = QByteArrayLiteral("Bad Request");
+            return response;
+        } else if (it == subscribers.end()) {
+            response.status = 412;
+            response.reason = QByteArrayLiteral("Precondition Failed");
+            return response;
+        }
+        it->expires = clock.elapsed() + qint64(timeout) * 1000;
+    } else {
+        // CALLBACK holds one or more <url>, the first one is used
+        const int end = callback.indexOf('>');
+        const QUrl url(QString::fromLatin1(callback.mid(1, end - 1)));
+        if (request.headers.value(QByteArrayLiteral("nt")) != "upnp:event" ||
+                !callback.startsWith('<') || end < 0 || !url.isValid()) {
+            response.status = 412;
+            response.reason = QByteArrayLiteral("Precondition Failed");
+            return response;
+        }
+
+        sid = QByteArrayLiteral("uuid:") + QUuid::createUuid().toByteArray(QUuid::WithoutBraces);
+        Subscriber &subscriber = subscribers[sid];
+        subscriber.callback = url;
+        subscriber.expires = clock.elapsed() + qint64(timeout) * 1000;
+        newSid = sid;
+    }
+
+    qCDebug(UPNPQT_EMULATOR) << "SUBSCRIBE" << sid << timeout;
+    response.headers.push_back({QByteArrayLiteral("SID"), sid});
+    response.headers.push_back({QByteArrayLiteral("TIMEOUT"), QByteArrayLiteral("Second-") + QByteArray::number(timeout)});
+    return response;
+}
+
+HttpServer::Response IgdEmulatorPrivate::unsubscribe(const HttpServer::Request &request)
+{
+    HttpServer::Response response;
+    const QByteArray sid = request.headers.value(QByteArrayLiteral("sid"));
+    if (subscribers.remove(sid) == 0) {
+        response.status = 412;
+        response.reason = QByteArrayLiteral("Precondition Failed");
+    }
+    qCDebug(UPNPQT_EMULATOR) << "UNSUBSCRIBE" << sid << response.status;
+    return response;
+}
+
+HttpServer::Response IgdEmulatorPrivate::success(const QString &action, const Values &values) const
+{
+    HttpServer::Response response;
+    response.headers.push_back({QByteArrayLiteral("Content-Type"), QByteArrayLiteral("text/xml; charset=\"utf-8\"")});
+    response.headers.push_back({QByteArrayLiteral("EXT"), QByteArray()});
+
+    QXmlStreamWriter xml(&response.body);
+    xml.writeStartDocument();
+    const QString envelopeNS = QStringLiteral("http://schemas.xmlsoap.org/soap/envelope/");
+    xml.writeNamespace(envelopeNS, QStringLiteral("s"));
+    xml.writeStartElement(envelopeNS, QStringLiteral("Envelope"));
+    xml.writeAttribute(envelopeNS, QStringLiteral("encodingStyle"), QStringLiteral("http://schemas.xmlsoap.org/soap/encoding/"));
+    xml.writeStartElement(envelopeNS, QStringLiteral("Body"));
+
+    xml.writeNamespace(serviceType(), QStringLiteral("u"));
+    xml.writeStartElement(serviceType(), action + QLatin1String("Response"));
+    for (const auto &value : values) {
+        xml.writeTextElement(value.first, value.second);
+    }
+    xml.writeEndElement(); // ACTIONResponse
+
+    xml.writeEndElement(); // Body
+    xml.writeEndElement(); // Envelope
+    xml.writeEndDocument();
+
+    return response;
+}
+
+HttpServer::Response IgdEmulatorPrivate::fault(int code, const QString &description) const
+{
+    qCDebug(UPNPQT_EMULATOR) << "Fault" << code << description;
+
+    HttpServer::Response response;
+    response.status = 500;
+    response.reason = QByteArrayLiteral("Internal Server Error");
+    response.headers.push_back({QByteArrayLiteral("Content-Type"), QByteArrayLiteral("text/xml; charset=\"utf-8\"")});
+
+    QXmlStreamWriter xml(&response.body);
+    xml.writeStartDocument();
+    const QString envelopeNS = QStringLiteral("http://schemas.xmlsoap.org/soap/envelope/");
+    xml.writeNamespace(envelopeNS, QStringLiteral("s"));
+    xml.writeStartElement(envelopeNS, QStringLiteral("Envelope"));
+    xml.writeAttribute(envelopeNS, QStringLiteral("encodingStyle"), QStringLiteral("http://schemas.xmlsoap.org/soap/encoding/"));
+    xml.writeStartElement(envelopeNS, QStringLiteral("Body"));
+    xml.writeStartElement(envelopeNS, QStringLiteral("Fault"));
+    xml.writeTextElement(QStringLiteral("faultcode"), QStringLiteral("s:Client"));
+    xml.writeTextElement(QStringLiteral("faultstring"), QStringLiteral("UPnPError"));
+    xml.writeStartElement(QStringLiteral("detail"));
+    xml.writeStartElement(QStringLiteral("UPnPError"));
+    xml.writeDefaultNamespace(QStringLiteral("urn:schemas-upnp-org:control-1-0"));
+    xml.writeTextElement(QStringLiteral("errorCode"), QString::number(code));
+    xml.writeTextElement(QStringLiteral("errorDescription"), description);
+    xml.writeEndElement(); // UPnPError
+    xml.writeEndElement(); // detail
+    xml.writeEndElement(); // Fault
+    xml.writeEndElement(); // Body
+    xml.writeEndElement(); // Envelope
+    xml.writeEndDocument();
+
+    return response;
+}
+
+void IgdEmulatorPrivate::expire()
+{
+    const qint64 now = clock.elapsed();
+    auto end = std::remove_if(table.begin(), table.end(), [=] (const Mapping &mapping) {
+        return mapping.expires && mapping.expires <= now;
+    });
+    if (end != table.end()) {
+        qCDebug(UPNPQT_EMULATOR) << "Expired" << (table.end() - end) << "mappings";
+        table.erase(end, table.end());
+        notifyAll();
+    }
+}
+
+int IgdEmulatorPrivate::find(const QString &remoteHost, quint16 externalPort, QAbstractSocket::SocketType sockType) const
+{
+    // requests may spell the address differently than the table stores it
+    QHostAddress address;
+    const bool isAddress = address.setAddress(remoteHost);
+    for (size_t i = 0; i < table.size(); ++i) {
+        const WanConnectionService::PortMap &portMap = table[i].portMap;
+        if (portMap.externalPort != externalPort || portMap.sockType() != sockType) {
+            continue;
+        }
+        if (isAddress ? address.isEqual(portMap.remoteHostAddress(), QHostAddress::TolerantConversion) : portMap.remoteHost() == remoteHost) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+bool IgdEmulatorPrivate::sameAddress(const QHostAddress &stored, const QString &storedString, const QString &requested)
+{
+    QHostAddress address;
+    if (address.setAddress(requested)) {
+        return address.isEqual(stored, QHostAddress::TolerantConversion);
+    }
+    return storedString == requested;
+}
+
+int IgdEmulatorPrivate::remainingLease(const Mapping &mapping) const
+{
+    if (!mapping.expires) {
+        return 0;
+    }
+    return int(qMax(qint64(1), (mapping.expires - clock.elapsed() + 999) / 1000));
+}
+
+QByteArray IgdEmulatorPrivate::propertySet() const
+{
+    QByteArray data;
+    QXmlStreamWriter xml(&data);
+    xml.writeStartDocument();
+    const QString eventNS = QStringLiteral("urn:schemas-upnp-org:event-1-0");
+    xml.writeNamespace(eventNS, QStringLiteral("e"));
+    xml.writeStartElement(eventNS, QStringLiteral("propertyset"));
+
+    const Values values = {
+        {QStringLiteral("PortMappingNumberOfEntries"), QString::number(table.size())},
+        {QStringLiteral("ExternalIPAddress"), externalIp},
+        {QStringLiteral("ConnectionStatus"), connectionStatus},
+    };
+    for (const auto &value : values) {
+        xml.writeStartElement(eventNS, QStringLiteral("property"));
+        xml.writeTextElement(value.first, value.second);
+        xml.writeEndElement(); // property
+    }
+
+    xml.writeEndElement(); // propertyset
+    xml.writeEndDocument();
+    return data;
+}
+
+void IgdEmulatorPrivate::notify(const QByteArray &sid)
+{
+    auto it = subscribers.find(sid);
+    if (it == subscribers.end()) {
+        return;
+    }
+
+    if (it->expires <= clock.elapsed()) {
+        qCDebug(UPNPQT_EMULATOR) << "Subscription expired" << sid;
+        subscribers.erase(it);
+        return;
+    }
+
+    if (!nam) {
+        nam = new QNetworkAccessManager(q_ptr);
+    }
+
+    QNetworkRequest request(it->callback);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, QByteArrayLiteral("text/xml; charset=\"utf-8\""));
+    request.setRawHeader(QByteArrayLiteral("NT"), QByteArrayLiteral("upnp:event"));
+    request.setRawHeader(QByteArrayLiteral("NTS"), QByteArrayLiteral("upnp:propchange"));
+    request.setRawHeader(QByteArrayLiteral("SID"), sid);
+    request.setRawHeader(QByteArrayLiteral("SEQ"), QByteArray::number(it->seq++));
+
+    QNetworkReply *reply = nam->sendCustomRequest(request, QByteArrayLiteral("NOTIFY"), propertySet());
+    QObject::connect(reply, &QNetworkReply::finished, reply, &QNetworkReply::deleteLater);
+}
+
+void IgdEmulatorPrivate::notifyAll()
+{
+    const QList<QByteArray> sids = subscribers.keys();
+    for (const QByteArray &sid : sids) {
+        notify(sid);
+    }
+}
+
+#include "moc_igdemulator.cpp"
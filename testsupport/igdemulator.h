@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef UPNPQT_IGDEMULATOR_H
+#define UPNPQT_IGDEMULATOR_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QUrl>
+
+#include <vector>
+
+#include <UpnpQt/wanconnectionservice.h>
+
+namespace UpnpQt {
+
+/**
+ * An emulated Internet Gateway Device living in the calling thread.
+ *
+ * It answers M-SEARCH sent to ssdpPort(), serves its description and
+ * implements the WANIPConnection actions and eventing on httpPort(),
+ * so the library can be driven without a router:
+ *
+ * @code
+ * auto igd = new IgdEmulator;
+ * igd->start();
+ * discover->discoverInternetGatewayDeviceAt(QHostAddress::LocalHost, igd->ssdpPort());
+ * @endcode
+ *
+ * Latency, lost requests, failing actions and table limits can be
+ * tuned to reproduce slow or flaky routers.
+ *
+ * It is test support for the tools and autotests, built as a static
+ * library of its own and not installed.
+ */
+class IgdEmulatorPrivate;
+class IgdEmulator : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(IgdEmulator)
+public:
+    explicit IgdEmulator(QObject *parent = nullptr);
+    virtual ~IgdEmulator();
+
+    /**
+     * @brief start listening for SSDP and HTTP on random ports of address
+     * @return false if either socket could not be bound
+     */
+    bool start(const QHostAddress &address = QHostAddress(QHostAddress::LocalHost));
+    void stop();
+    bool isRunning() const;
+
+    quint16 ssdpPort() const;
+    quint16 httpPort() const;
+
+    /**
+     * @brief location
+     * @return the URL of the description, for Discover::discoverLocation()
+     */
+    QUrl location() const;
+
+    /**
+     * @brief setVersion
+     * @param version 1 or 2, IGDv2 adds AddAnyPortMapping and GetListOfPortMappings, defaults to 2
+     */
+    void setVersion(int version);
+    int version() const;
+
+    void setExternalIp(const QString &ip);
+    QString externalIp() const;
+
+    /**
+     * @brief setConnectionStatus
+     * @param status reported by GetStatusInfo, defaults to "Connected"
+     */
+    void setConnectionStatus(const QString &status);
+    QString connectionStatus() const;
+
+    /**
+     * @brief setLatency delays every answer, SSDP included
+     * @param msec base delay
+     * @param jitter up to this many msec are randomly added
+     */
+    void setLatency(int msec, int jitter = 0);
+    int latency() const;
+    int jitter() const;
+
+    /**
+     * @brief setFailureRate
+     * @param rate fraction of actions answered with 501 ActionFailed
+     */
+    void setFailureRate(double rate);
+    double failureRate() const;
+
+    /**
+     * @brief setDropRate
+     * @param rate fraction of requests and M-SEARCH that are never answered,
+     * HTTP connections are aborted
+     */
+    void setDropRate(double rate);
+    double dropRate() const;
+
+    /**
+     * @brief setCloseConnections
+     * @param close answers with Connection: close like many embedded servers do
+     */
+    void setCloseConnections(bool close);
+    bool closeConnections() const;
+
+    /**
+     * @brief setMaxEntries
+     * @param max size of the table, further mappings fail with 728 NoPortMapsAvailable, defaults to 1024
+     */
+    void setMaxEntries(int max);
+    int maxEntries() const;
+
+    /**
+     * @brief setMaxPageSize
+     * @param max entries returned by GetListOfPortMappings whatever
+     * NewNumberOfPorts asks, like gateways with a fixed cap, 0 (the default) for no cap
+     */
+    void setMaxPageSize(int max);
+    int maxPageSize() const;
+
+    /**
+     * @brief populate fills the table with permanent TCP mappings
+     * @param count number of mappings, limited by maxEntries()
+     * @param firstPort external port of the first one, the others follow
+     */
+    void populate(int count, quint16 firstPort = 10000);
+
+    /**
+     * @brief addPortMap adds portMap as is, its leaseDuration counts from now
+     * @return false if the table is full or the mapping already exists
+     */
+    bool addPortMap(const WanConnectionService::PortMap &portMap);
+
+    int entryCount() const;
+    std::vector<WanConnectionService::PortMap> portMaps() const;
+    void clear();
+
+Q_SIGNALS:
+    void actionReceived(const QString &action);
+
+private:
+    IgdEmulatorPrivate *d_ptr;
+};
+
+}
+
+#endif // UPNPQT_IGDEMULATOR_H
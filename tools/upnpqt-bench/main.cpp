@@ -0,0 +1,591 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <UpnpQt/discover.h>
+#include <UpnpQt/internetgatewaydevice.h>
+#include <UpnpQt/wanconnectionservice.h>
+#include <UpnpQt/portmappingenumerator.h>
+#include <UpnpQt/reply.h>
+
+#include "config.h"
+#include "igdemulator.h"
+#include "localaddress_p.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QPointer>
+#include <QTimer>
+#include <QUrl>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <vector>
+
+using namespace UpnpQt;
+
+namespace {
+
+struct Options {
+    QString workload;
+    QUrl gateway;
+    QString internalClient;
+    int operations = 1000;
+    int concurrency = 16;
+    int firstPort = 40000;
+    int pageSize = 0;
+    int window = 4;
+    int timeout = 5000;
+    int operationTimeout = 10000;
+
+    bool emulator = false;
+    int emulatorVersion = 2;
+    int emulatorEntries = 0;
+    int emulatorLatency = 0;
+    int emulatorJitter = 0;
+    double emulatorFailureRate = 0;
+    double emulatorDropRate = 0;
+    bool emulatorClose = false;
+};
+
+struct ActionStats {
+    // msec
+    std::vector<double> latencies;
+    int errors = 0;
+};
+
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    // nearest rank
+    const size_t rank = size_t(std::ceil(p / 100.0 * double(sorted.size())));
+    return sorted[qBound(size_t(1), rank, sorted.size()) - 1];
+}
+
+class Bench : public QObject
+{
+public:
+    explicit Bench(const Options &options);
+
+    void start();
+
+private:
+    void trigger();
+    void discovered(Device *device);
+    void timedOut();
+    void run();
+    void next(int slot);
+    void addDelete(int slot);
+    void enumerate(int slot);
+    void status(int slot);
+    void discover();
+    QPointer<QTimer> guard(const QString &action, const QElapsedTimer &timer, int slot);
+    static bool release(const QPointer<QTimer> &guard);
+    void record(const QString &action, const QElapsedTimer &timer, Reply *reply);
+    void record(const QString &action, const QElapsedTimer &timer, bool error, const QString &errorCode, const QString &errorString);
+    void report();
+
+    Options m_options;
+    IgdEmulator *m_emulator = nullptr;
+    Discover *m_discover;
+    WanConnectionService *m_service = nullptr;
+    QTimer m_timeout;
+    QElapsedTimer m_elapsed;
+    QElapsedTimer m_discoverTimer;
+    std::map<QString, ActionStats> m_stats;
+    std::map<QString, int> m_errors;
+    qint64 m_entries = 0;
+    int m_started = 0;
+    int m_workers = 0;
+    int m_active = 0;
+    bool m_discovering = false;
+};
+
+Bench::Bench(const Options &options)
+    : m_options(options)
+    , m_discover(new Discover(this))
+{
+    connect(m_discover, &Discover::discovered, this, [=] (Device *device) {
+        discovered(device);
+    });
+
+    m_timeout.setSingleShot(true);
+    m_timeout.setInterval(m_options.timeout);
+    connect(&m_timeout, &QTimer::timeout, this, [=] {
+        timedOut();
+    });
+}
+
+void Bench::start()
+{
+    if (m_options.emulator) {
+        m_emulator = new IgdEmulator(this);
+        m_emulator->setVersion(m_options.emulatorVersion);
+        m_emulator->setLatency(m_options.emulatorLatency, m_options.emulatorJitter);
+        m_emulator->setFailureRate(m_options.emulatorFailureRate);
+        m_emulator->setDropRate(m_options.emulatorDropRate);
+        m_emulator->setCloseConnections(m_options.emulatorClose);
+        m_emulator->setMaxEntries(qMax(m_emulator->maxEntries(), m_options.emulatorEntries + m_options.concurrency));
+        if (!m_emulator->start()) {
+            QTextStream(stderr) << "Cannot start the emulator\n";
+            QCoreApplication::exit(2);
+            return;
+        }
+        m_emulator->populate(m_options.emulatorEntries);
+    }
+
+    if (m_options.workload == QLatin1String("discover")) {
+        run();
+    } else {
+        trigger();
+    }
+}
+
+void Bench::trigger()
+{
+    if (m_emulator) {
+        if (m_options.workload == QLatin1String("discover")) {
+            m_discover->discoverInternetGatewayDeviceAt(QHostAddress(QHostAddress::LocalHost), m_emulator->ssdpPort());
+        } else {
+            m_discover->discoverLocation(m_emulator->location());
+        }
+    } else if (m_options.gateway.isValid()) {
+        m_discover->discoverLocation(m_options.gateway);
+    } else {
+        m_discover->discoverInternetGatewayDevice();
+    }
+    m_timeout.start();
+}
+
+void Bench::discovered(Device *device)
+{
+    if (m_options.workload == QLatin1String("discover")) {
+        if (m_discovering) {
+            m_discovering = false;
+            m_timeout.stop();
+            record(QStringLiteral("Discover"), m_discoverTimer, false, QString(), QString());
+            next(0);
+        }
+        device->deleteLater();
+        return;
+    }
+
+    auto igd = qobject_cast<InternetGatewayDevice *>(device);
+    if (m_service || !igd || !igd->wanIpOrPppConnectionService()) {
+        return;
+    }
+
+    m_timeout.stop();
+    m_service = igd->wanIpOrPppConnectionService();
+    if (m_options.internalClient.isEmpty()) {
+        m_options.internalClient = localAddressTowards(QUrl(device->urlBase())).toString();
+    }
+    run();
+}
+
+void Bench::timedOut()
+{
+    if (m_discovering) {
+        m_discovering = false;
+        record(QStringLiteral("Discover"), m_discoverTimer, true, QStringLiteral("timeout"), QString());
+        next(0);
+    } else if (!m_service) {
+        QTextStream(stderr) << "No gateway found\n";
+        QCoreApplication::exit(2);
+    }
+}
+
+void Bench::run()
+{
+    // a single Discover can't tell concurrent searches apart
+    m_workers = m_options.workload == QLatin1String("discover") ? 1 : m_options.concurrency;
+    m_workers = qMin(m_workers, m_options.operations);
+
+    QTextStream out(stdout);
+    out << "workload " << m_options.workload << " against "
+        << (m_service ? m_service->device()->urlBase() : QStringLiteral("SSDP")) << "\n";
+    out.flush();
+
+    m_active = m_workers;
+    m_elapsed.start();
+    for (int slot = 0; slot < m_workers; ++slot) {
+        next(slot);
+    }
+
+    if (m_workers == 0) {
+        report();
+    }
+}
+
+void Bench::next(int slot)
+{
+    if (m_started >= m_options.operations) {
+        if (--m_active == 0) {
+            report();
+        }
+        return;
+    }
+    ++m_started;
+
+    if (m_options.workload == QLatin1String("add-delete")) {
+        addDelete(slot);
+    } else if (m_options.workload == QLatin1String("enumerate")) {
+        enumerate(slot);
+    } else if (m_options.workload == QLatin1String("status")) {
+        status(slot);
+    } else {
+        discover();
+    }
+}
+
+void Bench::addDelete(int slot)
+{
+    // each worker owns a port so workers never conflict with each other
+    const quint16 port = quint16(m_options.firstPort + slot);
+    QElapsedTimer addTimer;
+    addTimer.start();
+    Reply *add = m_service->addPortMapping(port, m_options.internalClient, port, QAbstractSocket::TcpSocket,
+                                           QStringLiteral("upnpqt-bench"), true, 3600);
+    const QPointer<QTimer> addGuard = guard(QStringLiteral("AddPortMapping"), addTimer, slot);
+    connect(add, &Reply::finished, this, [=] {
+        if (!release(addGuard)) {
+            return;
+        }
+        record(QStringLiteral("AddPortMapping"), addTimer, add);
+        if (add->error()) {
+            next(slot);
+            return;
+        }
+
+        QElapsedTimer deleteTimer;
+        deleteTimer.start();
+        Reply *del = m_service->deletePortMapping(port, QAbstractSocket::TcpSocket);
+        const QPointer<QTimer> deleteGuard = guard(QStringLiteral("DeletePortMapping"), deleteTimer, slot);
+        connect(del, &Reply::finished, this, [=] {
+            if (!release(deleteGuard)) {
+                return;
+            }
+            record(QStringLiteral("DeletePortMapping"), deleteTimer, del);
+            next(slot);
+        });
+    });
+}
+
+void Bench::enumerate(int slot)
+{
+    auto enumerator = new PortMappingEnumerator(m_service, this);
+    enumerator->setWindow(m_options.window);
+    enumerator->setPageSize(m_options.pageSize);
+
+    QElapsedTimer timer;
+    timer.start();
+    connect(enumerator, &PortMappingEnumerator::entry, this, [=] {
+        ++m_entries;
+    });
+    const QPointer<QTimer> enumerateGuard = guard(QStringLiteral("Enumerate"), timer, slot);
+    connect(enumerateGuard, &QTimer::timeout, enumerator, &PortMappingEnumerator::stop);
+    connect(enumerator, &PortMappingEnumerator::finished, this, [=] {
+        enumerator->deleteLater();
+        if (!release(enumerateGuard)) {
+            return;
+        }
+        record(QStringLiteral("Enumerate"), timer, enumerator->error(), enumerator->errorCode(), enumerator->errorString());
+        next(slot);
+    });
+    enumerator->start();
+}
+
+void Bench::status(int slot)
+{
+    QElapsedTimer timer;
+    timer.start();
+    auto reply = m_service->getStatusInfo();
+    const QPointer<QTimer> statusGuard = guard(QStringLiteral("GetStatusInfo"), timer, slot);
+    connect(reply, &Reply::finished, this, [=] {
+        if (!release(statusGuard)) {
+            return;
+        }
+        record(QStringLiteral("GetStatusInfo"), timer, reply);
+        next(slot);
+    });
+}
+
+void Bench::discover()
+{
+    m_discovering = true;
+    m_discoverTimer.start();
+    trigger();
+}
+
+QPointer<QTimer> Bench::guard(const QString &action, const QElapsedTimer &timer, int slot)
+{
+    // an unanswered request would stall its worker forever, gateways
+    // dropping requests under load are reported as timeouts instead
+    auto watchdog = new QTimer(this);
+    watchdog->setSingleShot(true);
+    connect(watchdog, &QTimer::timeout, this, [=] {
+        watchdog->deleteLater();
+        record(action, timer, true, QStringLiteral("timeout"), QString());
+        next(slot);
+    });
+    watchdog->start(m_options.operationTimeout);
+    return watchdog;
+}
+
+bool Bench::release(const QPointer<QTimer> &guard)
+{
+    // false once the operation was aborted, its late answer is ignored
+    if (!guard || !guard->isActive()) {
+        return false;
+    }
+    guard->stop();
+    guard->deleteLater();
+    return true;
+}
+
+void Bench::record(const QString &action, const QElapsedTimer &timer, Reply *reply)
+{
+    record(action, timer, reply->error(), reply->errorCode(), reply->errorString());
+}
+
+void Bench::record(const QString &action, const QElapsedTimer &timer, bool error, const QString &errorCode, const QString &errorString)
+{
+    ActionStats &stats = m_stats[action];
+    stats.latencies.push_back(double(timer.nsecsElapsed()) / 1e6);
+    if (error) {
+        ++stats.errors;
+        const QString key = action + QLatin1Char(' ') + errorCode + QLatin1Char(' ') + errorString;
+        ++m_errors[key];
+    }
+}
+
+void Bench::report()
+{
+    const double seconds = qMax(1e-9, double(m_elapsed.nsecsElapsed()) / 1e9);
+
+    QTextStream out(stdout);
+    out << QStringLiteral("%1 operations, concurrency %2, %3 s, %4 ops/s\n")
+           .arg(m_started)
+           .arg(m_workers)
+           .arg(seconds, 0, 'f', 3)
+           .arg(m_started / seconds, 0, 'f', 1);
+    if (m_entries) {
+        out << QStringLiteral("%1 entries enumerated, %2 entries/s\n")
+               .arg(m_entries)
+               .arg(m_entries / seconds, 0, 'f', 1);
+    }
+
+    out << "\n" << QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8\n")
+           .arg(QStringLiteral("action"), -28)
+           .arg(QStringLiteral("count"), 8)
+           .arg(QStringLiteral("errors"), 8)
+           .arg(QStringLiteral("mean ms"), 10)
+           .arg(QStringLiteral("p50 ms"), 10)
+           .arg(QStringLiteral("p95 ms"), 10)
+           .arg(QStringLiteral("p99 ms"), 10)
+           .arg(QStringLiteral("max ms"), 10);
+    for (auto &item : m_stats) {
+        std::vector<double> &latencies = item.second.latencies;
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0;
+        for (double latency : latencies) {
+            sum += latency;
+        }
+
+        out << QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8\n")
+               .arg(item.first, -28)
+               .arg(latencies.size(), 8)
+               .arg(item.second.errors, 8)
+               .arg(latencies.empty() ? 0.0 : sum / double(latencies.size()), 10, 'f', 2)
+               .arg(percentile(latencies, 50), 10, 'f', 2)
+               .arg(percentile(latencies, 95), 10, 'f', 2)
+               .arg(percentile(latencies, 99), 10, 'f', 2)
+               .arg(latencies.empty() ? 0.0 : latencies.back(), 10, 'f', 2);
+    }
+
+    if (!m_errors.empty()) {
+        out << "\nerrors\n";
+        for (const auto &item : m_errors) {
+            out << QStringLiteral("%1 %2\n").arg(item.second, 8).arg(item.first);
+        }
+    }
+    out.flush();
+
+    QCoreApplication::exit(0);
+}
+
+bool intValue(const QCommandLineParser &parser, const QCommandLineOption &option, int min, int max, int &value)
+{
+    if (!parser.isSet(option)) {
+        return true;
+    }
+
+    bool ok;
+    value = parser.value(option).toInt(&ok);
+    if (!ok || value < min || value > max) {
+        QTextStream(stderr) << "Invalid value for --" << option.names().last() << ": " << parser.value(option) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool rateValue(const QCommandLineParser &parser, const QCommandLineOption &option, double &value)
+{
+    if (!parser.isSet(option)) {
+        return true;
+    }
+
+    bool ok;
+    value = parser.value(option).toDouble(&ok);
+    if (!ok || value < 0 || value > 1) {
+        QTextStream(stderr) << "Invalid value for --" << option.names().last() << ", expected 0 to 1: " << parser.value(option) << "\n";
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("upnpqt-bench"));
+    QCoreApplication::setApplicationVersion(QStringLiteral(UPNPQT_VERSION));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Load driver for UPnP Internet Gateway Devices, reports throughput, "
+                                                    "latency percentiles and errors per action."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption workload({QStringLiteral("w"), QStringLiteral("workload")},
+                                QStringLiteral("add-delete, enumerate, status or discover, defaults to add-delete."),
+                                QStringLiteral("name"), QStringLiteral("add-delete"));
+    QCommandLineOption gateway({QStringLiteral("g"), QStringLiteral("gateway")},
+                               QStringLiteral("Description URL of the gateway, skips SSDP discovery."),
+                               QStringLiteral("url"));
+    QCommandLineOption operations({QStringLiteral("n"), QStringLiteral("operations")},
+                                  QStringLiteral("Number of operations, defaults to 1000."),
+                                  QStringLiteral("count"));
+    QCommandLineOption concurrency({QStringLiteral("c"), QStringLiteral("concurrency")},
+                                   QStringLiteral("Operations in flight, defaults to 16."),
+                                   QStringLiteral("count"));
+    QCommandLineOption firstPort(QStringLiteral("first-port"),
+                                 QStringLiteral("First external port used by add-delete, defaults to 40000."),
+                                 QStringLiteral("port"));
+    QCommandLineOption internalClient(QStringLiteral("internal-client"),
+                                      QStringLiteral("Internal client of the mappings, defaults to the address facing the gateway."),
+                                      QStringLiteral("address"));
+    QCommandLineOption pageSize(QStringLiteral("page-size"),
+                                QStringLiteral("Enumerate with GetListOfPortMappings pages of this size instead of by index."),
+                                QStringLiteral("entries"));
+    QCommandLineOption window(QStringLiteral("window"),
+                              QStringLiteral("Requests in flight per enumeration, defaults to 4."),
+                              QStringLiteral("count"));
+    QCommandLineOption timeout(QStringLiteral("timeout"),
+                               QStringLiteral("Discovery timeout in msec, defaults to 5000."),
+                               QStringLiteral("msec"));
+    QCommandLineOption operationTimeout(QStringLiteral("operation-timeout"),
+                                        QStringLiteral("Operations unanswered after this are recorded as timeouts, defaults to 10000."),
+                                        QStringLiteral("msec"));
+    QCommandLineOption emulator(QStringLiteral("emulator"),
+                                QStringLiteral("Run against an in-process IGD emulator on loopback."));
+    QCommandLineOption emulatorVersion(QStringLiteral("emulator-version"),
+                                       QStringLiteral("IGD version of the emulator, 1 or 2."),
+                                       QStringLiteral("version"));
+    QCommandLineOption emulatorEntries(QStringLiteral("emulator-entries"),
+                                       QStringLiteral("Mappings the emulator table starts with."),
+                                       QStringLiteral("count"));
+    QCommandLineOption emulatorLatency(QStringLiteral("emulator-latency"),
+                                       QStringLiteral("Delay of every emulator answer."),
+                                       QStringLiteral("msec"));
+    QCommandLineOption emulatorJitter(QStringLiteral("emulator-jitter"),
+                                      QStringLiteral("Random delay added to the emulator latency."),
+                                      QStringLiteral("msec"));
+    QCommandLineOption emulatorFailureRate(QStringLiteral("emulator-failure-rate"),
+                                           QStringLiteral("Fraction of actions failing with 501."),
+                                           QStringLiteral("rate"));
+    QCommandLineOption emulatorDropRate(QStringLiteral("emulator-drop-rate"),
+                                        QStringLiteral("Fraction of requests left unanswered."),
+                                        QStringLiteral("rate"));
+    QCommandLineOption emulatorClose(QStringLiteral("emulator-close"),
+                                     QStringLiteral("Close the connection after every emulator answer."));
+    parser.addOptions({
+                          workload, gateway, operations, concurrency, firstPort, internalClient, pageSize, window, timeout, operationTimeout,
+                          emulator, emulatorVersion, emulatorEntries, emulatorLatency, emulatorJitter,
+                          emulatorFailureRate, emulatorDropRate, emulatorClose,
+                      });
+    parser.process(app);
+
+    Options options;
+    options.workload = parser.value(workload);
+    options.internalClient = parser.value(internalClient);
+    options.emulator = parser.isSet(emulator);
+    options.emulatorClose = parser.isSet(emulatorClose);
+
+    const QStringList workloads = {
+        QStringLiteral("add-delete"),
+        QStringLiteral("enumerate"),
+        QStringLiteral("status"),
+        QStringLiteral("discover"),
+    };
+    if (!workloads.contains(options.workload)) {
+        QTextStream(stderr) << "Unknown workload " << options.workload << "\n";
+        return 1;
+    }
+
+    if (parser.isSet(gateway)) {
+        options.gateway = QUrl::fromUserInput(parser.value(gateway));
+        if (!options.gateway.isValid() || options.emulator) {
+            QTextStream(stderr) << "--gateway needs a valid URL and can't be used with --emulator\n";
+            return 1;
+        }
+    }
+
+    if (!intValue(parser, operations, 0, std::numeric_limits<int>::max(), options.operations) ||
+            !intValue(parser, concurrency, 1, 4096, options.concurrency) ||
+            !intValue(parser, firstPort, 1, 65535, options.firstPort) ||
+            !intValue(parser, pageSize, 0, 65535, options.pageSize) ||
+            !intValue(parser, window, 1, 1024, options.window) ||
+            !intValue(parser, timeout, 1, std::numeric_limits<int>::max(), options.timeout) ||
+            !intValue(parser, operationTimeout, 1, std::numeric_limits<int>::max(), options.operationTimeout) ||
+            !intValue(parser, emulatorVersion, 1, 2, options.emulatorVersion) ||
+            !intValue(parser, emulatorEntries, 0, 65535, options.emulatorEntries) ||
+            !intValue(parser, emulatorLatency, 0, 600000, options.emulatorLatency) ||
+            !intValue(parser, emulatorJitter, 0, 600000, options.emulatorJitter) ||
+            !rateValue(parser, emulatorFailureRate, options.emulatorFailureRate) ||
+            !rateValue(parser, emulatorDropRate, options.emulatorDropRate)) {
+        return 1;
+    }
+
+    if (options.workload == QLatin1String("add-delete") && options.firstPort + options.concurrency > 65536) {
+        QTextStream(stderr) << "--first-port plus --concurrency exceeds the port range\n";
+        return 1;
+    }
+
+    Bench bench(options);
+    QTimer::singleShot(0, &bench, [&bench] {
+        bench.start();
+    });
+
+    return app.exec();
+}
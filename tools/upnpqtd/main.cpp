@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2019 Daniel Nicoletti <dantti12@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <UpnpQt/daemonserver.h>
+#include <UpnpQt/discover.h>
+#include <UpnpQt/gatewaymanager.h>
+
+#include "config.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QUrl>
+
+using namespace UpnpQt;
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("upnpqtd"));
+    QCoreApplication::setApplicationVersion(QStringLiteral(UPNPQT_VERSION));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Discovers the Internet Gateway Devices and manages port mappings "
+                                                    "for every process of this host, see DaemonClient."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption name(QStringLiteral("name"),
+                            QStringLiteral("Name of the local socket, defaults to upnpqtd."),
+                            QStringLiteral("name"), DaemonServer::defaultName());
+    QCommandLineOption anyUser(QStringLiteral("any-user"),
+                               QStringLiteral("Accept clients of every user, not only the one running the daemon."));
+    QCommandLineOption gateway({QStringLiteral("g"), QStringLiteral("gateway")},
+                               QStringLiteral("Description URL of a gateway to add besides the discovered ones."),
+                               QStringLiteral("url"));
+    QCommandLineOption probeInterval(QStringLiteral("probe-interval"),
+                                     QStringLiteral("Time between gateway health probes, defaults to 10000."),
+                                     QStringLiteral("msec"));
+    QCommandLineOption gatewayTimeout(QStringLiteral("gateway-timeout"),
+                                      QStringLiteral("Time requests wait for a healthy gateway, defaults to 5000."),
+                                      QStringLiteral("msec"));
+    parser.addOptions({ name, anyUser, gateway, probeInterval, gatewayTimeout });
+    parser.process(app);
+
+    DaemonServer server;
+    if (parser.isSet(anyUser)) {
+        server.setSocketOptions(QLocalServer::WorldAccessOption);
+    }
+
+    bool ok = true;
+    if (parser.isSet(probeInterval)) {
+        const int msec = parser.value(probeInterval).toInt(&ok);
+        if (!ok || msec < 1) {
+            QTextStream(stderr) << "--probe-interval must be a positive number\n";
+            return 1;
+        }
+        server.gatewayManager()->setProbeInterval(msec);
+    }
+    if (parser.isSet(gatewayTimeout)) {
+        const int msec = parser.value(gatewayTimeout).toInt(&ok);
+        if (!ok || msec < 0) {
+            QTextStream(stderr) << "--gateway-timeout must not be negative\n";
+            return 1;
+        }
+        server.setGatewayTimeout(msec);
+    }
+
+    QUrl location;
+    if (parser.isSet(gateway)) {
+        location = QUrl::fromUserInput(parser.value(gateway));
+        if (!location.isValid()) {
+            QTextStream(stderr) << "--gateway needs a valid URL\n";
+            return 1;
+        }
+    }
+
+    if (!server.listen(parser.value(name))) {
+        QTextStream(stderr) << "Failed to listen on " << parser.value(name) << ": " << server.errorString() << "\n";
+        return 1;
+    }
+
+    if (!location.isEmpty()) {
+        server.discover()->discoverLocation(location);
+    }
+
+    return app.exec();
+}